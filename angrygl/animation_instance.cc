@@ -0,0 +1,140 @@
+#include "angrygl/animation_instance.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+
+namespace {
+
+const float animTransitionTime = 0.2f;
+
+enum Clip { DEATH, IDLE, FORWARD, RIGHT, BACK, LEFT, NUM_CLIPS };
+
+} // namespace
+
+AnimationInstance::AnimationInstance(const PlayerModel *model)
+    : sharedModel(model), gunJoint(model->jointIndexOf("Gun")),
+      clipCursors(NUM_CLIPS, model->compressedAnimation().cursor()) {
+  const int numJoints = model->numJoints();
+  clipPose.resize(numJoints);
+  blendedPose.resize(numJoints);
+  // Joints no clip moves keep whatever samplePose() last left, so start them
+  // at identity.
+  for (int j = 0; j < numJoints; ++j) {
+    clipPose.set(j, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f, 1.0f);
+  }
+  globals.resize(numJoints);
+  model->computeGlobals(nullptr, globals.data());
+}
+
+void AnimationInstance::setDead(float time) {
+  if (deathTime < 0.0f) {
+    deathTime = time;
+  }
+}
+
+void AnimationInstance::setInputs(const glm::vec2 movementDir, const float aimTheta) {
+  this->movementDir = movementDir;
+  this->aimTheta = aimTheta;
+}
+
+void AnimationInstance::evaluate(const float time) {
+  const aiAnimation *const anim = sharedModel->animation();
+  blendedPose.clear();
+  const auto processAnim = [this, anim, time](
+      const Clip clip,
+      const float weight,
+      const float minTicks,
+      const float maxTicks,
+      const float tickOffset,
+      // For non-looped
+      const float* opt_animStart = nullptr) {
+    if (weight == 0.0f) {
+      return;
+    }
+    const float tickRange = maxTicks - minTicks;
+    float targetAnimTicks = opt_animStart
+        ? std::min((float)((time - *opt_animStart) * anim->mTicksPerSecond + tickOffset), tickRange)
+        : fmod(time * anim->mTicksPerSecond + tickOffset, tickRange);
+    targetAnimTicks += minTicks;
+    if (targetAnimTicks < (minTicks - 0.01f) || targetAnimTicks > (maxTicks + 0.01f)) {
+      std::cerr << targetAnimTicks << std::endl;
+      exit(1);
+    }
+    sharedModel->samplePose(targetAnimTicks, &clipPose, &clipCursors[clip]);
+    accumulatePose(clipPose, weight, &blendedPose);
+  };
+  const bool isMoving = glm::length(movementDir) > 0.1f;
+  const float movementTheta = atan(movementDir.x / movementDir.y) + (movementDir.y < 0.0f ? 3.14f : 0.0f);
+  const float thetaDelta = movementTheta - aimTheta;
+  const glm::vec2 movementAnim(sin(thetaDelta), cos(thetaDelta));
+
+  const float deltaTime = time - lastTime;
+  lastTime = time;
+  prevIdleWeight = std::max(0.0f, prevIdleWeight - deltaTime / animTransitionTime);
+  prevRightWeight = std::max(0.0f, prevRightWeight - deltaTime / animTransitionTime);
+  prevLeftWeight = std::max(0.0f, prevLeftWeight - deltaTime / animTransitionTime);
+  prevForwardWeight = std::max(0.0f, prevForwardWeight - deltaTime / animTransitionTime);
+  prevBackWeight = std::max(0.0f, prevBackWeight - deltaTime / animTransitionTime);
+
+  const bool isDead = deathTime >= 0.0f;
+  float deathWeight = isDead ? 1.0f : 0.0f;
+  float idleWeight = prevIdleWeight + ((isDead || isMoving) ? 0.0f : 1.0f);
+  float rightWeight = prevRightWeight + (isMoving ? std::max(0.0f, -movementAnim.x) : 0.0f);
+  float forwardWeight = prevForwardWeight + (isMoving ? std::max(0.0f, movementAnim.y) : 0.0f);
+  float backWeight = prevBackWeight + (isMoving ? std::max(0.0f, -movementAnim.y) : 0.0f);
+  float leftWeight = prevLeftWeight + (isMoving ? std::max(0.0f, movementAnim.x) : 0.0f);
+  const float weightSum = deathWeight + idleWeight + rightWeight + forwardWeight + backWeight + leftWeight;
+  deathWeight /= weightSum;
+  idleWeight /= weightSum;
+  rightWeight /= weightSum;
+  forwardWeight /= weightSum;
+  backWeight /= weightSum;
+  leftWeight /= weightSum;
+  prevIdleWeight = std::max(prevIdleWeight, idleWeight);
+  prevRightWeight = std::max(rightWeight, prevRightWeight);
+  prevLeftWeight = std::max(prevLeftWeight, leftWeight);
+  prevForwardWeight = std::max(prevForwardWeight, forwardWeight);
+  prevBackWeight = std::max(prevBackWeight, backWeight);
+  if (abs(rightWeight + forwardWeight + backWeight + leftWeight + idleWeight + deathWeight - 1.0f) > 0.001f) {
+    std::cerr << "anims did not add to 1.0f" << std::endl;
+    std::cerr << "aimTheta: " << aimTheta << std::endl;
+    std::cerr << "idleWeight: " << idleWeight << std::endl;
+    std::cerr << "deathWeight: " << deathWeight << std::endl;
+    std::cerr << "rightWeight: " << rightWeight << std::endl;
+    std::cerr << "forwardWeight: " << forwardWeight << std::endl;
+    std::cerr << "backWeight: " << backWeight << std::endl;
+    std::cerr << "leftWeight: " << leftWeight << std::endl;
+    exit(1);
+  }
+
+  processAnim(DEATH, deathWeight, 234.0f, 293.0f, 0.0f, &deathTime);
+  processAnim(IDLE, idleWeight, 55.0f, 130.0f, 0.0f);
+  const float movementAnimDur = 20.0f;
+  processAnim(FORWARD, forwardWeight, 134.0f, 134.0f + movementAnimDur, 0.0f);
+  processAnim(RIGHT, rightWeight, 184.0f, 184.0f + movementAnimDur, 10.0f);
+  processAnim(BACK, backWeight, 159.0f, 159.0f + movementAnimDur, 10.0f);
+  processAnim(LEFT, leftWeight, 209.0f, 209.0f + movementAnimDur, 0.0f);
+
+  normalizePose(&blendedPose);
+  sharedModel->computeGlobals(&blendedPose, globals.data());
+}
+
+void AnimationInstance::evaluateAll(ThreadPool *pool, AnimationInstance *const *instances,
+                                    const int count, const float time) {
+  pool->parallelFor(count, [instances, time](int i) { instances[i]->evaluate(time); });
+}
+
+glm::mat4 AnimationInstance::gunTransform() const {
+  if (gunJoint < 0) {
+    return glm::mat4(1.0f);
+  }
+  const aiMatrix4x4 &gunAiMat = globals[gunJoint];
+  glm::mat4 transform;
+  for (int i = 0; i < 4; ++i) {
+    for (int j = 0; j < 4; ++j) {
+      transform[j][i] = gunAiMat[i][j];
+    }
+  }
+  return transform;
+}
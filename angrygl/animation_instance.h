@@ -0,0 +1,58 @@
+#ifndef _SD_ANG_ANIMATION_INSTANCE_H_
+#define _SD_ANG_ANIMATION_INSTANCE_H_
+
+#include <vector>
+
+#include "angrygl/player_model.h"
+#include "angrygl/pose.h"
+#include "assimp/scene.h"
+#include "lib/ThreadPool.h"
+#include <glm/glm.hpp>
+
+// One character's animation state: its inputs, clip blend weights and the
+// pose they produce. The model is only read, so any number of instances can
+// share one and be evaluated at the same time.
+class AnimationInstance {
+public:
+  explicit AnimationInstance(const PlayerModel *model);
+
+  // Plays the death clip from time on. Later calls are ignored.
+  void setDead(float time);
+  // Movement and aim used by the next evaluate().
+  void setInputs(glm::vec2 movementDir, float aimTheta);
+  // Advances the blend to time and poses the skeleton.
+  void evaluate(float time);
+  // evaluate()s every instance, spread across the pool.
+  static void evaluateAll(ThreadPool *pool, AnimationInstance *const *instances,
+                          int count, float time);
+
+  const PlayerModel &model() const { return *sharedModel; }
+  // Per joint of the model, from the last evaluate().
+  const std::vector<aiMatrix4x4> &globalTransforms() const { return globals; }
+  // The "Gun" node's transform, for placing the muzzle.
+  glm::mat4 gunTransform() const;
+
+private:
+  const PlayerModel *sharedModel;
+  int gunJoint;
+
+  glm::vec2 movementDir = glm::vec2(0.0f);
+  float aimTheta = 0.0f;
+  float deathTime = -1.0f;
+  float lastTime = 0.0f;
+  // Weights last frame, fading out rather than dropping to zero.
+  float prevIdleWeight = 0.0f;
+  float prevRightWeight = 0.0f;
+  float prevForwardWeight = 0.0f;
+  float prevBackWeight = 0.0f;
+  float prevLeftWeight = 0.0f;
+
+  // One per clip, each clip's samples running forwards between loops.
+  std::vector<CompressedAnimation::Cursor> clipCursors;
+  // One clip's local pose, and the weighted blend of every clip's.
+  Pose clipPose;
+  Pose blendedPose;
+  std::vector<aiMatrix4x4> globals;
+};
+
+#endif // _SD_ANG_ANIMATION_INSTANCE_H_
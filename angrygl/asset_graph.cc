@@ -0,0 +1,136 @@
+#include "angrygl/asset_graph.h"
+
+#include <iostream>
+
+namespace {
+
+long long msBetween(std::chrono::high_resolution_clock::time_point a,
+                    std::chrono::high_resolution_clock::time_point b) {
+  return std::chrono::duration_cast<std::chrono::milliseconds>(b - a).count();
+}
+
+} // namespace
+
+AssetGraph::AssetId AssetGraph::add(const std::string& name, std::vector<AssetId> deps, int priority,
+                                    std::function<void()> cpuStage, std::function<void()> glStage) {
+  const AssetId id = assets.size();
+  Asset a;
+  a.name = name;
+  a.priority = priority;
+  a.cpuStage = std::move(cpuStage);
+  a.glStage = std::move(glStage);
+  a.numPendingDeps = deps.size();
+  for (const AssetId dep : deps) {
+    if (dep >= id) {
+      std::cerr << "Asset " << name << " depends on an asset added after it" << std::endl;
+      exit(1);
+    }
+    assets[dep].dependents.push_back(id);
+  }
+  a.deps = std::move(deps);
+  assets.push_back(std::move(a));
+  return id;
+}
+
+void AssetGraph::run(ThreadPool* const _threadPool) {
+  threadPool = _threadPool;
+  startTime = Clock::now();
+  std::unique_lock<std::mutex> lock(mutex);
+  for (AssetId id = 0; id < assets.size(); ++id) {
+    if (assets[id].numPendingDeps == 0) {
+      schedule(id);
+    }
+  }
+  while (numDone < assets.size()) {
+    condition.wait(lock, [this]() { return !glReady.empty() || numDone == assets.size(); });
+    if (glReady.empty()) {
+      break;
+    }
+    const AssetId id = glReady.top().second;
+    glReady.pop();
+    Asset& a = assets[id];
+    a.glStart = Clock::now();
+    lock.unlock();
+    a.glStage();
+    lock.lock();
+    markDone(id);
+  }
+}
+
+void AssetGraph::schedule(const AssetId id) {
+  Asset& a = assets[id];
+  a.readyTime = Clock::now();
+  if (a.cpuStage) {
+    threadPool->enqueue([this, id]() {
+      Asset& a = assets[id];
+      a.cpuStart = Clock::now();
+      a.cpuStage();
+      std::unique_lock<std::mutex> lock(mutex);
+      a.cpuEnd = Clock::now();
+      if (a.glStage) {
+        glReady.emplace(a.priority, id);
+      } else {
+        markDone(id);
+      }
+      condition.notify_one();
+    });
+  } else {
+    a.cpuStart = a.cpuEnd = a.readyTime;
+    if (a.glStage) {
+      glReady.emplace(a.priority, id);
+    } else {
+      markDone(id);
+    }
+  }
+}
+
+void AssetGraph::markDone(const AssetId id) {
+  Asset& a = assets[id];
+  a.doneTime = Clock::now();
+  if (!a.glStage) {
+    a.glStart = a.doneTime;
+  }
+  numDone++;
+  for (const AssetId dependent : a.dependents) {
+    if (--assets[dependent].numPendingDeps == 0) {
+      schedule(dependent);
+    }
+  }
+  condition.notify_one();
+}
+
+void AssetGraph::logCriticalPath() const {
+  if (assets.empty()) {
+    return;
+  }
+  // Walk back from the last asset to finish, each time following whichever
+  // dependency finished last (i.e. the one that actually held it up).
+  AssetId last = 0;
+  for (AssetId id = 1; id < assets.size(); ++id) {
+    if (assets[id].doneTime > assets[last].doneTime) {
+      last = id;
+    }
+  }
+  std::vector<AssetId> path;
+  for (AssetId id = last; id >= 0;) {
+    path.push_back(id);
+    AssetId gating = -1;
+    for (const AssetId dep : assets[id].deps) {
+      if (gating < 0 || assets[dep].doneTime > assets[gating].doneTime) {
+        gating = dep;
+      }
+    }
+    id = gating;
+  }
+  std::cout << "Asset loading took " << msBetween(startTime, assets[last].doneTime)
+            << "ms, critical path:" << std::endl;
+  for (int i = path.size() - 1; i >= 0; --i) {
+    const Asset& a = assets[path[i]];
+    std::cout << "  " << a.name
+              << ": ready at " << msBetween(startTime, a.readyTime) << "ms"
+              << ", worker wait " << msBetween(a.readyTime, a.cpuStart) << "ms"
+              << ", cpu " << msBetween(a.cpuStart, a.cpuEnd) << "ms"
+              << ", gl wait " << msBetween(a.cpuEnd, a.glStart) << "ms"
+              << ", gl " << msBetween(a.glStart, a.doneTime) << "ms" << std::endl;
+  }
+}
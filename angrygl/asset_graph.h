@@ -0,0 +1,69 @@
+#ifndef _SD_ANG_ASSET_GRAPH_H_
+#define _SD_ANG_ASSET_GRAPH_H_
+
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <queue>
+#include <string>
+#include <vector>
+
+#include "lib/ThreadPool.h"
+
+// Startup loading as a dependency graph. Each asset has an optional CPU stage
+// (file read, decode, import, mesh processing) which runs on the worker pool
+// and an optional GL stage which runs on the thread that owns the context.
+// An asset starts once all of its dependencies have finished both stages.
+class AssetGraph {
+public:
+  typedef int AssetId;
+
+  // GL stages that are ready at the same time run in increasing priority
+  // order.
+  AssetId add(const std::string& name, std::vector<AssetId> deps, int priority,
+              std::function<void()> cpuStage, std::function<void()> glStage);
+
+  // Blocks until every asset is loaded. Must be called from the GL thread.
+  void run(ThreadPool* const threadPool);
+
+  // Logs the chain of assets that bounded total load time, with how long each
+  // spent queued, on the CPU and on the GL thread.
+  void logCriticalPath() const;
+
+private:
+  typedef std::chrono::high_resolution_clock Clock;
+
+  struct Asset {
+    std::string name;
+    std::vector<AssetId> deps;
+    std::vector<AssetId> dependents;
+    int priority;
+    std::function<void()> cpuStage;
+    std::function<void()> glStage;
+    int numPendingDeps = 0;
+
+    Clock::time_point readyTime;
+    Clock::time_point cpuStart;
+    Clock::time_point cpuEnd;
+    Clock::time_point glStart;
+    Clock::time_point doneTime;
+  };
+
+  // All of these expect mutex to be held.
+  void schedule(AssetId id);
+  void markDone(AssetId id);
+
+  std::vector<Asset> assets;
+  ThreadPool* threadPool = nullptr;
+  Clock::time_point startTime;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  // (priority, id) pairs whose GL stage can run.
+  std::priority_queue<std::pair<int, AssetId>, std::vector<std::pair<int, AssetId>>,
+                      std::greater<std::pair<int, AssetId>>> glReady;
+  int numDone = 0;
+};
+
+#endif  // _SD_ANG_ASSET_GRAPH_H_
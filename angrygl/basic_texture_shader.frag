@@ -1,7 +1,11 @@
 #version 330 core
 in vec2 TexCoord;
 
-out vec4 FragColor;
+// Bullets are drawn in the transparency pass but only glow: emission adds,
+// and zeros leave the transparency targets as they were.
+layout (location = 0) out vec4 AccumColor;
+layout (location = 1) out vec4 Revealage;
+layout (location = 2) out vec4 EmissionColor;
 
 struct DirectionLight {
   vec3 dir;
@@ -24,6 +28,8 @@ void main() {
     vec3 amb = ambient * vec3(texture(texture_diffuse, TexCoord));
     color = vec4(directionLight.color, 1.0) * color * diff + vec4(amb, 1.0);
   }
-  FragColor = color;
+  AccumColor = vec4(0.0);
+  Revealage = vec4(0.0);
+  EmissionColor = vec4(color.rgb * color.a, color.a);
 }
 
@@ -4,6 +4,8 @@ in vec2 TexCoord;
 out vec4 FragColor;
 
 uniform sampler2D image;
+// Fraction of the texture that holds this frame's image, see FrameGraph::renderScale().
+uniform float uvScale;
 
 uniform bool horizontal;
 #define BLUR_DIST 28
@@ -13,19 +15,30 @@ float CalcBrightness(vec3 col) {
   return (col.x + col.y + col.z) / (3);
 }
 
+// Keeps bilinear taps from blending in stale texels beyond the scaled image.
+vec3 SampleScaled(vec2 uv) {
+  return texture(image, min(uv, uvScale - 0.5 / vec2(textureSize(image, 0)))).rgb;
+}
+
+vec3 SampleImage(vec2 uv) {
+  return any(greaterThan(uv, vec2(uvScale))) ? vec3(0.0) : SampleScaled(uv);
+}
+
 void main() {
-  vec3 baseSample = texture(image, TexCoord).rgb;
-  vec2 tex_offset = 1.0 / textureSize(image, 0); // gets size of single texel
+  vec2 uv = TexCoord * uvScale;
+  vec3 baseSample = SampleScaled(uv);
+  // Steps are a full-scale texel so the glow keeps its size on screen.
+  vec2 tex_offset = uvScale / textureSize(image, 0);
   vec3 result = baseSample * weight[0]; // current fragment's contribution
   if (horizontal) {
     for(int i = 1; i < BLUR_DIST; ++i) {
-      result += texture(image, TexCoord + vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
-      result += texture(image, TexCoord - vec2(tex_offset.x * i, 0.0)).rgb * weight[i];
+      result += SampleImage(uv + vec2(tex_offset.x * i, 0.0)) * weight[i];
+      result += SampleImage(uv - vec2(tex_offset.x * i, 0.0)) * weight[i];
     }
   } else {
     for(int i = 1; i < BLUR_DIST; ++i) {
-      result += texture(image, TexCoord + vec2(0.0, tex_offset.y * i)).rgb * weight[i];
-      result += texture(image, TexCoord - vec2(0.0, tex_offset.y * i)).rgb * weight[i];
+      result += SampleImage(uv + vec2(0.0, tex_offset.y * i)) * weight[i];
+      result += SampleImage(uv - vec2(0.0, tex_offset.y * i)) * weight[i];
     }
   }
   FragColor = vec4(result, 1.0);
@@ -13,6 +13,9 @@
 #include "glm/gtc/quaternion.hpp"
 #include "glm/gtx/vector_angle.hpp"
 #include "angrygl/capsule.h"
+#include "lib/frame_arena.h"
+#include "opengl/gl_state.h"
+#include "opengl/resource_registry.h"
 #define _USE_MATH_DEFINES
 #include <math.h>
 
@@ -23,32 +26,15 @@ const Capsule BULLET_COLLIDER(0.3f, 0.03f);
 const float pi = (float)M_PI;
 const float rotPerBullet = 3.0f * pi / 180.0f;
 
-glm::quat partialHamiltonProduct2(const glm::quat& q1, const glm::vec3& q2 /*partial*/) {
-  return glm::quat(
-    - q1.x * q2.x - q1.y * q2.y - q1.z * q2.z,
-    q1.w * q2.x + q1.y * q2.z - q1.z * q2.y,
-    q1.w * q2.y - q1.x * q2.z + q1.z * q2.x,
-    q1.w * q2.z + q1.x * q2.y - q1.y * q2.x);
-}
-
-glm::vec3 partialHamiltonProduct(const glm::quat& q1, const glm::quat& q2) {
-  return glm::vec3(
-    q1.w * q2.x + q1.x * q2.w + q1.y * q2.z - q1.z * q2.y,
-    q1.w * q2.y - q1.x * q2.z + q1.y * q2.w + q1.z * q2.x,
-    q1.w * q2.z + q1.x * q2.y - q1.y * q2.x + q1.z * q2.w);
-}
-
-glm::vec3 rotateByQuat(const glm::vec3& v, const glm::quat& q) {
-  const glm::quat qPrime = glm::quat(q.w, -q.x, -q.y, -q.z);
-  return partialHamiltonProduct(partialHamiltonProduct2(q, v), qPrime);
-}
-
 const float bulletScale = 0.3f;
 const float bulletLifetime = 1.0f; // seconds
 const glm::vec3 scaleVec(bulletScale, bulletScale, bulletScale);
 const float bulletSpeed = 15.0f; // Game units per second
 const glm::vec3 bulletNormal(0.0f, 1.0f, 0.0f);
 const glm::vec3 canonicalDir(0.0f, 0.0f, 1.0f);
+// Dead bullets are compacted out at most this often. Until then they're
+// skipped for collisions and hidden by zeroing their rotation.
+const int framesPerCompaction = 4;
 
 // TODO double sided?
 const float bulletVertices[] = {
@@ -92,11 +78,13 @@ BulletStore BulletStore::initialiseBuffersAndCreate(ThreadPool* const threadPool
   glGenBuffers(1, &bulletVBO);
   unsigned int bulletEBO;
   glGenBuffers(1, &bulletEBO);
-  glBindVertexArray(bulletVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, bulletVBO);
+  glstate::bindVertexArray(bulletVAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, bulletVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(bulletVertices), bulletVertices, GL_STATIC_DRAW);
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, bulletEBO);
+  resources::track(resources::BUFFER, bulletVBO, sizeof(bulletVertices), "bullets");
+  glstate::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, bulletEBO);
   glBufferData(GL_ELEMENT_ARRAY_BUFFER, sizeof(bulletIndices), bulletIndices, GL_STATIC_DRAW);
+  resources::track(resources::BUFFER, bulletEBO, sizeof(bulletIndices), "bullets");
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
@@ -104,14 +92,14 @@ BulletStore BulletStore::initialiseBuffersAndCreate(ThreadPool* const threadPool
 
   unsigned int instanceVBO;
   glGenBuffers(1, &instanceVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
   glEnableVertexAttribArray(2);
   glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(glm::quat), (void*)0);
   glVertexAttribDivisor(2, 1);
 
   unsigned int offsetVBO;
   glGenBuffers(1, &offsetVBO);
-  glBindBuffer(GL_ARRAY_BUFFER, offsetVBO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, offsetVBO);
   glEnableVertexAttribArray(3);
   glVertexAttribPointer(3, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)0);
   glVertexAttribDivisor(3, 1);
@@ -119,55 +107,23 @@ BulletStore BulletStore::initialiseBuffersAndCreate(ThreadPool* const threadPool
   return std::move(BulletStore(threadPool, bulletVAO, instanceVBO, offsetVBO));
 }
 
-void BulletStore::createBullets(const glm::vec3& position, const glm::vec3& midDir, const int spreadAmount) {
+void BulletStore::createBullets(const glm::vec3& position, const glm::vec3& midDir, const int spreadAmount, const bool piercing) {
   const glm::vec3 normalizedDir = glm::normalize(midDir);
+  const glm::vec3 rotVec(0.0, 1.0f, 0.0f);
+  const glm::vec3 x = glm::normalize(glm::vec3(canonicalDir.x, 0.0f, canonicalDir.z));
+  const glm::vec3 y = glm::normalize(glm::vec3(normalizedDir.x, 0.0f, normalizedDir.z));
+  const float theta = glm::orientedAngle(x, y, rotVec);
 
-  glm::quat midDirQuat(1.0f, 0.0f, 0.0f, 0.0f);
-  // TODO there's probably a more efficient way to calculate this...
-  {
-    const glm::vec3 rotVec(0.0, 1.0f, 0.0f);
-    const glm::vec3 x = glm::normalize(glm::vec3(canonicalDir.x, 0.0f, canonicalDir.z));
-    const glm::vec3 y = glm::normalize(glm::vec3(normalizedDir.x, 0.0f, normalizedDir.z));
-    const float theta = glm::orientedAngle(x, y, rotVec);
-    midDirQuat = glm::rotate(midDirQuat, theta, rotVec);
-  }
-
+  // The spread relative to the aim direction is the same for every shot, so
+  // it's built once and only the yaw is applied here.
+  const SpreadPattern& pattern = spreadPatterns.get(spreadAmount, rotPerBullet);
   const int startIndex = allBulletPositions.size();
-  const int bulletGroupSize = spreadAmount * spreadAmount;
-  BulletGroup g(startIndex, bulletGroupSize, bulletLifetime);
-  allBulletPositions.resize(startIndex + bulletGroupSize);
+  const int bulletGroupSize = pattern.numBullets;
+  allBulletPositions.resize(startIndex + bulletGroupSize, position);
   allQuats.resize(startIndex + bulletGroupSize);
   allBulletDirs.resize(startIndex + bulletGroupSize);
-  const int parallelism = threadPool->numWorkers();
-  const int workerGroupSize = spreadAmount / parallelism;
-  std::vector<std::future<void>> futures;
-  for (int p = 0; p < parallelism; ++p) {
-    const int iStart = p * workerGroupSize;
-    const int iEnd = p == (parallelism - 1) ? spreadAmount : iStart + workerGroupSize;
-    futures.emplace_back(threadPool->enqueue([this, &position, &midDirQuat, spreadAmount, startIndex, &g, iStart, iEnd]() {
-      for (int i = iStart; i < iEnd; ++i) {
-        const glm::quat yQuat = glm::rotate(
-            midDirQuat,
-            rotPerBullet * (i - spreadAmount / 2),
-            glm::vec3(0.0f, 1.0f, 0.0f));
-        for (int j = 0; j < spreadAmount; ++j) {
-          const glm::quat rotQuat = glm::rotate(
-              yQuat,
-              rotPerBullet * (j - spreadAmount / 2),
-              glm::vec3(1.0f, 0.0f, 0.0f));
-          const glm::vec3 dir = rotateByQuat(canonicalDir, rotQuat);
-          const int pos = i * spreadAmount + j + startIndex;
-          allBulletPositions[pos] = position;
-          allBulletDirs[pos] = dir;
-          allQuats[pos] = rotQuat;
-        }
-      }
-    }));
-  }
-  for (auto& future : futures) {
-    future.get();
-  }
-  bulletGroups.push_back(g);
+  pattern.applyYaw(theta, &allBulletDirs[startIndex], &allQuats[startIndex]);
+  bulletGroups.emplace_back(startIndex, bulletGroupSize, bulletLifetime, piercing);
 }
 
 void BulletStore::updateBullets(float deltaTimeSeconds, std::vector<Enemy>* enemies, std::vector<SpritesheetSprite>* enemyDeathSprites) {
@@ -179,16 +135,19 @@ void BulletStore::updateBullets(float deltaTimeSeconds, std::vector<Enemy>* enem
   const float deltaPosMagnitude = deltaTimeSeconds * bulletSpeed;
   int firstLiveBulletGroup = 0;
 
-  // True iff enemies[i] is dead from bullet collision.
-  std::vector<bool> enemyDeathMarker(enemies->size());
+  // Nonzero iff enemies[i] is dead from bullet collision. Bytes rather than
+  // vector<bool> bits, which groups on different threads can't set safely.
+  ArenaVector<char> enemyDeathMarker(enemies->size(), 0);
 
-  std::vector<std::future<void>> futures;
   for (BulletGroup& g : bulletGroups) {
     g.TTL -= deltaTimeSeconds;
     if (g.TTL <= 0.0f) {
       firstLiveBulletGroup++;
-    } else {
-      futures.emplace_back(threadPool->enqueue([this, numSubGroups, useAABB, deltaPosMagnitude, &enemies, &g, &enemyDeathMarker]() {
+    }
+  }
+  threadPool->parallelFor(bulletGroups.size() - firstLiveBulletGroup,
+      [this, numSubGroups, useAABB, deltaPosMagnitude, firstLiveBulletGroup, &enemies, &enemyDeathMarker](const int groupIdx) {
+        BulletGroup& g = bulletGroups[firstLiveBulletGroup + groupIdx];
         const int bulletGroupStartIdx = g.startIndex;
         const int numBulletsInGroup = g.groupSize;
         const int subgroupSize = numBulletsInGroup / numSubGroups;
@@ -217,20 +176,23 @@ void BulletStore::updateBullets(float deltaTimeSeconds, std::vector<Enemy>* enem
               continue;
             }
             for (int bulletIdx = bulletsStart; bulletIdx < bulletsEnd; ++bulletIdx) {
+              const int idxInGroup = bulletIdx - bulletGroupStartIdx;
+              if (!g.piercing && !g.isAlive(idxInGroup)) {
+                continue;
+              }
               if (bulletCollidesWithEnemy(allBulletPositions[bulletIdx], allBulletDirs[bulletIdx], e)) {
-                // TODO kill bullet too? ... angry bots ECS version doesn't...
-                enemyDeathMarker[i] = true;
+                enemyDeathMarker[i] = 1;
+                if (!g.piercing) {
+                  g.kill(idxInGroup);
+                  // A zero quaternion collapses the instance to a point.
+                  allQuats[bulletIdx] = glm::quat(0.0f, 0.0f, 0.0f, 0.0f);
+                }
                 break;
               }
             }
           }
         }
-      }));
-    }
-  }
-  for (auto& future : futures) {
-    future.get();
-  }
+      });
   int firstLivingBullet = 0;
   if (firstLiveBulletGroup != 0) {
     firstLivingBullet = bulletGroups[firstLiveBulletGroup - 1].startIndex + bulletGroups[firstLiveBulletGroup - 1].groupSize;
@@ -244,6 +206,10 @@ void BulletStore::updateBullets(float deltaTimeSeconds, std::vector<Enemy>* enem
       g.startIndex -= firstLivingBullet;
     }
   }
+  if (++framesSinceCompaction >= framesPerCompaction) {
+    compactBullets();
+    framesSinceCompaction = 0;
+  }
   for (int i = (enemies->size() - 1); i >= 0; --i) {
     if (enemyDeathMarker[i]) {
       enemyDeathSprites->emplace_back((*enemies)[i].position);
@@ -252,17 +218,72 @@ void BulletStore::updateBullets(float deltaTimeSeconds, std::vector<Enemy>* enem
   }
 }
 
+void BulletStore::compactBullets() {
+  bool anyDead = false;
+  for (const BulletGroup& g : bulletGroups) {
+    anyDead |= g.numAlive < g.groupSize;
+  }
+  if (!anyDead) {
+    return;
+  }
+  // Groups are contiguous and in TTL order, so sliding each group's live
+  // bullets down to a single write cursor keeps that ordering intact.
+  int dst = 0;
+  for (BulletGroup& g : bulletGroups) {
+    const int src = g.startIndex;
+    if (g.numAlive == g.groupSize) {
+      if (dst != src) {
+        std::move(allBulletPositions.begin() + src, allBulletPositions.begin() + src + g.groupSize, allBulletPositions.begin() + dst);
+        std::move(allQuats.begin() + src, allQuats.begin() + src + g.groupSize, allQuats.begin() + dst);
+        std::move(allBulletDirs.begin() + src, allBulletDirs.begin() + src + g.groupSize, allBulletDirs.begin() + dst);
+      }
+    } else {
+      int w = dst;
+      for (int i = 0; i < g.groupSize; ++i) {
+        if (g.isAlive(i)) {
+          allBulletPositions[w] = allBulletPositions[src + i];
+          allQuats[w] = allQuats[src + i];
+          allBulletDirs[w] = allBulletDirs[src + i];
+          w++;
+        }
+      }
+      g.groupSize = g.numAlive;
+      g.aliveMask.assign((g.groupSize + 31) / 32, 0xFFFFFFFFu);
+    }
+    g.startIndex = dst;
+    dst += g.groupSize;
+  }
+  allBulletPositions.resize(dst);
+  allQuats.resize(dst);
+  allBulletDirs.resize(dst);
+  bulletGroups.erase(
+      std::remove_if(
+          bulletGroups.begin(),
+          bulletGroups.end(),
+          [](const BulletGroup& g) {
+            return g.groupSize == 0;
+          }),
+      bulletGroups.end());
+}
+
 void BulletStore::renderBulletSprites() {
-  if (bulletGroups.size() == 0) {
+  if (bulletGroups.size() == 0 || allQuats.size() == 0) {
     return;
   }
-  glBindVertexArray(VAO);
+  glstate::bindVertexArray(VAO);
 
-  glBindBuffer(GL_ARRAY_BUFFER, instanceVBO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, instanceVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(glm::quat) * allQuats.size(), &allQuats[0], GL_STREAM_DRAW);
+  resources::track(resources::BUFFER, instanceVBO, sizeof(glm::quat) * allQuats.size(), "bullets");
 
-  glBindBuffer(GL_ARRAY_BUFFER, offsetVBO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, offsetVBO);
 
   glBufferData(GL_ARRAY_BUFFER, sizeof(glm::vec3) * allBulletPositions.size(), &allBulletPositions[0], GL_STREAM_DRAW);
+  resources::track(resources::BUFFER, offsetVBO, sizeof(glm::vec3) * allBulletPositions.size(), "bullets");
+  resources::trackCpu(this,
+                      allBulletPositions.capacity() * sizeof(glm::vec3) +
+                      allQuats.capacity() * sizeof(glm::quat) +
+                      allBulletDirs.capacity() * sizeof(glm::vec3),
+                      "bullets");
   glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_INT, 0, allBulletPositions.size());
 }
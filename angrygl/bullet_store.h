@@ -1,10 +1,12 @@
 #ifndef _SD_ANG_BULLET_STORE_H_
 #define _SD_ANG_BULLET_STORE_H_
 
+#include <cstdint>
 #include <vector>
 
 #include "angrygl/spritesheet.h"
 #include "angrygl/enemy.h"
+#include "angrygl/spread_pattern.h"
 #include "glm/glm.hpp"
 #include "lib/ThreadPool.h"
 
@@ -12,11 +14,25 @@ class BulletStore {
 public:
   static BulletStore initialiseBuffersAndCreate(ThreadPool* const threadPool);
 
-  void createBullets(const glm::vec3& position, const glm::vec3& midDir, const int spreadAmount);
+  // Non-piercing bullets die on their first hit, piercing ones keep going
+  // until their group's TTL runs out.
+  void createBullets(const glm::vec3& position, const glm::vec3& midDir, const int spreadAmount, const bool piercing);
 
   void updateBullets(float deltaTimeSeconds, std::vector<Enemy>* enemies, std::vector<SpritesheetSprite>* enemyDeathSprites);
 
   void renderBulletSprites();
+
+  // Calls f(position) for every live bullet, oldest group first.
+  template <class F>
+  void forEachLiveBullet(F&& f) const {
+    for (const BulletGroup& g : bulletGroups) {
+      for (int i = 0; i < g.groupSize; ++i) {
+        if (g.isAlive(i)) {
+          f(allBulletPositions[g.startIndex + i]);
+        }
+      }
+    }
+  }
  private:
   std::vector<glm::vec3> allBulletPositions;
   std::vector<glm::quat> allQuats;
@@ -26,23 +42,42 @@ public:
     int startIndex;
     int groupSize;
     float TTL;
+    bool piercing;
+    int numAlive;
+    // Bit i is set while bullet startIndex + i is live. Bullets are only
+    // removed from the store when the group is compacted.
+    std::vector<uint32_t> aliveMask;
 
-    BulletGroup(int _startIndex, int _groupSize, float lifetime)
+    BulletGroup(int _startIndex, int _groupSize, float lifetime, bool _piercing)
     {
       TTL = lifetime;
       startIndex = _startIndex;
       groupSize = _groupSize;
+      piercing = _piercing;
+      numAlive = _groupSize;
+      aliveMask.assign((_groupSize + 31) / 32, 0xFFFFFFFFu);
+    }
+
+    bool isAlive(int i) const { return (aliveMask[i >> 5] >> (i & 31)) & 1u; }
+    void kill(int i) {
+      aliveMask[i >> 5] &= ~(1u << (i & 31));
+      numAlive--;
     }
   };
   BulletStore(ThreadPool* const _threadPool, unsigned int _VAO, unsigned int _instanceVBO, unsigned int _offsetVBO)
     : threadPool(_threadPool), VAO(_VAO), instanceVBO(_instanceVBO), offsetVBO(_offsetVBO) {}
 
+  // Squeezes dead bullets out of the store, keeping groups in FIFO order.
+  void compactBullets();
+
   ThreadPool* const threadPool;
   const unsigned int VAO;
   const unsigned int instanceVBO;
   const unsigned int offsetVBO;
   // Must be ordered in increasing TTL
   std::vector<BulletGroup> bulletGroups;
+  SpreadPatternCache spreadPatterns;
+  int framesSinceCompaction = 0;
 };
 
 #endif // _SD_ANG_BULLET_STORE_H_
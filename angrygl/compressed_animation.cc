@@ -0,0 +1,265 @@
+#include "angrygl/compressed_animation.h"
+
+#include <algorithm>
+#include <array>
+#include <cmath>
+
+namespace {
+
+typedef std::array<float, 4> KeyValue;
+
+// Range of the three smallest components of a unit quaternion.
+const float sqrtHalf = 0.70710678f;
+
+unsigned short quantise(const float v, const float min, const float extent) {
+  if (extent <= 0.0f) {
+    return 0;
+  }
+  return (unsigned short)lroundf(std::min(std::max((v - min) / extent, 0.0f), 1.0f) * 65535.0f);
+}
+
+// Drops the largest component, which the others and the unit length give
+// back, after flipping the quaternion to make it positive. Its index goes in
+// the top bits of the first two values.
+void encodeRotation(const KeyValue &q, unsigned short out[3]) {
+  int largest = 0;
+  for (int i = 1; i < 4; ++i) {
+    if (std::abs(q[i]) > std::abs(q[largest])) {
+      largest = i;
+    }
+  }
+  const float sign = q[largest] < 0.0f ? -1.0f : 1.0f;
+  for (int i = 0, k = 0; i < 4; ++i) {
+    if (i == largest) {
+      continue;
+    }
+    const float c = std::min(std::max(sign * q[i] / sqrtHalf, -1.0f), 1.0f);
+    out[k++] = (unsigned short)lroundf((0.5f * c + 0.5f) * 32767.0f);
+  }
+  out[0] |= (largest & 1) << 15;
+  out[1] |= (largest >> 1) << 15;
+}
+
+void decodeRotation(const unsigned short in[3], float out[4]) {
+  const int largest = (in[0] >> 15) | ((in[1] >> 15) << 1);
+  float sumSquares = 0.0f;
+  for (int i = 0, k = 0; i < 4; ++i) {
+    if (i == largest) {
+      continue;
+    }
+    out[i] = ((in[k++] & 0x7fff) / 32767.0f * 2.0f - 1.0f) * sqrtHalf;
+    sumSquares += out[i] * out[i];
+  }
+  out[largest] = std::sqrt(std::max(0.0f, 1.0f - sumSquares));
+}
+
+float dot4(const float *a, const float *b) {
+  return a[0] * b[0] + a[1] * b[1] + a[2] * b[2] + a[3] * b[3];
+}
+
+// Linear for vectors, nlerp the short way round for rotations.
+void interpolate(const float *a, const float *b, const float f, const bool isRotation,
+                 float *out) {
+  if (!isRotation) {
+    for (int i = 0; i < 3; ++i) {
+      out[i] = a[i] + (b[i] - a[i]) * f;
+    }
+    return;
+  }
+  const float sign = dot4(a, b) < 0.0f ? -1.0f : 1.0f;
+  for (int i = 0; i < 4; ++i) {
+    out[i] = a[i] + (sign * b[i] - a[i]) * f;
+  }
+  const float length = std::sqrt(dot4(out, out));
+  for (int i = 0; i < 4; ++i) {
+    out[i] = length > 0.0f ? out[i] / length : (i == 3 ? 1.0f : 0.0f);
+  }
+}
+
+// Distance for vectors, angle for rotations.
+float keyError(const float *a, const float *b, const bool isRotation) {
+  if (isRotation) {
+    return 2.0f * std::acos(std::min(1.0f, std::abs(dot4(a, b))));
+  }
+  return std::sqrt((a[0] - b[0]) * (a[0] - b[0]) + (a[1] - b[1]) * (a[1] - b[1]) +
+                   (a[2] - b[2]) * (a[2] - b[2]));
+}
+
+// Greedily extends each segment from the last kept key while interpolating
+// across it stays within tolerance of every key it skips.
+std::vector<int> reduceKeys(const std::vector<double> &times, const std::vector<KeyValue> &values,
+                            const bool isRotation, const float tolerance) {
+  const int n = times.size();
+  bool constant = true;
+  for (int i = 1; i < n && constant; ++i) {
+    constant = keyError(values[i].data(), values[0].data(), isRotation) <= tolerance;
+  }
+  if (n <= 1 || constant) {
+    return std::vector<int>(std::min(n, 1), 0);
+  }
+  std::vector<int> kept = {0};
+  for (int i = 1; i < n - 1; ++i) {
+    const int a = kept.back();
+    const int b = i + 1;
+    bool fits = times[b] > times[a];
+    for (int j = a + 1; j <= i && fits; ++j) {
+      float interpolated[4];
+      interpolate(values[a].data(), values[b].data(),
+                  (times[j] - times[a]) / (times[b] - times[a]), isRotation, interpolated);
+      fits = keyError(interpolated, values[j].data(), isRotation) <= tolerance;
+    }
+    if (!fits) {
+      kept.push_back(i);
+    }
+  }
+  kept.push_back(n - 1);
+  return kept;
+}
+
+} // namespace
+
+CompressedAnimation::CompressedAnimation(const aiAnimation *anim, const Tolerance &tolerance)
+    : numChannels(anim->mNumChannels) {
+  timeScale = anim->mDuration > 0.0 ? 65535.0 / anim->mDuration : 0.0f;
+  float largestTranslation = 0.0f;
+  for (int c = 0; c < numChannels; ++c) {
+    const aiNodeAnim *const a = anim->mChannels[c];
+    for (int k = 0; k < a->mNumPositionKeys; ++k) {
+      const aiVector3D &v = a->mPositionKeys[k].mValue;
+      largestTranslation = std::max({largestTranslation, std::abs(v.x), std::abs(v.y), std::abs(v.z)});
+    }
+  }
+  const float tolerances[NUM_TRACKS] = {
+      tolerance.translation * largestTranslation, tolerance.rotation, tolerance.scale};
+
+  tracks.resize(NUM_TRACKS * numChannels);
+  for (int c = 0; c < numChannels; ++c) {
+    const aiNodeAnim *const a = anim->mChannels[c];
+    for (int type = 0; type < NUM_TRACKS; ++type) {
+      const bool isRotation = type == ROTATION;
+      std::vector<double> keyTimes;
+      std::vector<KeyValue> keyValues;
+      if (isRotation) {
+        for (int k = 0; k < a->mNumRotationKeys; ++k) {
+          aiQuaternion q = a->mRotationKeys[k].mValue;
+          q.Normalize();
+          KeyValue v = {q.x, q.y, q.z, q.w};
+          // Neighbours in the same hemisphere, so interpolating between any
+          // two kept keys passes near the ones dropped.
+          if (!keyValues.empty() && dot4(v.data(), keyValues.back().data()) < 0.0f) {
+            v = {-v[0], -v[1], -v[2], -v[3]};
+          }
+          keyTimes.push_back(a->mRotationKeys[k].mTime);
+          keyValues.push_back(v);
+        }
+        numOriginalBytes += a->mNumRotationKeys * sizeof(aiQuatKey);
+      } else {
+        const aiVectorKey *keys = type == TRANSLATION ? a->mPositionKeys : a->mScalingKeys;
+        const int numKeys = type == TRANSLATION ? a->mNumPositionKeys : a->mNumScalingKeys;
+        for (int k = 0; k < numKeys; ++k) {
+          keyTimes.push_back(keys[k].mTime);
+          keyValues.push_back({keys[k].mValue.x, keys[k].mValue.y, keys[k].mValue.z, 0.0f});
+        }
+        numOriginalBytes += numKeys * sizeof(aiVectorKey);
+      }
+      numOriginalKeys += keyTimes.size();
+
+      const std::vector<int> kept = reduceKeys(keyTimes, keyValues, isRotation, tolerances[type]);
+      Track &track = tracks[c * NUM_TRACKS + type];
+      track.first = times.size();
+      track.count = kept.size();
+      if (!isRotation && !kept.empty()) {
+        for (int i = 0; i < 3; ++i) {
+          float min = keyValues[kept[0]][i];
+          float max = min;
+          for (const int k : kept) {
+            min = std::min(min, keyValues[k][i]);
+            max = std::max(max, keyValues[k][i]);
+          }
+          track.min[i] = min;
+          track.extent[i] = max - min;
+        }
+      }
+      for (const int k : kept) {
+        times.push_back(quantise(keyTimes[k] * timeScale, 0.0f, 65535.0f));
+        unsigned short packed[3];
+        if (isRotation) {
+          encodeRotation(keyValues[k], packed);
+        } else {
+          for (int i = 0; i < 3; ++i) {
+            packed[i] = quantise(keyValues[k][i], track.min[i], track.extent[i]);
+          }
+        }
+        values.insert(values.end(), packed, packed + 3);
+      }
+    }
+  }
+}
+
+size_t CompressedAnimation::compressedBytes() const {
+  return (times.size() + values.size()) * sizeof(unsigned short) + tracks.size() * sizeof(Track);
+}
+
+int CompressedAnimation::findKey(const Track &track, const float time, int *cursorKey) const {
+  const unsigned short *const keyTimes = &times[track.first];
+  int i = cursorKey ? *cursorKey : track.count;
+  if (i >= track.count || keyTimes[i] > time) {
+    i = std::max(0, (int)(std::upper_bound(keyTimes, keyTimes + track.count, time) - keyTimes) - 1);
+  } else {
+    while (i + 1 < track.count && keyTimes[i + 1] <= time) {
+      ++i;
+    }
+  }
+  if (cursorKey) {
+    *cursorKey = i;
+  }
+  return i;
+}
+
+void CompressedAnimation::decodeKey(const TrackType type, const Track &track, const int key,
+                                    float *out) const {
+  const unsigned short *const in = &values[3 * (track.first + key)];
+  if (type == ROTATION) {
+    decodeRotation(in, out);
+    return;
+  }
+  for (int i = 0; i < 3; ++i) {
+    out[i] = track.min[i] + track.extent[i] * (in[i] / 65535.0f);
+  }
+}
+
+void CompressedAnimation::sampleTrack(const int t, const float time, Cursor *cursor,
+                                      float *out) const {
+  const Track &track = tracks[t];
+  const TrackType type = (TrackType)(t % NUM_TRACKS);
+  if (track.count == 0) {
+    const float identity = type == SCALE ? 1.0f : 0.0f;
+    out[0] = out[1] = out[2] = identity;
+    if (type == ROTATION) {
+      out[3] = 1.0f;
+    }
+    return;
+  }
+  const int i = findKey(track, time, cursor ? &cursor->keys[t] : nullptr);
+  decodeKey(type, track, i, out);
+  if (i + 1 >= track.count) {
+    return;
+  }
+  const float t0 = times[track.first + i];
+  const float t1 = times[track.first + i + 1];
+  if (time <= t0 || t1 <= t0) {
+    return;
+  }
+  float a[4], b[4];
+  std::copy(out, out + (type == ROTATION ? 4 : 3), a);
+  decodeKey(type, track, i + 1, b);
+  interpolate(a, b, std::min(1.0f, (time - t0) / (t1 - t0)), type == ROTATION, out);
+}
+
+void CompressedAnimation::sample(const int channel, const float ticks, Cursor *cursor,
+                                 float translation[3], float rotation[4], float scale[3]) const {
+  const float time = std::min(std::max(ticks * timeScale, 0.0f), 65535.0f);
+  sampleTrack(channel * NUM_TRACKS + TRANSLATION, time, cursor, translation);
+  sampleTrack(channel * NUM_TRACKS + ROTATION, time, cursor, rotation);
+  sampleTrack(channel * NUM_TRACKS + SCALE, time, cursor, scale);
+}
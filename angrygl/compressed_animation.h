@@ -0,0 +1,81 @@
+#ifndef _SD_ANG_COMPRESSED_ANIMATION_H_
+#define _SD_ANG_COMPRESSED_ANIMATION_H_
+
+#include <cstddef>
+#include <vector>
+
+#include "assimp/anim.h"
+
+// An assimp animation with the keys that interpolation can recreate dropped,
+// and the rest quantised to 6 bytes of value and 2 of time: translations and
+// scales to 16 bits a component within their track's range, rotations as the
+// smallest three components of the quaternion at 15 bits each. Samples
+// interpolate linearly between keys, nlerping rotations.
+class CompressedAnimation {
+public:
+  // How far a dropped key may be from the interpolated curve. Translation is
+  // a fraction of the largest translation in the animation, rotation is in
+  // radians.
+  struct Tolerance {
+    float translation;
+    float rotation;
+    float scale;
+  };
+
+  // Where each track was last sampled, so a run of samples at increasing
+  // times finds its keys in O(1). Keep one per run, e.g. per looping clip;
+  // going backwards falls back to a binary search.
+  class Cursor {
+  public:
+    Cursor() {}
+
+  private:
+    friend class CompressedAnimation;
+    explicit Cursor(int numTracks) : keys(numTracks, 0) {}
+    std::vector<int> keys;
+  };
+
+  CompressedAnimation() {}
+  CompressedAnimation(const aiAnimation *anim, const Tolerance &tolerance);
+
+  Cursor cursor() const { return Cursor(NUM_TRACKS * numChannels); }
+
+  // Writes channel's pose at ticks, rotation as x, y, z, w. cursor may be
+  // null.
+  void sample(int channel, float ticks, Cursor *cursor, float translation[3], float rotation[4],
+              float scale[3]) const;
+
+  int originalKeys() const { return numOriginalKeys; }
+  int keptKeys() const { return times.size(); }
+  size_t originalBytes() const { return numOriginalBytes; }
+  size_t compressedBytes() const;
+
+private:
+  enum TrackType { TRANSLATION, ROTATION, SCALE, NUM_TRACKS };
+
+  struct Track {
+    // Index of the track's first key in times, and 3 * that in values.
+    int first = 0;
+    int count = 0;
+    // Decode range for translations and scales.
+    float min[3] = {0.0f, 0.0f, 0.0f};
+    float extent[3] = {0.0f, 0.0f, 0.0f};
+  };
+
+  int findKey(const Track &track, float time, int *cursorKey) const;
+  void sampleTrack(int track, float time, Cursor *cursor, float *out) const;
+  void decodeKey(TrackType type, const Track &track, int key, float *out) const;
+
+  // Quantised to [0, 65535] over the duration.
+  float timeScale = 0.0f;
+  // NUM_TRACKS per channel.
+  std::vector<Track> tracks;
+  std::vector<unsigned short> times;
+  // 3 per key.
+  std::vector<unsigned short> values;
+  int numChannels = 0;
+  int numOriginalKeys = 0;
+  size_t numOriginalBytes = 0;
+};
+
+#endif // _SD_ANG_COMPRESSED_ANIMATION_H_
@@ -4,6 +4,16 @@ layout (location = 0) in vec3 aPos;
 uniform mat4 lightSpaceMatrix;
 uniform mat4 model;
 
+// See player_shader.vert.
+layout (std140) uniform LateLatched {
+  mat4 aimCorrection;
+};
+
+// Packed positions, see opengl/packed_vertex.h.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
 void main() {
-  gl_Position = lightSpaceMatrix * model * vec4(aPos, 1.0);
+  gl_Position = lightSpaceMatrix * model * aimCorrection *
+                vec4(positionOffset + positionScale * aPos, 1.0);
 }
@@ -3,7 +3,8 @@ in vec2 TexCoord;
 in vec4 FragPosLightSpace;
 in vec3 FragWorldPos;
 
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 EmissionColor;
 
 struct DirectionLight {
   vec3 dir;
@@ -11,49 +12,88 @@ struct DirectionLight {
 };
 uniform DirectionLight directionLight;
 
-struct PointLight {
-  vec3 worldPos;
-  vec3 color;
-};
-uniform PointLight pointLight;
-uniform bool usePointLight;
+// Point lights, binned into froxels by LightClusters. See
+// opengl/light_clusters.h.
+uniform samplerBuffer clusterLights;
+uniform usamplerBuffer clusterGrid;
+uniform usamplerBuffer clusterIndices;
+uniform ivec3 clusterDims;
+// Tiles per pixel.
+uniform vec2 clusterTileScale;
+uniform vec2 clusterDepthRange;
+// slice = log(view depth) * x + y
+uniform vec2 clusterSliceScaleBias;
 
-uniform sampler2D texture_diffuse;
-uniform sampler2D texture_normal;
-uniform sampler2D texture_spec;
+#define MAX_MATERIALS 16
+// Layers of the selected material: x diffuse, y spec, z normal, w emission;
+// -1 for roles it doesn't have.
+uniform ivec4 material_layers[MAX_MATERIALS];
+uniform int material;
+uniform sampler2DArray texture_diffuse;
+uniform sampler2DArray texture_normal;
+uniform sampler2DArray texture_spec;
 uniform bool useLight;
 uniform bool useSpec;
 uniform vec3 ambient;
-uniform sampler2D shadow_map;
+uniform sampler2DShadow shadow_map;
+// Taps per side are 2 * shadowPcfRadius + 1, each a bilinear 2x2 hardware
+// comparison.
+uniform int shadowPcfRadius;
 uniform vec3 viewPos;
 
-float ShadowCalculation(float bias, vec4 fragPosLightSpace, vec2 offset) {
+float ShadowCalculation(float bias, vec4 fragPosLightSpace) {
   vec3 projCoords = fragPosLightSpace.xyz / fragPosLightSpace.w;
   projCoords = projCoords * 0.5 + 0.5;
-  float closestDepth = texture(shadow_map, projCoords.xy + offset).r;
-  float currentDepth = projCoords.z;
   bias = 0.001;
-  float shadow = (currentDepth - bias) > closestDepth ? 1.0 : 0.0;
-  return shadow;
+  vec2 texelSize = 1.0 / textureSize(shadow_map, 0);
+  float lit = 0.0;
+  for (int x = -shadowPcfRadius; x <= shadowPcfRadius; ++x) {
+    for (int y = -shadowPcfRadius; y <= shadowPcfRadius; ++y) {
+      lit += texture(shadow_map, vec3(projCoords.xy + vec2(x, y) * texelSize, projCoords.z - bias));
+    }
+  }
+  float taps = float((2 * shadowPcfRadius + 1) * (2 * shadowPcfRadius + 1));
+  return 1.0 - lit / taps;
+}
+
+// Diffuse light reaching worldPos from the lights in this fragment's froxel.
+vec3 clusteredPointLights(vec3 worldPos, vec3 normal) {
+  float nearPlane = clusterDepthRange.x;
+  float farPlane = clusterDepthRange.y;
+  float viewDepth = nearPlane * farPlane / (farPlane - gl_FragCoord.z * (farPlane - nearPlane));
+  ivec3 froxel = ivec3(ivec2(gl_FragCoord.xy * clusterTileScale),
+                       int(floor(log(viewDepth) * clusterSliceScaleBias.x + clusterSliceScaleBias.y)));
+  froxel = clamp(froxel, ivec3(0), clusterDims - 1);
+  int cluster = (froxel.z * clusterDims.y + froxel.y) * clusterDims.x + froxel.x;
+  uvec2 range = texelFetch(clusterGrid, cluster).xy;
+  vec3 total = vec3(0.0);
+  for (uint i = 0u; i < range.y; ++i) {
+    int light = int(texelFetch(clusterIndices, int(range.x + i)).x);
+    vec4 posRange = texelFetch(clusterLights, 2 * light);
+    vec3 lightColor = texelFetch(clusterLights, 2 * light + 1).rgb;
+    vec3 toLight = posRange.xyz - worldPos;
+    float distance = length(toLight);
+    float diff = max(dot(normal, toLight / max(distance, 0.0001)), 0.0);
+    // Windowed to reach zero at the light's range.
+    float window = clamp(1.0 - pow(distance / posRange.w, 4.0), 0.0, 1.0);
+    float attenuation = window * window / (0.05 + 0.5 * distance + 3.0 * distance * distance);
+    total += lightColor * diff * attenuation;
+  }
+  return total;
 }
 
 void main() {
-  vec4 color = texture(texture_diffuse, TexCoord);
+  ivec4 layers = material_layers[material];
+  vec3 diffuseCoord = vec3(TexCoord, layers.x);
+  vec4 color = texture(texture_diffuse, diffuseCoord);
   if (useLight) {
-    vec2 texelSize = 1.0 / textureSize(shadow_map, 0);
     vec3 lightDir = normalize(-directionLight.dir);
-    vec3 normal = vec3(texture(texture_normal, TexCoord));
+    vec3 normal = vec3(texture(texture_normal, vec3(TexCoord, layers.z)));
     normal = normalize(normal * 2.0 - 1.0);
     float diff = max(dot(normal, lightDir), 0.0);
-    vec3 amb = ambient * vec3(texture(texture_diffuse, TexCoord));
+    vec3 amb = ambient * vec3(texture(texture_diffuse, diffuseCoord));
     float bias = max(0.05 * (1.0 - dot(normal, lightDir)), 0.005);
-    float shadow = 0.0;
-    for (int x = -1; x <= 1; ++x) {
-      for (int y = -1; y <= 1; ++y) {
-        shadow += ShadowCalculation(bias, FragPosLightSpace, vec2(x, y) * texelSize);
-      }
-    }
-    shadow /= 9.0;
+    float shadow = ShadowCalculation(bias, FragPosLightSpace);
     shadow *= 0.7;
     color = 0.7* (1.0 - shadow) * vec4(directionLight.color, 1.0) * color * diff + vec4(amb, 1.0);
     if (useSpec) {
@@ -64,23 +104,11 @@ void main() {
       float shininess = 0.7;
       float str = 1;//0.88;
       float spec = pow(max(dot(viewDir, reflectDir), 0.0), shininess);
-      color += str * spec * texture(texture_spec, TexCoord) * vec4(directionLight.color, 1.0);
-    }
-    if (usePointLight) {
-      vec3 lightDir = normalize(pointLight.worldPos - FragWorldPos);
-      vec3 normal = vec3(0.0, 1.0, 0.0);
-      float diff = max(dot(normal, lightDir), 0.0);
-      float distance = length(pointLight.worldPos- FragWorldPos);
-      float linear = 0.5;
-      float constant = 0;
-      float quadratic = 3;
-      float attenuation = 1.0 / (constant + linear * distance +
-               quadratic * (distance * distance));
-      vec3 diffuse  = pointLight.color  * diff * vec3(texture(texture_diffuse, TexCoord));
-      diffuse *= attenuation;
-      color += vec4(diffuse.xyz, 1.0);
+      color += str * spec * texture(texture_spec, vec3(TexCoord, layers.y)) * vec4(directionLight.color, 1.0);
     }
+    color.rgb += clusteredPointLights(FragWorldPos, vec3(0.0, 1.0, 0.0)) * vec3(texture(texture_diffuse, diffuseCoord));
   }
   FragColor = color;
+  EmissionColor = vec4(0.0);
 }
 
@@ -2,12 +2,18 @@
 
 #include <iostream>
 #include <chrono>
+#include <cstdio>
+#include <memory>
+#include <string>
 #include <thread>
 
+#include "angrygl/asset_graph.h"
+#include "angrygl/animation_instance.h"
 #include "angrygl/player_model.h"
 #include "angrygl/spritesheet.h"
 #include "angrygl/enemy_spawner.h"
 #include "angrygl/geom.h"
+#include "angrygl/materials.h"
 #include "angrygl/capsule.h"
 #include "angrygl/enemy.h"
 #include "angrygl/bullet_store.h"
@@ -18,7 +24,22 @@
 #include "glm/gtx/norm.hpp"
 #include "include/GLFW/glfw3.h"
 #include "lib/ThreadPool.h"
+#include "lib/alloc_tracker.h"
+#include "lib/frame_arena.h"
 #include "angrygl/model.h"
+#include "opengl/dynamic_resolution.h"
+#include "opengl/frame_capture.h"
+#include "opengl/frame_graph.h"
+#include "opengl/frame_pacer.h"
+#include "opengl/gl_state.h"
+#include "opengl/headless_context.h"
+#include "opengl/light_clusters.h"
+#include "opengl/lod_selector.h"
+#include "opengl/packed_vertex.h"
+#include "opengl/program_cache.h"
+#include "opengl/render_queue.h"
+#include "opengl/resource_registry.h"
+#include "opengl/texture_array.h"
 #include "stb/image.h"
 
 #if SD_ENABLE_IRRKLANG
@@ -40,27 +61,33 @@ const int parallelism = 4;
 int viewportWidth = 1500;
 int viewportHeight = 1000;
 
+// Headless benchmark runs (--headless) step the game at a fixed rate so every
+// run renders the same frames.
+const int defaultHeadlessFrames = 600;
+const float headlessFrameStep = 1.0f / 60.0f;
+// With --alloc-check, the combat loop's zones must stop allocating after this
+// many frames. Needs a build with --define alloc_hooks=1.
+const int allocCheckWarmupFrames = 120;
+// Per-frame containers are reserved for this many enemies so that a growing
+// horde doesn't reallocate mid-fight.
+const int reservedEnemies = 256;
+
 // Texture units
-const int texUnit_playerDiffuse = 0;
-const int texUnit_gunDiffuse = 1;
-const int texUnit_floorDiffuse = 2;
-const int texUnit_wigglyBoi = 3;
-const int texUnit_bullet = 4;
-const int texUnit_floorNormal = 5;
-const int texUnit_playerNormal = 6;
-const int texUnit_gunNormal = 7;
-const int texUnit_shadowMap = 8;
-const int texUnit_emissionFBO = 9;
-const int texUnit_playerEmission = 10;
-const int texUnit_gunEmission = 11;
-const int texUnit_scene = 12;
-const int texUnit_horzBlur = 13;
-const int texUnit_vertBlur = 14;
-const int texUnit_impactSpriteSheet = 15;
-const int texUnit_muzzleFlashSpriteSheet = 16;
-const int texUnit_floorSpec = 18;
-const int texUnit_playerSpec = 19;
-const int texUnit_gunSpec = 20;
+const int texUnit_bullet = 0;
+const int texUnit_shadowMap = 1;
+const int texUnit_emissionFBO = 2;
+const int texUnit_scene = 3;
+const int texUnit_horzBlur = 4;
+const int texUnit_vertBlur = 5;
+const int texUnit_impactSpriteSheet = 6;
+const int texUnit_muzzleFlashSpriteSheet = 7;
+const int texUnit_frameGraphScratch = 8;
+const int texUnit_transparencyAccum = 9;
+const int texUnit_transparencyRevealage = 10;
+// Light clusters take this unit and the next two.
+const int texUnit_lightClusters = 11;
+// Material texture arrays take this unit and up.
+const int texUnit_materialArrays = 14;
 
 // Camera
 const glm::vec3 cameraFollowVec(-4.0f, 4.3f, 0.0f);
@@ -73,6 +100,7 @@ float lastFireTime = 0.0f;
 bool isTryingToFire = false;
 const float fireInterval = 0.1f; // seconds
 const int spreadAmount = 20;
+const bool bulletsPierce = false;
 const float playerSpeed = 1.5f;
 const float playerCollisionRadius = 0.35f;
 bool isAlive = true;
@@ -81,18 +109,57 @@ float aimTheta = 0.0f;
 // Frame timing
 float deltaTime = 0.0f;
 float lastFrame = 0.0f;
+// Render scale for the viewport-sized targets. Follows GPU time unless pinned
+// with --render-scale or the keys in keyCallback().
+DynamicResolution dynamicResolution((DynamicResolution::Settings()));
+const float renderScaleKeyStep = 0.1f;
+const float targetFrameMsKeyStep = 1.0f;
+// Caps frames queued ahead of the GPU (--max-frames-in-flight) and measures
+// how long cursor motion takes to reach the screen.
+FramePacer framePacer((FramePacer::Settings()));
 
 // Mouse input
 float mouseClipX = 0.0f;
 float mouseClipY = 0.0f;
 
+// Dynamic point lights, fed to the light clusters each frame. Ranges are in
+// world units; light falls to zero at the range.
 const glm::vec3 muzzlePointLightColor(1.0f, 0.2f, 0.0f);
+const float muzzlePointLightRange = 3.0f;
+// Impacts flare and then fade over their spritesheet.
+const glm::vec3 impactLightColor(1.0f, 0.5f, 0.1f);
+const float impactLightRange = 1.0f;
+const glm::vec3 bulletLightColor(0.3f, 0.25f, 0.1f);
+const float bulletLightRange = 0.4f;
 
 // Models
 const float playerModelScale = 0.0044f;
 const float playerModelGunHeight = 120.0f;       // un-scaled
 const float playerModelGunMuzzleOffset = 100.0f; // un-scaled
 const float monsterY = playerModelScale * playerModelGunHeight;
+const float wigglyBoiScale = 0.01f;
+
+// Enemy levels of detail, picked by projected height in pixels. A positive
+// bias makes every enemy count as smaller; the shadow map can afford coarser
+// meshes than the scene.
+const int enemyMaxLods = 4;
+const std::vector<float> enemyLodThresholds = {160.0f, 80.0f, 40.0f};
+const float enemyLodBias = 0.0f;
+const float enemyShadowLodBias = 1.0f;
+
+// Shadow quality tiers, picked with --shadow-tier=N.
+struct ShadowTier {
+  int mapSize;
+  // PCF taps per side are 2 * pcfRadius + 1.
+  int pcfRadius;
+};
+const ShadowTier shadowTiers[] = {
+  {1024, 0},
+  {2048, 0},
+  {4096, 1},
+  {6144, 1},
+};
+const int defaultShadowTier = 3;
 
 // Lighting
 const glm::vec3 lightDir = glm::normalize(glm::vec3(-0.8f, 0.0f, -1.0f));
@@ -143,6 +210,7 @@ const float obnoxiousQuad[] = {
 void cursorPositionCallback(GLFWwindow *window, double xPos, double yPos) {
   mouseClipX = -1.0f + 2.0f * xPos / viewportWidth;
   mouseClipY = 1.0f - 2.0f * yPos / viewportHeight;
+  framePacer.inputEvent();
 }
 
 void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
@@ -151,6 +219,33 @@ void mouseButtonCallback(GLFWwindow* window, int button, int action, int mods) {
   }
 }
 
+void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mods) {
+  if (action != GLFW_PRESS) {
+    return;
+  }
+  switch (key) {
+  case GLFW_KEY_LEFT_BRACKET:
+  case GLFW_KEY_RIGHT_BRACKET:
+    dynamicResolution.setFixedScale(dynamicResolution.scale() +
+        (key == GLFW_KEY_LEFT_BRACKET ? -renderScaleKeyStep : renderScaleKeyStep));
+    std::cout << "Render scale fixed at " << dynamicResolution.scale() << std::endl;
+    break;
+  case GLFW_KEY_0:
+    dynamicResolution.setDynamic();
+    std::cout << "Render scale dynamic" << std::endl;
+    break;
+  case GLFW_KEY_MINUS:
+  case GLFW_KEY_EQUAL:
+    dynamicResolution.setTargetMs(dynamicResolution.targetMs() +
+        (key == GLFW_KEY_MINUS ? -targetFrameMsKeyStep : targetFrameMsKeyStep));
+    std::cout << "Target GPU frame time " << dynamicResolution.targetMs() << "ms" << std::endl;
+    break;
+  case GLFW_KEY_M:
+    resources::dump();
+    break;
+  }
+}
+
 void chasePlayer(const float deltaTime, std::vector<Enemy>* enemies) {
   const glm::vec3 playerCollisionPosition(playerPosition.x, monsterY, playerPosition.z);
   for (int i = 0; i < enemies->size(); ++i) {
@@ -227,40 +322,46 @@ const float floorVertices[] = {
     floorSize / 2,  0.0f, floorSize / 2,  numTileWraps, numTileWraps,
     floorSize / 2,  0.0f, -floorSize / 2, 0.0f,         numTileWraps};
 
-void drawWigglyBois(Model& wigglyBoi, Shader& shader, const std::vector<Enemy>& enemies) {
-  shader.use();
-  shader.setVec3("nosePos", glm::vec3(1.0f, monsterY, -2.0f));
-  // TODO optimise (multithread, instancing, SOA, etc..)
-  for (const Enemy& e : enemies) {
-    float monsterTheta = atan(e.dir.x / e.dir.z) + (e.dir.z < 0.0f ? 0.0f : pi);
-    const glm::mat4 modelTransform =
+void wigglyBoiTransforms(const Enemy& e, glm::mat4* modelTransform, glm::mat4* rotOnly) {
+  float monsterTheta = atan(e.dir.x / e.dir.z) + (e.dir.z < 0.0f ? 0.0f : pi);
+  *modelTransform =
+    glm::rotate(
       glm::rotate(
         glm::rotate(
-          glm::rotate(
-            glm::scale(
-              glm::translate(glm::mat4(1.0f), e.position),
-              glm::vec3(0.01f)),
-            monsterTheta,
-            glm::vec3(0.0f, 1.0f, 0.0f)),
-          pi,
-          glm::vec3(0.0f, 0.0f, 1.0f)),
-        glm::radians(90.0f),
-        glm::vec3(1.0f, 0.0f, 0.0f));
-    glm::mat4 rotOnly = glm::rotate(
+          glm::scale(
+            glm::translate(glm::mat4(1.0f), e.position),
+            glm::vec3(wigglyBoiScale)),
+          monsterTheta,
+          glm::vec3(0.0f, 1.0f, 0.0f)),
+        pi,
+        glm::vec3(0.0f, 0.0f, 1.0f)),
+      glm::radians(90.0f),
+      glm::vec3(1.0f, 0.0f, 0.0f));
+  *rotOnly = glm::rotate(
+      glm::rotate(
         glm::rotate(
-          glm::rotate(
-            glm::mat4(1.0f),
-            monsterTheta,
-            glm::vec3(0.0f, 1.0f, 0.0f)),
-          pi,
-          glm::vec3(0.0f, 0.0f, 1.0f)),
-        glm::radians(90.0f),
-        glm::vec3(1.0f, 0.0f, 0.0f));
+          glm::mat4(1.0f),
+          monsterTheta,
+          glm::vec3(0.0f, 1.0f, 0.0f)),
+        pi,
+        glm::vec3(0.0f, 0.0f, 1.0f)),
+      glm::radians(90.0f),
+      glm::vec3(1.0f, 0.0f, 0.0f));
+}
 
+void drawWigglyBois(Model& wigglyBoi, Shader& shader, const std::vector<Enemy>& enemies,
+                    const std::vector<int>& which, int lod) {
+  shader.use();
+  shader.setVec3("nosePos", glm::vec3(1.0f, monsterY, -2.0f));
+  // TODO optimise (multithread, instancing, SOA, etc..)
+  for (const int i : which) {
+    const Enemy& e = enemies[i];
+    glm::mat4 modelTransform, rotOnly;
+    wigglyBoiTransforms(e, &modelTransform, &rotOnly);
     glUniformMatrix4fv(glGetUniformLocation(shader.id, "aimRot"), 1, GL_FALSE, glm::value_ptr(rotOnly));
     glUniformMatrix4fv(glGetUniformLocation(shader.id, "model"), 1,
                        GL_FALSE, glm::value_ptr(modelTransform));
-    wigglyBoi.Draw(shader);
+    wigglyBoi.Draw(shader, lod);
   }
 }
 
@@ -293,7 +394,6 @@ void bindLoadedTexture(LoadedTexture& texture) {
   int height = texture.height;
   int nrComponents = texture.nrComponents;
   unsigned char* data = texture.data;
-  glActiveTexture(GL_TEXTURE0 + textureUnit);
   if (data) {
     GLenum format;
     if (nrComponents == 1) {
@@ -304,10 +404,12 @@ void bindLoadedTexture(LoadedTexture& texture) {
       format = GL_RGBA;
     }
 
-    glBindTexture(GL_TEXTURE_2D, textureID);
+    glstate::bindTexture(textureUnit, GL_TEXTURE_2D, textureID);
     glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
                  GL_UNSIGNED_BYTE, data);
     glGenerateMipmap(GL_TEXTURE_2D);
+    resources::track(resources::TEXTURE, textureID,
+                     resources::textureBytes(format, width, height, 1, true), "textures");
 
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
     glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
@@ -321,7 +423,7 @@ void bindLoadedTexture(LoadedTexture& texture) {
     stbi_image_free(data);
     exit(1);
   }
-  glBindTexture(GL_TEXTURE_2D, textureID);
+  glstate::bindTexture(textureUnit, GL_TEXTURE_2D, textureID);
 }
 
 void textureFromFile(const int tU, const std::string &filename) {
@@ -332,7 +434,7 @@ void textureFromFile(const int tU, const std::string &filename) {
 void framebufferSizeCallback(GLFWwindow *window, int width, int height) {
   viewportWidth = width;
   viewportHeight = height;
-  glViewport(0, 0, viewportWidth, viewportHeight);
+  glstate::viewport(0, 0, viewportWidth, viewportHeight);
 }
 
 void processInput(GLFWwindow *window) {
@@ -361,11 +463,36 @@ void processInput(GLFWwindow *window) {
   }
 }
 
-int main(int argc, const char **argv) {
-  std::cout << "Starting up" << std::endl;
-  const auto appStart = std::chrono::high_resolution_clock::now();
-  ThreadPool threadPool(parallelism);
+// Returns the yaw from the player to where the cursor meets the plane at
+// monsterY, and the offset to that point in dx, dz.
+float aimAt(const float clipX, const float clipY, const glm::mat4& viewTransform,
+            const glm::mat4& projInv, float* const dx, float* const dz) {
+  // Map from screen (clip) coords back to world coords for an infinite plane
+  // at monsterY.
+  // TODO it'd probably be simpler to do a line intersection from camera pos
+  // to the plane along the direction vector. Probably faster too (no matrix
+  // inverse).
+  const glm::mat4 inv = glm::inverse(viewTransform) * projInv;
+  const float t = (inv[0][1] * clipX + inv[1][1] * clipY + inv[3][1] - monsterY *
+           (inv[0][3] * clipX + inv[1][3] * clipX + inv[3][3])) /
+      (inv[2][3] * monsterY - inv[2][1]);
+  const float s = 1.0f / (inv[0][3] * clipX + inv[1][3] * clipY + inv[2][3] * t + inv[3][3]);
+  const float us = clipX * s;
+  const float vs = clipY * s;
+  const float ts = t * s;
+  const float worldX = inv[0][0] * us + inv[1][0] * vs + inv[2][0] * ts + inv[3][0] * s;
+  const float worldZ = inv[0][2] * us + inv[1][2] * vs + inv[2][2] * ts + inv[3][2] * s;
+
+  *dx = worldX - playerPosition.x;
+  *dz = worldZ - playerPosition.z;
+  if (abs(clipX) < 0.005f && abs(clipY) < 0.005f) {
+    return 0.0f;
+  }
+  return atan(*dx / *dz) + (*dz < 0.0f ? pi : 0.0f);
+}
 
+// Opens the game window and loads GL through its context. Exits on failure.
+GLFWwindow* createWindow(std::chrono::time_point<std::chrono::high_resolution_clock> appStart) {
   glfwInit();
   glfwWindowHint(GLFW_CONTEXT_VERSION_MINOR, OPENGL_MINOR_VERSION);
   glfwWindowHint(GLFW_CONTEXT_VERSION_MAJOR, OPENGL_MAJOR_VERSION);
@@ -385,26 +512,125 @@ int main(int argc, const char **argv) {
       }
     }
   }
-  GLFWwindow* const window  = glfwCreateWindow(viewportWidth, viewportHeight,
+  GLFWwindow* const window = glfwCreateWindow(viewportWidth, viewportHeight,
                                         "AngryBots OpenGL", monitor, NULL);
   logTimeSince("window created ", appStart);
   if (window == NULL) {
     std::cerr << "Failed to create GLFW window" << std::endl;
     glfwTerminate();
-    return 1;
+    exit(1);
   }
   glfwMakeContextCurrent(window);
   logTimeSince("window context ", appStart);
 
   if (!gladLoadGLLoader((GLADloadproc)glfwGetProcAddress)) {
     std::cerr << "Failed to initialize GLAD" << std::endl;
-    return 1;
+    exit(1);
   }
 
-  glViewport(0, 0, viewportWidth, viewportHeight);
   glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
   glfwSetCursorPosCallback(window, cursorPositionCallback);
   glfwSetMouseButtonCallback(window, mouseButtonCallback);
+  glfwSetKeyCallback(window, keyCallback);
+  return window;
+}
+
+int main(int argc, const char **argv) {
+  allocs::nameThread("main");
+  std::cout << "Starting up" << std::endl;
+  int shadowTierIndex = defaultShadowTier;
+  const std::string shadowTierFlag = "--shadow-tier=";
+  const std::string targetFrameMsFlag = "--target-frame-ms=";
+  const std::string renderScaleFlag = "--render-scale=";
+  const std::string sizeFlag = "--size=";
+  const std::string framesFlag = "--frames=";
+  const std::string captureDirFlag = "--capture-dir=";
+  const std::string maxFramesInFlightFlag = "--max-frames-in-flight=";
+  bool headless = false;
+  bool allocCheck = false;
+  int headlessFrames = defaultHeadlessFrames;
+  std::string captureDir;
+  for (int i = 1; i < argc; ++i) {
+    const std::string arg = argv[i];
+    if (arg == "--headless") {
+      headless = true;
+    } else if (arg == "--alloc-check") {
+      allocCheck = true;
+    } else if (arg.compare(0, sizeFlag.size(), sizeFlag) == 0) {
+      if (sscanf(arg.c_str() + sizeFlag.size(), "%dx%d", &viewportWidth, &viewportHeight) != 2 ||
+          viewportWidth <= 0 || viewportHeight <= 0) {
+        std::cerr << "Size must be WIDTHxHEIGHT" << std::endl;
+        exit(1);
+      }
+    } else if (arg.compare(0, framesFlag.size(), framesFlag) == 0) {
+      headlessFrames = atoi(arg.c_str() + framesFlag.size());
+    } else if (arg.compare(0, captureDirFlag.size(), captureDirFlag) == 0) {
+      captureDir = arg.substr(captureDirFlag.size());
+    } else if (arg.compare(0, shadowTierFlag.size(), shadowTierFlag) == 0) {
+      shadowTierIndex = atoi(arg.c_str() + shadowTierFlag.size());
+    } else if (arg.compare(0, targetFrameMsFlag.size(), targetFrameMsFlag) == 0) {
+      dynamicResolution.setTargetMs(atof(arg.c_str() + targetFrameMsFlag.size()));
+    } else if (arg.compare(0, renderScaleFlag.size(), renderScaleFlag) == 0) {
+      dynamicResolution.setFixedScale(atof(arg.c_str() + renderScaleFlag.size()));
+    } else if (arg.compare(0, maxFramesInFlightFlag.size(), maxFramesInFlightFlag) == 0) {
+      framePacer.setMaxFramesInFlight(atoi(arg.c_str() + maxFramesInFlightFlag.size()));
+    }
+  }
+  const int numShadowTiers = sizeof(shadowTiers) / sizeof(shadowTiers[0]);
+  if (shadowTierIndex < 0 || shadowTierIndex >= numShadowTiers) {
+    std::cerr << "Shadow tier must be 0 to " << numShadowTiers - 1 << std::endl;
+    exit(1);
+  }
+  const ShadowTier& shadowTier = shadowTiers[shadowTierIndex];
+  if (!captureDir.empty() && !headless) {
+    std::cerr << "--capture-dir needs --headless" << std::endl;
+    exit(1);
+  }
+  if (allocCheck && (!headless || !allocs::hooked())) {
+    std::cerr << "--alloc-check needs --headless and a build with --define alloc_hooks=1" << std::endl;
+    exit(1);
+  }
+  if (headless) {
+    // Benchmarks compare like with like unless a scale is asked for.
+    if (dynamicResolution.isDynamic()) {
+      dynamicResolution.setFixedScale(1.0f);
+    }
+    // Nobody to pull the trigger, so keep firing for a representative load.
+    isTryingToFire = true;
+  }
+  const auto appStart = std::chrono::high_resolution_clock::now();
+  ThreadPool threadPool(parallelism);
+
+  std::unique_ptr<HeadlessContext> headlessContext;
+  GLFWwindow* window = NULL;
+  unsigned int headlessFbo = 0;
+  if (headless) {
+    headlessContext.reset(new HeadlessContext(OPENGL_MAJOR_VERSION, OPENGL_MINOR_VERSION));
+    if (!gladLoadGLLoader((GLADloadproc)HeadlessContext::getProcAddress)) {
+      std::cerr << "Failed to initialize GLAD" << std::endl;
+      return 1;
+    }
+    // Stands in for the window's framebuffer.
+    unsigned int headlessColor;
+    glGenRenderbuffers(1, &headlessColor);
+    glstate::bindRenderbuffer(headlessColor);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, viewportWidth, viewportHeight);
+    resources::track(resources::RENDERBUFFER, headlessColor,
+                     resources::textureBytes(GL_RGBA8, viewportWidth, viewportHeight, 1, false),
+                     "headless");
+    glGenFramebuffers(1, &headlessFbo);
+    glstate::bindFramebuffer(headlessFbo);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, headlessColor);
+    if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+      std::cerr << "Headless frame buffer not complete!" << std::endl;
+      return 1;
+    }
+    std::cout << "Rendering " << headlessFrames << " frames headless at " << viewportWidth
+              << "x" << viewportHeight << " on " << glGetString(GL_RENDERER) << std::endl;
+  } else {
+    window = createWindow(appStart);
+  }
+  glstate::viewport(0, 0, viewportWidth, viewportHeight);
 
 #if SD_ENABLE_IRRKLANG
   irrklang::ISoundEngine* const soundEngine = irrklang::createIrrKlangDevice();
@@ -425,9 +651,10 @@ int main(int argc, const char **argv) {
   glGenVertexArrays(1, &obnoxiousQuadVAO);
   unsigned int obnoxiousQuadVBO;
   glGenBuffers(1, &obnoxiousQuadVBO);
-  glBindVertexArray(obnoxiousQuadVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, obnoxiousQuadVBO);
+  glstate::bindVertexArray(obnoxiousQuadVAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, obnoxiousQuadVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(obnoxiousQuad), obnoxiousQuad, GL_STATIC_DRAW);
+  resources::track(resources::BUFFER, obnoxiousQuadVBO, sizeof(obnoxiousQuad), "scene geometry");
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
@@ -437,9 +664,10 @@ int main(int argc, const char **argv) {
   glGenVertexArrays(1, &unitSquareVAO);
   unsigned int unitSquareVBO;
   glGenBuffers(1, &unitSquareVBO);
-  glBindVertexArray(unitSquareVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, unitSquareVBO);
+  glstate::bindVertexArray(unitSquareVAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, unitSquareVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(unitSquare), unitSquare, GL_STATIC_DRAW);
+  resources::track(resources::BUFFER, unitSquareVBO, sizeof(unitSquare), "scene geometry");
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
@@ -449,108 +677,256 @@ int main(int argc, const char **argv) {
   glGenVertexArrays(1, &moreObnoxiousQuadVAO);
   unsigned int moreObnoxiousQuadVBO;
   glGenBuffers(1, &moreObnoxiousQuadVBO);
-  glBindVertexArray(moreObnoxiousQuadVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, moreObnoxiousQuadVBO);
+  glstate::bindVertexArray(moreObnoxiousQuadVAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, moreObnoxiousQuadVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(moreObnoxiousQuad), moreObnoxiousQuad, GL_STATIC_DRAW);
+  resources::track(resources::BUFFER, moreObnoxiousQuadVBO, sizeof(moreObnoxiousQuad), "scene geometry");
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)0);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void*)(3 * sizeof(float)));
   glEnableVertexAttribArray(1);
 
   std::cout << "Loading assets" << std::endl;
-  // TODO this is horribly inefficient. Fix this.
-  Shader blurShader = Shader::create("angrygl/basicer_shader.vert", "angrygl/blur_shader.frag");
-  Shader basicerShader = Shader::create("angrygl/basicer_shader.vert", "angrygl/basicer_shader.frag");
-  Shader sceneDrawShader = Shader::create("angrygl/basicer_shader.vert", "angrygl/texture_merge_shader.frag");
-  Shader simpleDepthShader = Shader::create("angrygl/depth_shader.vert", "angrygl/depth_shader.frag");
+  // CPU-side loading runs on the thread pool, GL-side finalisation is drained
+  // here in priority order (lower first).
+  AssetGraph assetGraph;
+  const int shaderPriority = 0;
+  const int modelPriority = 1;
+  const int texturePriority = 2;
+
+  // Extension entry points come from whichever context is current.
+  const GLADloadproc getProcAddress =
+      headless ? (GLADloadproc)HeadlessContext::getProcAddress : (GLADloadproc)glfwGetProcAddress;
+  // All programs are submitted up front so cache misses can compile in
+  // parallel, then collected in one go. Reading and hashing the sources runs
+  // on the pool; only building the programs needs the GL thread.
+  ProgramCache programCache(getProcAddress, "angrygl/shader_cache");
+  int blurProgram, basicerProgram, sceneDrawProgram, simpleDepthProgram,
+      wigglyDepthProgram, wigglyProgram, playerProgram, basicTextureProgram, instancedTextureProgram,
+      nodeProgram, spriteProgram;
+  assetGraph.add("shaders", {}, shaderPriority, [&]() {
+    blurProgram = programCache.submit("angrygl/basicer_shader.vert", "angrygl/blur_shader.frag");
+    basicerProgram = programCache.submit("angrygl/basicer_shader.vert", "angrygl/basicer_shader.frag");
+    sceneDrawProgram = programCache.submit("angrygl/basicer_shader.vert", "angrygl/texture_merge_shader.frag");
+    simpleDepthProgram = programCache.submit("angrygl/depth_shader.vert", "angrygl/depth_shader.frag");
+    wigglyDepthProgram = programCache.submit("angrygl/wiggly_shader.vert", "angrygl/depth_shader.frag");
+    wigglyProgram = programCache.submit("angrygl/wiggly_shader.vert", "angrygl/player_shader.frag");
+    playerProgram = programCache.submit("angrygl/player_shader.vert", "angrygl/player_shader.frag");
+    basicTextureProgram = programCache.submit("angrygl/basic_texture_shader.vert", "angrygl/floor_shader.frag");
+    instancedTextureProgram = programCache.submit("angrygl/instanced_texture_shader.vert", "angrygl/basic_texture_shader.frag");
+    nodeProgram = programCache.submit("angrygl/redshader.vert", "angrygl/redshader.frag");
+    spriteProgram = programCache.submit("angrygl/geom_shader2.vert", "angrygl/sprite_shader.frag");
+  }, [&]() { programCache.finish(); });
+
+  Model wigglyBoi(false, enemyMaxLods);
+  assetGraph.add("wiggly boi model", {}, modelPriority,
+      [&]() { wigglyBoi.loadModel("angrygl/assets/wiggly_boi/EelDog.FBX"); },
+      [&]() { wigglyBoi.uploadMeshes(); });
+  PlayerModel playerModel;
+  assetGraph.add("player model", {}, modelPriority,
+      [&]() { playerModel.importScene("angrygl/assets/Player/Player.fbx"); },
+      [&]() { playerModel.initGlResources(); });
+
+  // Textures sampled as plain 2D textures on fixed units.
+  std::vector<std::pair<int, std::string>> texturesToLoad;
+  texturesToLoad.emplace_back(texUnit_impactSpriteSheet, "angrygl/assets/bullet/impact_spritesheet_with_00.png");
+  texturesToLoad.emplace_back(texUnit_muzzleFlashSpriteSheet, "angrygl/assets/Player/muzzle_spritesheet.png");
+  texturesToLoad.emplace_back(texUnit_bullet, "angrygl/assets/bullet/BulletTexture2.png");
+  std::vector<LoadedTexture> loadedTextures(texturesToLoad.size());
+  for (int i = 0; i < texturesToLoad.size(); ++i) {
+    const auto& textureToLoad = texturesToLoad[i];
+    assetGraph.add(textureToLoad.second, {}, texturePriority,
+        [&textureToLoad, i, &loadedTextures]() {
+          loadedTextures[i] = loadTexture(textureToLoad.first, textureToLoad.second);
+        },
+        [i, &loadedTextures]() { bindLoadedTexture(loadedTextures[i]); });
+  }
+
+  // Material textures are packed into texture arrays once all are decoded.
+  enum MaterialTexture {
+    WIGGLY_BOI_DIFFUSE,
+    FLOOR_NORMAL,
+    FLOOR_DIFFUSE,
+    FLOOR_SPEC,
+    GUN_NORMAL,
+    PLAYER_NORMAL,
+    GUN_DIFFUSE,
+    PLAYER_EMISSION,
+    PLAYER_SPEC,
+    GUN_EMISSION,
+    PLAYER_DIFFUSE,
+    GUN_SPEC,
+    NUM_MATERIAL_TEXTURES,
+  };
+  const std::string materialTexturePaths[NUM_MATERIAL_TEXTURES] = {
+      "angrygl/assets/wiggly_boi/Eeldog_Albedo.png",
+      "angrygl/assets/floor/Floor_N.psd",
+      "angrygl/assets/floor/Floor_D.psd",
+      "angrygl/assets/floor/Floor_M.psd",
+      "angrygl/assets/Player/Textures/Gun_NRM.tga",
+      "angrygl/assets/Player/Textures/Player_NRM.tga",
+      "angrygl/assets/Player/Textures/Gun_D.tga",
+      "angrygl/assets/Player/Textures/Player_E.tga",
+      "angrygl/assets/Player/Textures/Player_M.tga",
+      "angrygl/assets/Player/Textures/Gun_E.tga",
+      "angrygl/assets/Player/Textures/Player_D.tga",
+      "angrygl/assets/Player/Textures/Gun_M.tga",
+  };
+  std::vector<LoadedTexture> materialTextures(NUM_MATERIAL_TEXTURES);
+  std::vector<AssetGraph::AssetId> materialTextureAssets;
+  for (int i = 0; i < NUM_MATERIAL_TEXTURES; ++i) {
+    const std::string& path = materialTexturePaths[i];
+    materialTextureAssets.push_back(assetGraph.add(path, {}, texturePriority,
+        [&path, i, &materialTextures]() {
+          materialTextures[i] = loadTexture(-1, path);
+          if (!materialTextures[i].data) {
+            std::cerr << "loadTexture failed " << path << ": " << stbi_failure_reason() << std::endl;
+            exit(1);
+          }
+        },
+        nullptr));
+  }
+  TextureArrayPool textureArrays;
+  MaterialLibrary materials(&textureArrays);
+  int playerMaterial, gunMaterial, floorMaterialId, wigglyBoiMaterial;
+  assetGraph.add("material texture arrays", materialTextureAssets, texturePriority, nullptr, [&]() {
+    TextureLayer layers[NUM_MATERIAL_TEXTURES];
+    for (int i = 0; i < NUM_MATERIAL_TEXTURES; ++i) {
+      const LoadedTexture& t = materialTextures[i];
+      layers[i] = textureArrays.add(t.width, t.height, t.nrComponents, t.data);
+    }
+    textureArrays.build(texUnit_materialArrays);
+    for (LoadedTexture& t : materialTextures) {
+      stbi_image_free(t.data);
+      t.data = nullptr;
+    }
+    textureArrays.logStats();
+
+    Material m;
+    m.diffuse = layers[PLAYER_DIFFUSE];
+    m.spec = layers[PLAYER_SPEC];
+    m.normal = layers[PLAYER_NORMAL];
+    m.emission = layers[PLAYER_EMISSION];
+    playerMaterial = materials.add(m);
+    m.diffuse = layers[GUN_DIFFUSE];
+    m.spec = layers[GUN_SPEC];
+    m.normal = layers[GUN_NORMAL];
+    m.emission = layers[GUN_EMISSION];
+    gunMaterial = materials.add(m);
+    m.diffuse = layers[FLOOR_DIFFUSE];
+    m.spec = layers[FLOOR_SPEC];
+    m.normal = layers[FLOOR_NORMAL];
+    m.emission = TextureLayer();
+    floorMaterialId = materials.add(m);
+    // The enemy only has a diffuse texture.
+    m = Material();
+    m.diffuse = layers[WIGGLY_BOI_DIFFUSE];
+    wigglyBoiMaterial = materials.add(m);
+  });
+
+  assetGraph.run(&threadPool);
+  assetGraph.logCriticalPath();
+  programCache.logStats();
+  logTimeSince("assets loaded ", appStart);
+
+  // The player is the only animated character so far, but instances share the
+  // model and are posed together on the pool.
+  AnimationInstance playerAnimation(&playerModel);
+  AnimationInstance *const animated[] = {&playerAnimation};
+  const int numAnimated = sizeof(animated) / sizeof(animated[0]);
+
+  Shader blurShader = programCache.get(blurProgram);
+  Shader basicerShader = programCache.get(basicerProgram);
+  Shader sceneDrawShader = programCache.get(sceneDrawProgram);
+  Shader simpleDepthShader = programCache.get(simpleDepthProgram);
+  Shader wigglyDepthShader = programCache.get(wigglyDepthProgram);
+  Shader wigglyShader = programCache.get(wigglyProgram);
+  Shader playerShader = programCache.get(playerProgram);
+  Shader basicTextureShader = programCache.get(basicTextureProgram);
+  Shader instancedTextureShader = programCache.get(instancedTextureProgram);
+  Shader nodeShader = programCache.get(nodeProgram);
+  Shader spriteShader = programCache.get(spriteProgram);
+  for (const Shader* shader : {&wigglyShader, &playerShader, &basicTextureShader}) {
+    materials.uploadTable(*shader);
+  }
+  // Every sampler needs pointing at a unit of its own type before any draw,
+  // even passes that don't sample.
+  materials.use(wigglyShader, wigglyBoiMaterial);
+  materials.use(playerShader, playerMaterial);
+  materials.use(basicTextureShader, floorMaterialId);
+  // Programs drawing PlayerMeshes decode positions against the model's box.
+  for (const Shader* shader : {&wigglyShader, &wigglyDepthShader}) {
+    shader->use();
+    usePositionBounds(*shader, wigglyBoi.positionBounds());
+  }
+  for (const Shader* shader : {&playerShader, &simpleDepthShader}) {
+    shader->use();
+    usePositionBounds(*shader, playerModel.positionBounds());
+  }
+  for (const Shader* shader : {&playerShader, &wigglyShader, &basicTextureShader}) {
+    shader->use();
+    shader->setInt("shadowPcfRadius", shadowTier.pcfRadius);
+  }
+
+  // Uniforms written as late as possible before the frame graph runs; see the
+  // LateLatched block in player_shader.vert. std140, so a mat4 is 64 bytes.
+  const int lateLatchedBinding = 0;
+  unsigned int lateLatchedUbo;
+  glGenBuffers(1, &lateLatchedUbo);
+  glstate::bindBuffer(GL_UNIFORM_BUFFER, lateLatchedUbo);
+  const glm::mat4 noAimCorrection(1.0f);
+  glBufferData(GL_UNIFORM_BUFFER, sizeof(noAimCorrection), glm::value_ptr(noAimCorrection),
+               GL_STREAM_DRAW);
+  resources::track(resources::BUFFER, lateLatchedUbo, sizeof(noAimCorrection), "frame uniforms");
+  glBindBufferBase(GL_UNIFORM_BUFFER, lateLatchedBinding, lateLatchedUbo);
+  for (const Shader* shader : {&playerShader, &simpleDepthShader}) {
+    glUniformBlockBinding(shader->id, glGetUniformBlockIndex(shader->id, "LateLatched"),
+                          lateLatchedBinding);
+  }
+
   simpleDepthShader.use();
   const unsigned int lsml = glGetUniformLocation(simpleDepthShader.id, "lightSpaceMatrix");
-  Shader wigglyShader = Shader::create("angrygl/wiggly_shader.vert", "angrygl/player_shader.frag");
-  Model wigglyBoi("angrygl/assets/wiggly_boi/EelDog.FBX", false);
 
-  Shader playerShader = Shader::create("angrygl/player_shader.vert", "angrygl/player_shader.frag");
   playerShader.use();
   const unsigned int playerLightSpaceMatrixLocation =
       glGetUniformLocation(playerShader.id, "lightSpaceMatrix");
   playerShader.setVec3("directionLight.dir", playerLightDir);
   playerShader.setVec3("directionLight.color", lightColor);
   playerShader.setVec3("ambient", ambientColor);
-  playerShader.setInt("texture_spec", texUnit_playerSpec);
-
-  logTimeSince("shaders loaded ", appStart);
 
   const Spritesheet bulletImpactSpritesheet(texUnit_impactSpriteSheet, 11, 0.05f);
   const Spritesheet muzzleFlashImpactSpritesheet(texUnit_muzzleFlashSpriteSheet, 6, 0.05f);
   BulletStore bulletStore = BulletStore::initialiseBuffersAndCreate(&threadPool);
+  LightClusters lightClusters((LightClusters::Settings()), texUnit_lightClusters);
 
-  {
-    std::vector<std::pair<int, std::string>> texturesToLoad;
-    texturesToLoad.emplace_back(texUnit_impactSpriteSheet, "angrygl/assets/bullet/impact_spritesheet_with_00.png");
-    texturesToLoad.emplace_back(texUnit_muzzleFlashSpriteSheet, "angrygl/assets/Player/muzzle_spritesheet.png");
-    texturesToLoad.emplace_back(texUnit_bullet, "angrygl/assets/bullet/BulletTexture2.png");
-    texturesToLoad.emplace_back(texUnit_wigglyBoi, "angrygl/assets/wiggly_boi/Eeldog_Albedo.png");
-    texturesToLoad.emplace_back(texUnit_floorNormal, "angrygl/assets/floor/Floor_N.psd");
-    texturesToLoad.emplace_back(texUnit_floorDiffuse, "angrygl/assets/floor/Floor_D.psd");
-    texturesToLoad.emplace_back(texUnit_floorSpec, "angrygl/assets/floor/Floor_M.psd");
-    texturesToLoad.emplace_back(texUnit_gunNormal, "angrygl/assets/Player/Textures/Gun_NRM.tga");
-    texturesToLoad.emplace_back(texUnit_playerNormal, "angrygl/assets/Player/Textures/Player_NRM.tga");
-    texturesToLoad.emplace_back(texUnit_gunDiffuse, "angrygl/assets/Player/Textures/Gun_D.tga");
-    texturesToLoad.emplace_back(texUnit_playerEmission, "angrygl/assets/Player/Textures/Player_E.tga");
-    texturesToLoad.emplace_back(texUnit_playerSpec, "angrygl/assets/Player/Textures/Player_M.tga");
-    texturesToLoad.emplace_back(texUnit_gunEmission, "angrygl/assets/Player/Textures/Gun_E.tga");
-    texturesToLoad.emplace_back(texUnit_playerDiffuse, "angrygl/assets/Player/Textures/Player_D.tga");
-    texturesToLoad.emplace_back(texUnit_gunSpec, "angrygl/assets/Player/Textures/Gun_M.tga");
-
-    std::vector<std::thread> threads;
-    std::vector<LoadedTexture> loadedTextures(texturesToLoad.size());
-    for (int i = 0; i < texturesToLoad.size(); ++i) {
-      const auto& textureToLoad = texturesToLoad[i];
-      threads.emplace_back([&textureToLoad,i, &loadedTextures]() {
-        loadedTextures[i] = loadTexture(textureToLoad.first, textureToLoad.second);
-      });
-    }
-    for (auto& thread : threads) {
-      thread.join();
-    }
-    for (LoadedTexture& l : loadedTextures) {
-      bindLoadedTexture(l);
-    }
-  }
-  logTimeSince("textures loaded ", appStart);
-  PlayerModel playerModel("angrygl/assets/Player/Player.fbx");
-
-  const glm::mat4 projTransform = glm::perspective(
+  glm::mat4 projTransform = glm::perspective(
       glm::radians(45.0f), (float)viewportWidth / viewportHeight, 0.1f, 10.0f);
-  const glm::mat4 projInv = glm::inverse(projTransform);
+  glm::mat4 projInv = glm::inverse(projTransform);
 
-  Shader basicTextureShader = Shader::create("angrygl/basic_texture_shader.vert", "angrygl/floor_shader.frag");
   basicTextureShader.use();
   basicTextureShader.setVec3("directionLight.dir", lightDir);
   basicTextureShader.setVec3("directionLight.color", floorLightColor);
   basicTextureShader.setVec3("ambient", floorAmbientColor);
 
-  Shader instancedTextureShader = Shader::create("angrygl/instanced_texture_shader.vert", "angrygl/basic_texture_shader.frag");
-  Shader nodeShader = Shader::create("angrygl/redshader.vert", "angrygl/redshader.frag");
   nodeShader.use();
 
   wigglyShader.use();
-  wigglyShader.use();
-  wigglyShader.setInt("texture_diffuse", texUnit_wigglyBoi);
+  wigglyShader.setInt("shadow_map", texUnit_shadowMap);
   wigglyShader.setVec3("directionLight.dir", playerLightDir);
   wigglyShader.setVec3("directionLight.color", lightColor);
   wigglyShader.setVec3("ambient", ambientColor);
 
-  Shader spriteShader = Shader::create("angrygl/geom_shader2.vert", "angrygl/sprite_shader.frag");
   spriteShader.use();
 
   unsigned int floorVAO;
   glGenVertexArrays(1, &floorVAO);
   unsigned int floorVBO;
   glGenBuffers(1, &floorVBO);
-  glBindVertexArray(floorVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, floorVBO);
+  glstate::bindVertexArray(floorVAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, floorVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(floorVertices), floorVertices,
                GL_STATIC_DRAW);
+  resources::track(resources::BUFFER, floorVBO, sizeof(floorVertices), "scene geometry");
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 5 * sizeof(float), (void *)0);
   glEnableVertexAttribArray(0);
   glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, 5 * sizeof(float),
@@ -562,159 +938,615 @@ int main(int argc, const char **argv) {
   glGenVertexArrays(1, &singlePointVAO);
   unsigned int singlePointVBO;
   glGenBuffers(1, &singlePointVBO);
-  glBindVertexArray(singlePointVAO);
-  glBindBuffer(GL_ARRAY_BUFFER, singlePointVBO);
+  glstate::bindVertexArray(singlePointVAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, singlePointVBO);
   glBufferData(GL_ARRAY_BUFFER, sizeof(point), point, GL_STATIC_DRAW);
+  resources::track(resources::BUFFER, singlePointVBO, sizeof(point), "scene geometry");
   glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(float), (void *)0);
   glEnableVertexAttribArray(0);
 
   std::vector<Enemy> enemies;
+  enemies.reserve(reservedEnemies);
   EnemySpawner enemySpawner(monsterY, &enemies);
 
   std::vector<SpritesheetSprite> bulletImpactSprites;
+  bulletImpactSprites.reserve(reservedEnemies);
   std::vector<float> muzzleFlashSpritesAge;
 
-  glActiveTexture(GL_TEXTURE0 + texUnit_shadowMap);
-  unsigned int depthMapFBO;
-  glGenFramebuffers(1, &depthMapFBO);
-  const unsigned int SHADOW_WIDTH = 6 * 1024, SHADOW_HEIGHT = 6 * 1024;
-  unsigned int depthMap;
-  glGenTextures(1, &depthMap);
-  glBindTexture(GL_TEXTURE_2D, depthMap);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT,
-               SHADOW_WIDTH, SHADOW_HEIGHT, 0, GL_DEPTH_COMPONENT, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-  float borderColor[] = { 1.0f, 1.0f, 1.0f, 1.0f };
-  glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor);
-  glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthMap, 0);
-  glDrawBuffer(GL_NONE);
-  glReadBuffer(GL_NONE);
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-
-  Shader textureShader = Shader::create("angrygl/geom_shader.vert", "angrygl/texture_shader.frag");
-  glActiveTexture(GL_TEXTURE0 + texUnit_emissionFBO);
-  unsigned int emissionFBO;
-  glGenFramebuffers(1, &emissionFBO);
-  glBindFramebuffer(GL_FRAMEBUFFER, emissionFBO);
-  unsigned int emisionBuffer;
-  glGenTextures(1, &emisionBuffer);
-  glBindTexture(GL_TEXTURE_2D, emisionBuffer);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, viewportWidth, viewportHeight, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_BORDER);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_BORDER);
-  float borderColor2[] = { 0.0f, 0.0f, 0.0f, 0.0f };
-  glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, borderColor2);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, emisionBuffer, 0);
-  {
-    unsigned int rbo;
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT16, viewportWidth, viewportHeight);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, rbo);
+  // Per-frame values shared between the simulation and the render passes.
+  bool isMeasuredFrame = false;
+  auto frameStart = std::chrono::high_resolution_clock::now();
+  float currentFrame = 0.0f;
+  glm::vec3 cameraPos;
+  glm::mat4 viewTransform(1.0f);
+  glm::mat4 PV(1.0f);
+  glm::mat4 playerModelTransform(1.0f);
+  glm::vec3 projectileSpawnPoint;
+  glm::mat4 lightSpaceMatrix(1.0f);
+  glm::mat4 muzzleTransform(1.0f);
+  glm::vec3 muzzleWorldPos3;
+
+  // Bullets only glow: they add into the emission target and leave the
+  // transparency targets alone. Blend state is the transparency pass's, so
+  // draw them before flushing a queue, which leaves blending off.
+  const auto drawBullets = [&]() {
+    glstate::activeTexture(texUnit_bullet);
+    instancedTextureShader.use();
+    instancedTextureShader.setInt("texture_diffuse", texUnit_bullet);
+    instancedTextureShader.setBool("useLight", false);
+    glUniformMatrix4fv(glGetUniformLocation(instancedTextureShader.id, "PV"), 1,
+                       GL_FALSE, glm::value_ptr(PV));
+    bulletStore.renderBulletSprites();
+  };
+
+  // Scene pass draws are sorted to share programs, materials and VAOs.
+  RenderQueue sceneQueue(20.0f);
+  // Two transforms and a draw per mesh for each enemy, plus the player.
+  sceneQueue.reserve(reservedEnemies * (3 + wigglyBoi.getMeshes().size()) + 16);
+  // Sprites composite order-independently, so only state is sorted.
+  RenderQueue transparentQueue(20.0f, false);
+  // An impact per enemy, plus muzzle flashes.
+  transparentQueue.reserve(reservedEnemies + 16);
+
+  const LodSelector enemyLods(enemyLodThresholds, enemyLodBias);
+  const LodSelector enemyShadowLods(enemyLodThresholds, enemyShadowLodBias);
+  // Around the enemy's origin rather than its box, plus the sideways wiggle
+  // wiggly_shader.vert adds.
+  const float wigglyBoiRadius = wigglyBoiScale * (3.0f + glm::length(glm::max(
+      glm::abs(wigglyBoi.positionBounds().min), glm::abs(wigglyBoi.positionBounds().max))));
+  // Enemy indices per LOD, rebuilt every frame so each level's draws are
+  // submitted as one run.
+  std::vector<std::vector<int>> enemiesByLod(wigglyBoi.numLods());
+  for (std::vector<int>& lodEnemies : enemiesByLod) {
+    lodEnemies.reserve(reservedEnemies);
   }
-
-  glActiveTexture(GL_TEXTURE0 + texUnit_scene);
-  unsigned int sceneRenderFBO;
-  glGenFramebuffers(1, &sceneRenderFBO);
-  glBindFramebuffer(GL_FRAMEBUFFER, sceneRenderFBO);
-  unsigned int sceneBuffer;
-  glGenTextures(1, &sceneBuffer);
-  glBindTexture(GL_TEXTURE_2D, sceneBuffer);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, viewportWidth, viewportHeight, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, sceneBuffer, 0);
-  {
-    unsigned int rbo;
-    glGenRenderbuffers(1, &rbo);
-    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
-    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH24_STENCIL8, viewportWidth, viewportHeight);
-    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_STENCIL_ATTACHMENT, GL_RENDERBUFFER, rbo);
+  std::vector<int> enemyLodDraws(wigglyBoi.numLods(), 0);
+  int shadowLod = 0;
+  std::vector<int> shadowCasters;
+  shadowCasters.reserve(reservedEnemies);
+  int shadowCasterDraws = 0;
+  int shadowCasterCandidates = 0;
+  // The player model's meshes are the body then the gun. The asset graph has
+  // built them by now, so each gets its material once here.
+  const int playerMeshMaterials[] = {playerMaterial, gunMaterial};
+  std::vector<int> playerMaterials;
+  for (int i = 0; i < playerModel.meshes.size(); ++i) {
+    std::vector<std::pair<std::string, int>> uniforms = materials.uniforms(playerMeshMaterials[i % 2]);
+    uniforms.emplace_back("useEmission", true);
+    playerMaterials.push_back(sceneQueue.addMaterial(playerShader.id, uniforms));
   }
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-      std::cerr << "Frame buffer not complete!";
-      return 1;
+  if (playerMaterials.empty()) {
+    std::cerr << "Player model has no meshes to register materials for" << std::endl;
+    exit(1);
   }
-
+  std::vector<std::pair<std::string, int>> floorUniforms = materials.uniforms(floorMaterialId);
+  floorUniforms.emplace_back("shadow_map", texUnit_shadowMap);
+  const int floorMaterial = sceneQueue.addMaterial(basicTextureShader.id, floorUniforms);
+  std::vector<std::pair<std::string, int>> wigglyUniforms = materials.uniforms(wigglyBoiMaterial);
+  wigglyUniforms.emplace_back("useEmission", false);
+  const int wigglyMaterial = sceneQueue.addMaterial(wigglyShader.id, wigglyUniforms);
+  const int muzzleFlashMaterial = transparentQueue.addMaterial(spriteShader.id,
+      {{"numCols", muzzleFlashImpactSpritesheet.numCols},
+       {"spritesheet", muzzleFlashImpactSpritesheet.textureUnit}},
+      {{"timePerSprite", muzzleFlashImpactSpritesheet.timePerSprite}},
+      true, false);
+  const int impactSpriteMaterial = transparentQueue.addMaterial(spriteShader.id,
+      {{"numCols", bulletImpactSpritesheet.numCols},
+       {"spritesheet", bulletImpactSpritesheet.textureUnit}},
+      {{"timePerSprite", bulletImpactSpritesheet.timePerSprite}},
+      true, false);
+
+  // Render targets. The frame graph allocates (and aliases) these and binds
+  // them to their texture units for the passes that read them.
+  FrameGraph frameGraph(texUnit_frameGraphScratch);
   const int blurScale = 2;
-  glActiveTexture(GL_TEXTURE0 + texUnit_horzBlur);
-  unsigned int horzBlurFBO;
-  glGenFramebuffers(1, &horzBlurFBO);
-  glBindFramebuffer(GL_FRAMEBUFFER, horzBlurFBO);
-  unsigned int horzBlurBuffer;
-  glGenTextures(1, &horzBlurBuffer);
-  glBindTexture(GL_TEXTURE_2D, horzBlurBuffer);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, viewportWidth / blurScale, viewportHeight / blurScale, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, horzBlurBuffer, 0);
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-      std::cerr << "Frame buffer not complete!";
-      return 1;
-  }
 
-  glActiveTexture(GL_TEXTURE0 + texUnit_vertBlur);
-  unsigned int vertBlurFBO;
-  glGenFramebuffers(1, &vertBlurFBO);
-  glBindFramebuffer(GL_FRAMEBUFFER, vertBlurFBO);
-  unsigned int vertBlurBuffer;
-  glGenTextures(1, &vertBlurBuffer);
-  glBindTexture(GL_TEXTURE_2D, vertBlurBuffer);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGB, viewportWidth / blurScale, viewportHeight / blurScale, 0, GL_RGB, GL_FLOAT, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, vertBlurBuffer, 0);
-  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
-      std::cerr << "Frame buffer not complete!";
-      return 1;
+  RenderTargetDesc shadowMapDesc;
+  shadowMapDesc.internalFormat = GL_DEPTH_COMPONENT;
+  shadowMapDesc.format = GL_DEPTH_COMPONENT;
+  shadowMapDesc.fixedWidth = shadowTier.mapSize;
+  shadowMapDesc.fixedHeight = shadowTier.mapSize;
+  shadowMapDesc.filter = GL_LINEAR;
+  shadowMapDesc.compareMode = GL_COMPARE_REF_TO_TEXTURE;
+  shadowMapDesc.wrap = GL_CLAMP_TO_BORDER;
+  std::fill(shadowMapDesc.borderColor, shadowMapDesc.borderColor + 4, 1.0f);
+  shadowMapDesc.textureUnit = texUnit_shadowMap;
+  const FrameGraph::ResourceId shadowMap = frameGraph.createTarget("shadow map", shadowMapDesc);
+
+  RenderTargetDesc depthStencilDesc;
+  depthStencilDesc.internalFormat = GL_DEPTH24_STENCIL8;
+  depthStencilDesc.format = GL_DEPTH_STENCIL;
+  depthStencilDesc.type = GL_UNSIGNED_INT_24_8;
+  depthStencilDesc.renderbuffer = true;
+  depthStencilDesc.dynamicScale = true;
+  const FrameGraph::ResourceId sceneDepth = frameGraph.createTarget("scene depth", depthStencilDesc);
+
+  RenderTargetDesc emissionDesc;
+  emissionDesc.wrap = GL_CLAMP_TO_BORDER;
+  emissionDesc.dynamicScale = true;
+  emissionDesc.textureUnit = texUnit_emissionFBO;
+  const FrameGraph::ResourceId emission = frameGraph.createTarget("emission", emissionDesc);
+
+  RenderTargetDesc sceneDesc;
+  sceneDesc.textureUnit = texUnit_scene;
+  sceneDesc.dynamicScale = true;
+  const FrameGraph::ResourceId scene = frameGraph.createTarget("scene", sceneDesc);
+
+  // Weighted blended order-independent transparency (McGuire and Bavoil).
+  // Accumulation holds the weighted sum of premultiplied colour. Revealage
+  // holds the sum of weights in red and the product of (1 - alpha) in alpha.
+  RenderTargetDesc transparencyDesc;
+  transparencyDesc.internalFormat = GL_RGBA16F;
+  transparencyDesc.format = GL_RGBA;
+  transparencyDesc.dynamicScale = true;
+  transparencyDesc.textureUnit = texUnit_transparencyAccum;
+  const FrameGraph::ResourceId transparencyAccum =
+      frameGraph.createTarget("transparency accumulation", transparencyDesc);
+  transparencyDesc.textureUnit = texUnit_transparencyRevealage;
+  const FrameGraph::ResourceId transparencyRevealage =
+      frameGraph.createTarget("transparency revealage", transparencyDesc);
+
+  RenderTargetDesc blurDesc;
+  blurDesc.scaleDivisor = blurScale;
+  blurDesc.dynamicScale = true;
+  blurDesc.textureUnit = texUnit_horzBlur;
+  const FrameGraph::ResourceId horzBlur = frameGraph.createTarget("horizontal blur", blurDesc);
+  blurDesc.textureUnit = texUnit_vertBlur;
+  const FrameGraph::ResourceId vertBlur = frameGraph.createTarget("vertical blur", blurDesc);
+
+  frameGraph.addPass("shadow", {}, {shadowMap}, [&]() {
+    const float nearPlane = 1.0f;
+    const float farPlane = 50.0f;
+    const float orthoSize = 10.0f;
+    const glm::mat4 lightProj = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, nearPlane, farPlane);
+    const glm::mat4 lightView = glm::lookAt(
+        playerPosition - 20.0f * playerLightDir,
+        playerPosition,
+        glm::vec3(0.0f, 1.0f, 0.0f));
+    lightSpaceMatrix = lightProj * lightView;
+    glClear(GL_DEPTH_BUFFER_BIT);
+    simpleDepthShader.use();
+    glUniformMatrix4fv(lsml, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    glUniformMatrix4fv(glGetUniformLocation(simpleDepthShader.id, "model"), 1,
+                 GL_FALSE, glm::value_ptr(playerModelTransform));
+    playerModel.Draw(simpleDepthShader);
+    // Only enemies whose bounding sphere touches the light's box can cast into
+    // the map. The projection is orthographic, so w is 1 and the box is
+    // [-1, 1] in every axis.
+    {
+      allocs::Zone zone("render prep");
+      shadowCasters.clear();
+      const glm::vec3 radiusNdc(wigglyBoiRadius / orthoSize, wigglyBoiRadius / orthoSize,
+                                2.0f * wigglyBoiRadius / (farPlane - nearPlane));
+      for (int i = 0; i < enemies.size(); ++i) {
+        const glm::vec4 p = lightSpaceMatrix * glm::vec4(enemies[i].position, 1.0f);
+        if (std::abs(p.x) <= 1.0f + radiusNdc.x && std::abs(p.y) <= 1.0f + radiusNdc.y &&
+            std::abs(p.z) <= 1.0f + radiusNdc.z) {
+          shadowCasters.push_back(i);
+        }
+      }
+    }
+    shadowCasterDraws += shadowCasters.size();
+    shadowCasterCandidates += enemies.size();
+    wigglyDepthShader.use();
+    wigglyDepthShader.setFloat("time", currentFrame);
+    glUniformMatrix4fv(glGetUniformLocation(wigglyDepthShader.id, "PV"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    // Orthographic, so every enemy is the same size in the shadow map.
+    shadowLod = enemyShadowLods.select(
+        LodSelector::orthographicPixels(wigglyBoiRadius, 2.0f * orthoSize, shadowMapDesc.fixedHeight),
+        wigglyBoi.numLods());
+    drawWigglyBois(wigglyBoi, wigglyDepthShader, enemies, shadowCasters, shadowLod);
+  });
+
+  // Colour and emission come out of the same geometry pass, as attachments 0
+  // and 1. Every program drawn here writes both.
+  frameGraph.addPass("scene", {shadowMap}, {scene, emission, sceneDepth}, [&]() {
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+    const float noEmission[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    glClearBufferfv(GL_COLOR, 1, noEmission);
+
+    // Per-program uniforms; the per-draw ones are set by the queue.
+    const glm::vec2 sceneSize =
+        glm::vec2(viewportWidth, viewportHeight) * frameGraph.renderScale();
+    playerShader.use();
+    playerShader.setVec3("viewPos", cameraPos);
+    playerShader.setBool("useLight", true);
+    glUniformMatrix4fv(glGetUniformLocation(playerShader.id, "PV"), 1,
+                       GL_FALSE, glm::value_ptr(PV));
+    glUniformMatrix4fv(playerLightSpaceMatrixLocation, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    playerShader.setInt("shadow_map", texUnit_shadowMap);
+    lightClusters.use(playerShader, sceneSize);
+
+    basicTextureShader.use();
+    basicTextureShader.setBool("useLight", true);
+    basicTextureShader.setBool("useSpec", true);
+    lightClusters.use(basicTextureShader, sceneSize);
+    basicTextureShader.setVec3("viewPos", cameraPos);
+    glUniformMatrix4fv(glGetUniformLocation(basicTextureShader.id, "lightSpaceMatrix"),
+                       1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    glUniformMatrix4fv(glGetUniformLocation(basicTextureShader.id, "PV"), 1,
+                       GL_FALSE, glm::value_ptr(PV));
+
+    wigglyShader.use();
+    lightClusters.use(wigglyShader, sceneSize);
+    glUniformMatrix4fv(glGetUniformLocation(wigglyShader.id, "PV"), 1, GL_FALSE, glm::value_ptr(PV));
+    glUniformMatrix4fv(glGetUniformLocation(wigglyShader.id, "lightSpaceMatrix"),
+                       1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
+    wigglyShader.setFloat("time", currentFrame);
+    wigglyShader.setVec3("nosePos", glm::vec3(1.0f, monsterY, -2.0f));
+    wigglyShader.setBool("useLight", true);
+
+    {  // Queue building, watched by --alloc-check.
+      allocs::Zone zone("render prep");
+      {  // Player
+        const int model = sceneQueue.addTransform(playerModelTransform);
+        const int aimRot = sceneQueue.addTransform(glm::rotate(
+            glm::mat4(1.0f),
+            aimTheta,
+            glm::vec3(0.0f, 1.0f, 0.0f)));
+        const float depth = glm::distance(cameraPos, playerPosition);
+        for (int i = 0; i < playerModel.meshes.size(); ++i) {
+          const PlayerMesh& mesh = playerModel.meshes[i];
+          mesh.syncVertices();
+          RenderQueue::Draw draw;
+          draw.vao = mesh.vao();
+          draw.count = mesh.indexCount();
+          draw.indexed = true;
+          draw.indexType = mesh.indexType();
+          draw.transform = model;
+          draw.aimRot = aimRot;
+          sceneQueue.submit(playerMaterials[i], draw, depth);
+        }
+      }
+
+      {  // Floor
+        RenderQueue::Draw draw;
+        draw.vao = floorVAO;
+        draw.count = 6;
+        draw.transform = sceneQueue.addTransform(glm::rotate(
+            glm::mat4(1.0f),
+            glm::radians(45.0f),
+            glm::vec3(0.0f, 1.0f, 0.0f)));
+        sceneQueue.submit(floorMaterial, draw, glm::length(cameraFollowVec));
+      }
+
+      for (std::vector<int>& lodEnemies : enemiesByLod) {
+        lodEnemies.clear();
+      }
+      for (int i = 0; i < enemies.size(); ++i) {
+        const float pixels = LodSelector::perspectivePixels(wigglyBoiRadius,
+            glm::distance(cameraPos, enemies[i].position), glm::radians(45.0f),
+            viewportHeight * frameGraph.renderScale());
+        enemiesByLod[enemyLods.select(pixels, wigglyBoi.numLods())].push_back(i);
+      }
+      for (int lod = 0; lod < enemiesByLod.size(); ++lod) {
+        enemyLodDraws[lod] += enemiesByLod[lod].size();
+        for (const int i : enemiesByLod[lod]) {
+          const Enemy& e = enemies[i];
+          glm::mat4 modelTransform, rotOnly;
+          wigglyBoiTransforms(e, &modelTransform, &rotOnly);
+          const int model = sceneQueue.addTransform(modelTransform);
+          const int aimRot = sceneQueue.addTransform(rotOnly);
+          const float depth = glm::distance(cameraPos, e.position);
+          for (const PlayerMesh& mesh : wigglyBoi.getMeshes()) {
+            RenderQueue::Draw draw;
+            draw.vao = mesh.vao();
+            draw.count = mesh.indexCount(lod);
+            draw.indexed = true;
+            draw.indexType = mesh.indexType();
+            draw.firstIndex = mesh.firstIndex(lod);
+            draw.transform = model;
+            draw.aimRot = aimRot;
+            sceneQueue.submit(wigglyMaterial, draw, depth);
+          }
+        }
+      }
+    }
+
+    sceneQueue.flush();
+    playerShader.use();
+    playerShader.setBool("useLight", false);
+
+    if (isMeasuredFrame) {
+      logTimeSince("scene rendered: ", frameStart);
+      std::cout << "  (" << enemies.size() << " wiggly bois, "
+                << bulletImpactSprites.size() << " sprites)" << std::endl;
+    }
+
+#if DEBUG
+    glstate::disable(GL_DEPTH_TEST);
+    nodeShader.use();
+    for (int i = 0; i < 3; ++i) { // Axis markers
+      const bool isX = i == 0;
+      const bool isY = i == 1;
+      const bool isZ = i == 2;
+      const glm::vec3 pointVec(isX ? 1.0f : 0.0f, monsterY + isY ? 1.0f : 0.0f,
+                               isZ ? 1.0f : 0.0f);
+      const glm::mat4 pointPos = glm::translate(glm::mat4(1.0f), pointVec);
+      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "model"), 1,
+                         GL_FALSE, glm::value_ptr(pointPos));
+      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "PV"), 1,
+                         GL_FALSE, glm::value_ptr(PV));
+      nodeShader.setVec3("color", pointVec);
+      glPointSize(7.0f);
+      glstate::bindVertexArray(singlePointVAO);
+      glDrawArrays(GL_POINTS, 0, 1);
+    }
+    { // Projectile spawn point debug
+      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "model"), 1,
+                         GL_FALSE,
+                         glm::value_ptr(glm::translate(glm::mat4(1.0f),
+                                                       projectileSpawnPoint)));
+      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "PV"), 1,
+                         GL_FALSE, glm::value_ptr(PV));
+      nodeShader.setVec3("color", glm::vec3(1.0f, 0.0f, 0.0f));
+      glPointSize(7.0f);
+      glstate::bindVertexArray(singlePointVAO);
+      glDrawArrays(GL_POINTS, 0, 1);
+    }
+    { // Capsule collider debug
+      nodeShader.use();
+      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "PV"), 1,
+                         GL_FALSE, glm::value_ptr(PV));
+      nodeShader.setVec3("color", glm::vec3(0.0f, 1.0f, 1.0f));
+      for (const Enemy& e : enemies) {
+        drawCapsuleBounds(nodeShader, e.position, e.dir, ENEMY_COLLIDER);
+      }
+    }
+    glstate::enable(GL_DEPTH_TEST);
+#endif
+  });
+
+  // Effects draw unsorted over the scene's depth without writing it. Attachment
+  // 0 accumulates, attachment 1 sums weights and multiplies revealage through
+  // the alpha factors, and emission adds for glow. Without per-attachment
+  // blend functions in GL 3.3 one separate RGB/alpha function serves all
+  // three. Resolved in the composite.
+  frameGraph.addPass("transparency", {},
+                     {transparencyAccum, transparencyRevealage, emission, sceneDepth}, [&]() {
+    const float noAccum[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+    const float allRevealed[4] = {0.0f, 0.0f, 0.0f, 1.0f};
+    glClearBufferfv(GL_COLOR, 0, noAccum);
+    glClearBufferfv(GL_COLOR, 1, allRevealed);
+    glstate::enable(GL_BLEND);
+    glstate::depthMask(false);
+    glBlendFuncSeparate(GL_ONE, GL_ONE, GL_ZERO, GL_ONE_MINUS_SRC_ALPHA);
+
+    spriteShader.use();
+    glUniformMatrix4fv(glGetUniformLocation(spriteShader.id, "PV"), 1, GL_FALSE,
+                       glm::value_ptr(PV));
+
+    {  // Queue building, watched by --alloc-check.
+      allocs::Zone zone("render prep");
+      if (muzzleFlashSpritesAge.size() != 0) {
+        // Muzzle flash(es)
+        const float scale = 50.0f;
+        glm::mat4 model = glm::scale(muzzleTransform, glm::vec3(scale, scale, scale));
+        model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0, 1.0, 0.0));
+        model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0, 0.0, 0.0));
+        model = glm::translate(model, glm::vec3(0.7f, 0.0f, 0.0f));
+        const glm::vec4 thingo = model * glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
+        const float yRot = acos(thingo.y);
+        const float t = aimTheta >= 0.0f ? aimTheta : aimTheta + 2.0f * pi;
+        const float bbRad = 0.5f;
+        const float bb =
+            (aimTheta >= 0.0f && aimTheta <= pi)
+            ? (bbRad - 2.0f * bbRad * t / pi)
+            : (-3.0f * bbRad + 2.0f * bbRad * t / pi);
+        model = glm::rotate(model, bb - yRot + 0.94f, glm::vec3(1.0f, 0.0f, 0.0f));
+        const int transform = transparentQueue.addTransform(model);
+        const float depth = glm::distance(cameraPos, muzzleWorldPos3);
+        for (const float spriteAge : muzzleFlashSpritesAge) {
+          RenderQueue::Draw draw;
+          draw.vao = unitSquareVAO;
+          draw.count = 6;
+          draw.transform = transform;
+          draw.age = spriteAge;
+          transparentQueue.submit(muzzleFlashMaterial, draw, depth);
+        }
+      }
+
+      {  // Bullet impact sprites
+        const float scale = 0.25f;
+        for (const auto& sprite : bulletImpactSprites) {
+          glm::mat4 model = glm::translate(
+                  glm::mat4(1.0f),
+                  sprite.worldPos);
+          // Billboarding
+          for (int i = 0; i < 3; i++) {
+            for (int j = 0; j < 3; j++) {
+              model[i][j] = viewTransform[j][i];
+            }
+          }
+          model = glm::scale(model, glm::vec3(scale, scale, scale));
+
+          RenderQueue::Draw draw;
+          draw.vao = unitSquareVAO;
+          draw.count = 6;
+          draw.transform = transparentQueue.addTransform(model);
+          draw.age = sprite.age;
+          transparentQueue.submit(impactSpriteMaterial, draw, glm::distance(cameraPos, sprite.worldPos));
+        }
+      }
+    }
+    drawBullets();
+    transparentQueue.flush();
+
+    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+    glstate::disable(GL_BLEND);
+    glstate::depthMask(true);
+    if (isMeasuredFrame) {
+      logTimeSince("transparency rendered: ", frameStart);
+    }
+  });
+
+  frameGraph.addPass("horizontal blur", {emission}, {horzBlur}, [&]() {
+    glstate::disable(GL_DEPTH_TEST);
+    glstate::bindVertexArray(moreObnoxiousQuadVAO);
+    blurShader.use();
+    blurShader.setInt("image", texUnit_emissionFBO);
+    blurShader.setInt("horizontal", true);
+    blurShader.setFloat("uvScale", frameGraph.renderScale());
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+  });
+
+  frameGraph.addPass("vertical blur", {horzBlur}, {vertBlur}, [&]() {
+    glstate::bindVertexArray(moreObnoxiousQuadVAO);
+    blurShader.use();
+    blurShader.setInt("image", texUnit_horzBlur);
+    blurShader.setInt("horizontal", false);
+    blurShader.setFloat("uvScale", frameGraph.renderScale());
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+  });
+
+  frameGraph.addPass("composite",
+                     {scene, vertBlur, emission, transparencyAccum, transparencyRevealage},
+                     {FrameGraph::BACKBUFFER}, [&]() {
+    sceneDrawShader.use();
+    glstate::bindVertexArray(moreObnoxiousQuadVAO);
+    sceneDrawShader.setInt("base_texture", texUnit_scene);
+    sceneDrawShader.setInt("accum_texture", texUnit_transparencyAccum);
+    sceneDrawShader.setInt("revealage_texture", texUnit_transparencyRevealage);
+    sceneDrawShader.setInt("emission_texture", texUnit_vertBlur);
+    sceneDrawShader.setInt("bright_texture", texUnit_emissionFBO);
+    sceneDrawShader.setFloat("uvScale", frameGraph.renderScale());
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    if (DEBUG) {  // Emission in the top right corner.
+      basicerShader.use();
+      glstate::bindVertexArray(obnoxiousQuadVAO);
+      basicerShader.setInt("greyscale", false);
+      basicerShader.setInt("tex", texUnit_emissionFBO);
+      glDrawArrays(GL_TRIANGLES, 0, 6);
+    }
+    glstate::enable(GL_DEPTH_TEST);
+  });
+
+  frameGraph.compile(viewportWidth, viewportHeight);
+  frameGraph.setBackbuffer(headlessFbo);
+  frameGraph.logStats();
+  frameGraph.enableGpuTiming();
+  std::unique_ptr<FrameCapture> frameCapture;
+  if (!captureDir.empty()) {
+    frameCapture.reset(new FrameCapture(captureDir, viewportWidth, viewportHeight));
   }
 
-  glActiveTexture(GL_TEXTURE0 + texUnit_scene);
-  glEnable(GL_CULL_FACE);
-  glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-  glEnable(GL_DEPTH_TEST);
+  glstate::enable(GL_CULL_FACE);
+  glstate::clearColor(0.1f, 0.1f, 0.1f, 1.0f);
+  glstate::enable(GL_DEPTH_TEST);
   glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
 
-  glActiveTexture(GL_TEXTURE0);
+  glstate::activeTexture(0);
 
+  glstate::resetCounters();
   std::cout << "Entering render loop." << std::endl;
   int fpsLogCount = 0;
-  const float startTime = glfwGetTime();
+  int headlessFrame = 0;
+  const auto clock = [&]() -> float {
+    return headless ? headlessFrame * headlessFrameStep : glfwGetTime();
+  };
+  const float startTime = clock();
   const int framesPerLog = 100;
   int frameMeasurementCount = 0;
   float totalFrameTime = 0.0f;
-  while (!glfwWindowShouldClose(window)) {
-    const bool isMeasuredFrame = false;//fpsLogCount++ % 100 == 0;
+  int totalStateChanges = 0;
+  int totalUnsortedStateChanges = 0;
+  long long totalHeapAllocations = 0;
+  float totalGpuMs = 0.0f;
+  float totalRenderScale = 0.0f;
+  std::vector<float> totalPassMs;
+  int gpuSamples = 0;
+  // Over the whole run, for the headless summary.
+  std::vector<float> runPassMs;
+  int runGpuSamples = 0;
+  const auto runStart = std::chrono::high_resolution_clock::now();
+  int projViewportWidth = viewportWidth;
+  int projViewportHeight = viewportHeight;
+  while (headless ? headlessFrame < headlessFrames : !glfwWindowShouldClose(window)) {
+    isMeasuredFrame = false;//fpsLogCount++ % 100 == 0;
     if (isMeasuredFrame) {
       std::cout << std::endl << "MEASURING FRAME" << std::endl;
     }
-    const auto frameStart = std::chrono::high_resolution_clock::now();
+    framePacer.beginFrame();
+    frameStart = std::chrono::high_resolution_clock::now();
 
-    float currentFrame = glfwGetTime();
+    currentFrame = clock();
     deltaTime = lastFrame == 0.0f ? 0.0f : currentFrame - lastFrame;
     lastFrame = currentFrame;
-    const float timeSinceStart = (glfwGetTime() - startTime);
-    glfwPollEvents();
-    processInput(window);
+    const float timeSinceStart = (clock() - startTime);
+    if (!headless) {
+      glfwPollEvents();
+      processInput(window);
+    }
+
+    if (viewportWidth > 0 && viewportHeight > 0 &&
+        (viewportWidth != projViewportWidth || viewportHeight != projViewportHeight)) {
+      projViewportWidth = viewportWidth;
+      projViewportHeight = viewportHeight;
+      frameGraph.resize(viewportWidth, viewportHeight);
+      projTransform = glm::perspective(
+          glm::radians(45.0f), (float)viewportWidth / viewportHeight, 0.1f, 10.0f);
+      projInv = glm::inverse(projTransform);
+    }
 
     {
       totalFrameTime += deltaTime;
       frameMeasurementCount++;
+      const RenderQueue::Stats& queueStats = sceneQueue.lastFlushStats();
+      totalStateChanges += queueStats.programChanges + queueStats.materialChanges + queueStats.vaoChanges;
+      totalUnsortedStateChanges += queueStats.unsortedChanges;
       if (frameMeasurementCount == framesPerLog) {
         std::cout << "average frame time: " << (totalFrameTime / framesPerLog) << std::endl;
+        std::cout << "  scene state changes per frame: " << (totalStateChanges / framesPerLog)
+                  << " (" << (totalUnsortedStateChanges / framesPerLog) << " unsorted)" << std::endl;
+        const glstate::Counters glCalls = glstate::counters();
+        std::cout << "  GL state calls per frame: " << (glCalls.issued / framesPerLog)
+                  << " issued, " << (glCalls.elided / framesPerLog) << " elided" << std::endl;
+        glstate::resetCounters();
+        const FramePacer::Stats pacing = framePacer.takeStats();
+        std::cout << "  frames in flight <= " << framePacer.maxFramesInFlight() << ", waited "
+                  << (pacing.waitMs / framesPerLog) << "ms per frame" << std::endl;
+        if (pacing.inputFrames > 0) {
+          std::cout << "  input latency over " << pacing.inputFrames << " frames: "
+                    << pacing.inputToSwapMs << "ms to swap, " << pacing.inputToGpuMs
+                    << "ms to GPU done (max " << pacing.maxInputToGpuMs << "ms)" << std::endl;
+        }
+        if (allocs::hooked()) {
+          std::cout << "  heap allocations per frame: " << (totalHeapAllocations / (float)framesPerLog)
+                    << std::endl;
+          totalHeapAllocations = 0;
+        }
+        const LightClusters::Stats lightStats = lightClusters.stats();
+        std::cout << "  lights: " << lightStats.lights << " (" << lightStats.droppedLights
+                  << " dropped), " << lightStats.indices << " cluster indices, busiest cluster "
+                  << lightStats.busiestCluster << std::endl;
+        std::cout << "  enemies per frame by LOD:";
+        for (int& draws : enemyLodDraws) {
+          std::cout << " " << (draws / framesPerLog);
+          draws = 0;
+        }
+        std::cout << ", shadow LOD " << shadowLod << std::endl;
+        std::cout << "  shadow casters per frame: " << (shadowCasterDraws / framesPerLog)
+                  << " of " << (shadowCasterCandidates / framesPerLog) << std::endl;
+        if (gpuSamples > 0) {
+          std::cout << "  GPU frame time: " << (totalGpuMs / gpuSamples) << "ms (target "
+                    << dynamicResolution.targetMs() << "ms), render scale "
+                    << (totalRenderScale / gpuSamples)
+                    << (dynamicResolution.isDynamic() ? "" : " (fixed)") << std::endl;
+          std::cout << "  GPU ms per pass:";
+          for (int i = 0; i < totalPassMs.size(); ++i) {
+            std::cout << " " << frameGraph.passName(i) << " " << (totalPassMs[i] / gpuSamples);
+          }
+          std::cout << std::endl;
+        }
+        totalPassMs.assign(totalPassMs.size(), 0.0f);
+        totalGpuMs = 0.0f;
+        totalRenderScale = 0.0f;
+        gpuSamples = 0;
+        shadowCasterDraws = 0;
+        shadowCasterCandidates = 0;
         totalFrameTime = 0.0f;
+        totalStateChanges = 0;
+        totalUnsortedStateChanges = 0;
         frameMeasurementCount = 0;
       }
     }
@@ -756,6 +1588,7 @@ int main(int argc, const char **argv) {
     }
 
     {
+      allocs::Zone zone("updateBullets");
       const int origEnemyCount = enemies.size();
       bulletStore.updateBullets(deltaTime, &enemies, &bulletImpactSprites);
 #if SD_ENABLE_IRRKLANG
@@ -769,83 +1602,54 @@ int main(int argc, const char **argv) {
     }
     if (isAlive) {
       enemySpawner.update(playerPosition, deltaTime);
+      allocs::Zone zone("chasePlayer");
       chasePlayer(deltaTime, &enemies);
       if (!isAlive) {
-        playerModel.setPlayerDead(timeSinceStart);
+        playerAnimation.setDead(timeSinceStart);
       }
     }
     if (isMeasuredFrame) {
       logTimeSince("enemies updated: ", frameStart);
     }
 
-    const glm::vec3 cameraPos = playerPosition + cameraFollowVec;
-    const glm::mat4 viewTransform =
-        glm::lookAt(cameraPos, playerPosition, cameraUp);
-    const glm::mat4 PV = projTransform * viewTransform;
-
+    cameraPos = playerPosition + cameraFollowVec;
+    viewTransform = glm::lookAt(cameraPos, playerPosition, cameraUp);
+    PV = projTransform * viewTransform;
     float dx = 0.0f;
     float dz = 0.0f;
     if (isAlive) {
-      // TODO extract to helper fn
-      // Aiming
-      // Map from screen (clip) coords back to world coords for an infinite plane
-      // at monsterY.
-      // TODO it'd probably be simpler to do a line intersection from camera pos
-      // to the plane along the direction vector. Probably faster too (no matrix
-      // inverse).
-      const glm::mat4 inv = glm::inverse(viewTransform) * projInv;
-      const float t = (inv[0][1] * mouseClipX + inv[1][1] * mouseClipY + inv[3][1] - monsterY *
-               (inv[0][3] * mouseClipX + inv[1][3] * mouseClipX + inv[3][3])) /
-          (inv[2][3] * monsterY - inv[2][1]);
-      const float s = 1.0f / (inv[0][3] * mouseClipX + inv[1][3] * mouseClipY + inv[2][3] * t + inv[3][3]);
-      const float us = mouseClipX * s;
-      const float vs = mouseClipY * s;
-      const float ts = t * s;
-      const float worldX = inv[0][0] * us + inv[1][0] * vs + inv[2][0] * ts + inv[3][0] * s;
-      const float worldZ = inv[0][2] * us + inv[1][2] * vs + inv[2][2] * ts + inv[3][2] * s;
-
-      // Calculate aim rotation.
-      dx = worldX - playerPosition.x;
-      dz = worldZ - playerPosition.z;
-      aimTheta = atan(dx / dz) + (dz < 0.0f ? pi : 0.0f);
-      if (abs(mouseClipX) < 0.005f && abs(mouseClipY) < 0.005f) {
-        // TODO shortcut earlier once extracted to helper fn
-        aimTheta = 0;
-      }
-
+      aimTheta = aimAt(mouseClipX, mouseClipY, viewTransform, projInv, &dx, &dz);
       if (isMeasuredFrame) {
         logTimeSince("aim resolved: ", frameStart);
       }
     }
-    glm::vec3 muzzleWorldPos3;
-    bool usePointLight = false;
-
-    playerModel.UpdatePointsForAnim(isMeasuredFrame, playerMovementDir, aimTheta, timeSinceStart);
+    {
+      allocs::Zone zone("animation");
+      playerAnimation.setInputs(playerMovementDir, aimTheta);
+      AnimationInstance::evaluateAll(&threadPool, animated, numAnimated, timeSinceStart);
+      if (isMeasuredFrame) {
+        logTimeSince("  anims processed: ", frameStart);
+      }
+      playerModel.skin(&threadPool, playerAnimation.globalTransforms(), isMeasuredFrame);
+    }
 
     if (isMeasuredFrame) {
       logTimeSince("player animations updated: ", frameStart);
     }
 
-    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-    wigglyShader.use();
-    wigglyShader.setFloat("time", currentFrame);
-    glUniformMatrix4fv(glGetUniformLocation(wigglyShader.id, "PV"), 1,
-                       GL_FALSE, glm::value_ptr(PV));
-
-    const glm::mat4 playerModelTransform = glm::rotate(
+    playerModelTransform = glm::rotate(
           glm::scale(glm::translate(glm::mat4(1.0f), playerPosition),
                      glm::vec3(playerModelScale)),
           aimTheta, glm::vec3(0.0f, 1.0f, 0.0f));
     // TODO offset for "left-right" muzzle alignment is not the best. Fix aiming
     // trig to account for this.
-    const glm::vec3 projectileSpawnPoint =
+    projectileSpawnPoint =
         playerModelTransform * glm::vec4(-20.0f, playerModelGunHeight,
                                    playerModelGunMuzzleOffset, 1.0f);
     if (isAlive && isTryingToFire && (lastFireTime + fireInterval) < currentFrame) {
       const auto bulletSpawnStart = std::chrono::high_resolution_clock::now();
       const glm::vec4 midDir = glm::normalize(glm::vec4(dx, 0.0f, dz, 1.0f));
-      bulletStore.createBullets(projectileSpawnPoint, midDir, spreadAmount);
+      bulletStore.createBullets(projectileSpawnPoint, midDir, spreadAmount, bulletsPierce);
 #if SD_ENABLE_IRRKLANG
       soundEngine->play2D(fireSound, false);
 #endif
@@ -857,133 +1661,14 @@ int main(int argc, const char **argv) {
       }
     }
 
-    const auto drawBullets = [&]() {
-      glEnable(GL_BLEND);
-      glDepthMask(GL_FALSE);
-      glActiveTexture(GL_TEXTURE0 + texUnit_bullet);
-      instancedTextureShader.use();
-      instancedTextureShader.setInt("texture_diffuse", texUnit_bullet);
-      instancedTextureShader.setBool("useLight", false);
-      glUniformMatrix4fv(glGetUniformLocation(instancedTextureShader.id, "PV"), 1,
-                         GL_FALSE, glm::value_ptr(PV));
-      bulletStore.renderBulletSprites();
-      glDisable(GL_BLEND);
-      glDepthMask(GL_TRUE);
-    };
-    const auto drawFloor = [&](const glm::mat4* const lightSpaceMatrixOrNull) { // Floor
-      basicTextureShader.use();
-      basicTextureShader.setBool("useLight", !!lightSpaceMatrixOrNull);
-      basicTextureShader.setBool("useSpec", !!lightSpaceMatrixOrNull);
-      basicTextureShader.setInt("texture_diffuse", texUnit_floorDiffuse);
-      basicTextureShader.setInt("texture_normal", texUnit_floorNormal);
-      basicTextureShader.setInt("texture_spec", texUnit_floorSpec);
-      basicTextureShader.setInt("shadow_map", texUnit_shadowMap);
-      basicTextureShader.setBool("usePointLight", usePointLight);
-      basicTextureShader.setVec3("pointLight.worldPos", muzzleWorldPos3);
-      basicTextureShader.setVec3("pointLight.color", muzzlePointLightColor);
-      basicTextureShader.setVec3("viewPos", cameraPos);
-      if (lightSpaceMatrixOrNull) {
-        glUniformMatrix4fv(glGetUniformLocation(basicTextureShader.id, "lightSpaceMatrix"),
-                           1, GL_FALSE, glm::value_ptr(*lightSpaceMatrixOrNull));
-      }
-      glUniformMatrix4fv(glGetUniformLocation(basicTextureShader.id, "model"),
-                         1, GL_FALSE, glm::value_ptr(glm::rotate(
-                             glm::mat4(1.0f),
-                             glm::radians(45.0f),
-                             glm::vec3(0.0f, 1.0f, 0.0f))));
-      glUniformMatrix4fv(glGetUniformLocation(basicTextureShader.id, "PV"), 1,
-                         GL_FALSE, glm::value_ptr(PV));
-      glBindVertexArray(floorVAO);
-      glDrawArrays(GL_TRIANGLES, 0, 6);
-      basicTextureShader.setBool("useLight", false);
-      basicTextureShader.setBool("useSpec", false);
-    };
-
-    playerShader.use();
-    glm::mat4 lightSpaceMatrix(1.0f);
-    playerShader.setVec3("viewPos", cameraPos);
-    { // Draw player
-      playerShader.setBool("useLight", true);
-      glUniformMatrix4fv(glGetUniformLocation(playerShader.id, "model"), 1,
-                   GL_FALSE, glm::value_ptr(playerModelTransform));
-      glUniformMatrix4fv(glGetUniformLocation(playerShader.id, "aimRot"), 1,
-                   GL_FALSE, glm::value_ptr(glm::rotate(
-                       glm::mat4(1.0f),
-                       aimTheta,
-                       glm::vec3(0.0f, 1.0f, 0.0f))));
-      glUniformMatrix4fv(glGetUniformLocation(playerShader.id, "PV"), 1,
-                         GL_FALSE, glm::value_ptr(PV));
-
-      {  // Get the player shadow.
-        const float nearPlane = 1.0f;
-        const float farPlane = 50.0f;
-        const float orthoSize = 10.0f;
-        const glm::mat4 lightProj = glm::ortho(-orthoSize, orthoSize, -orthoSize, orthoSize, nearPlane, farPlane);
-        const glm::mat4 lightView = glm::lookAt(
-            playerPosition - 20.0f * playerLightDir,
-            playerPosition,
-            glm::vec3(0.0f, 1.0f, 0.0f));
-        lightSpaceMatrix = lightProj * lightView;
-        simpleDepthShader.use();
-        glUniformMatrix4fv(lsml, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        glUniformMatrix4fv(glGetUniformLocation(simpleDepthShader.id, "model"), 1,
-                     GL_FALSE, glm::value_ptr(playerModelTransform));
-        glViewport(0, 0, SHADOW_WIDTH, SHADOW_HEIGHT);
-        glBindFramebuffer(GL_FRAMEBUFFER, depthMapFBO);
-        glClear(GL_DEPTH_BUFFER_BIT);
-        playerModel.Draw(simpleDepthShader, false);
-        wigglyShader.use();
-        glUniformMatrix4fv(glGetUniformLocation(wigglyShader.id, "PV"), 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        drawWigglyBois(wigglyBoi, wigglyShader, enemies);
-
-        glBindFramebuffer(GL_FRAMEBUFFER, sceneRenderFBO);
-        glViewport(0, 0, viewportWidth, viewportHeight);
-
-        glUniformMatrix4fv(glGetUniformLocation(wigglyShader.id, "PV"), 1, GL_FALSE, glm::value_ptr(PV));
-
-        // Player emission
-        glBindFramebuffer(GL_FRAMEBUFFER, emissionFBO);
-        glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-        glEnable(GL_DEPTH_TEST);
-        textureShader.use();
-        glUniformMatrix4fv(glGetUniformLocation(textureShader.id, "PV"), 1, GL_FALSE, glm::value_ptr(PV));
-        glUniformMatrix4fv(glGetUniformLocation(textureShader.id, "model"), 1, GL_FALSE, glm::value_ptr(playerModelTransform));
-        textureShader.setInt("tex", texUnit_playerEmission);
-        playerModel.meshes[0].Draw(textureShader);
-        textureShader.setInt("tex", texUnit_gunEmission);
-        playerModel.meshes[1].Draw(textureShader);
-        glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
-        drawFloor(nullptr);
-        glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
-        drawBullets();
-        glBindFramebuffer(GL_FRAMEBUFFER, sceneRenderFBO);
-        glClearColor(0.1f, 0.1f, 0.1f, 1.0f);
-
-        if (DEBUG) {
-          basicerShader.use();
-          glBindVertexArray(obnoxiousQuadVAO);
-          basicerShader.setInt("greyscale", false);
-          basicerShader.setInt("tex", texUnit_emissionFBO);
-          glDrawArrays(GL_TRIANGLES, 0, 6);
-        }
-
-        playerShader.use();
-        glUniformMatrix4fv(playerLightSpaceMatrixLocation, 1, GL_FALSE, glm::value_ptr(lightSpaceMatrix));
-        playerShader.setInt("shadow_map", texUnit_shadowMap);
-      }
-    }
-    if (isMeasuredFrame) {
-      logTimeSince("shadow map and emissions generated: ", frameStart);
-    }
-    glm::mat4 muzzleTransform(1.0f);
+    lightClusters.clear();
     if (muzzleFlashSpritesAge.size() != 0) {
       // Muzzle pos calc
 
       // Position in original model of gun muzzle
       const glm::vec3 pointVec(197.0f, 76.143f, -3.054f);
       // Adjust for animation
-      const glm::mat4 T = glm::translate(playerModel.getAnimatedGunTransform(), pointVec);
+      const glm::mat4 T = glm::translate(playerAnimation.gunTransform(), pointVec);
       // Adjust for player
       muzzleTransform = playerModelTransform * T;
 
@@ -997,187 +1682,118 @@ int main(int argc, const char **argv) {
       for (const float a : muzzleFlashSpritesAge) {
         minAge = std::min(a, minAge);
       }
-      usePointLight = minAge < 0.03f;
-      playerShader.setBool("usePointLight", usePointLight);
-      playerShader.setVec3("pointLight.worldPos", muzzleWorldPos3);
-      playerShader.setVec3("pointLight.color", muzzlePointLightColor);
-    } else {
-      usePointLight = false;
-      playerShader.setBool("usePointLight", false);
+      if (minAge < 0.03f) {
+        lightClusters.addLight(muzzleWorldPos3, muzzlePointLightColor, muzzlePointLightRange);
+      }
     }
-
-    playerModel.Draw(playerShader);
-    playerShader.setBool("useLight", false);
-
-    drawFloor(&lightSpaceMatrix);
-    if (muzzleFlashSpritesAge.size() != 0) {
-      // Muzzle flash(es)
-      glDepthMask(GL_FALSE);
-      glEnable(GL_BLEND);
-      spriteShader.use();
-      glUniformMatrix4fv(glGetUniformLocation(spriteShader.id, "PV"), 1, GL_FALSE,
-                         glm::value_ptr(PV));
-      glBindVertexArray(unitSquareVAO);
-      spriteShader.setInt("numCols", muzzleFlashImpactSpritesheet.numCols);
-      spriteShader.setInt("spritesheet", muzzleFlashImpactSpritesheet.textureUnit);
-      spriteShader.setFloat("timePerSprite", muzzleFlashImpactSpritesheet.timePerSprite);
-      const float scale = 50.0f;
-      glm::mat4 model = glm::scale(muzzleTransform, glm::vec3(scale, scale, scale));
-      model = glm::rotate(model, glm::radians(0.0f), glm::vec3(0.0, 1.0, 0.0));
-      model = glm::rotate(model, glm::radians(-90.0f), glm::vec3(1.0, 0.0, 0.0));
-      model = glm::translate(model, glm::vec3(0.7f, 0.0f, 0.0f));
-      const glm::vec4 thingo = model * glm::vec4(0.0f, 0.0f, 1.0f, 1.0f);
-      const float yRot = acos(thingo.y);
-      const float t = aimTheta >= 0.0f ? aimTheta : aimTheta + 2.0f * pi;
-      const float bbRad = 0.5f;
-      const float bb =
-          (aimTheta >= 0.0f && aimTheta <= pi)
-          ? (bbRad - 2.0f * bbRad * t / pi)
-          : (-3.0f * bbRad + 2.0f * bbRad * t / pi);
-      model = glm::rotate(model, bb - yRot + 0.94f, glm::vec3(1.0f, 0.0f, 0.0f));
-      glUniformMatrix4fv(glGetUniformLocation(spriteShader.id, "model"), 1, GL_FALSE,
-                         glm::value_ptr(model));
-      for (const float spriteAge : muzzleFlashSpritesAge) {
-        spriteShader.setFloat("age", spriteAge);
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+    {
+      const float impactDur = bulletImpactSpritesheet.numCols * bulletImpactSpritesheet.timePerSprite;
+      for (const SpritesheetSprite& s : bulletImpactSprites) {
+        const float fade = std::max(0.0f, 1.0f - s.age / impactDur);
+        lightClusters.addLight(s.worldPos, impactLightColor * fade, impactLightRange);
       }
-      glDisable(GL_BLEND);
-      glDepthMask(GL_TRUE);
+      bulletStore.forEachLiveBullet([&](const glm::vec3& position) {
+        lightClusters.addLight(position, bulletLightColor, bulletLightRange);
+      });
+      lightClusters.build(viewTransform, projTransform);
       if (isMeasuredFrame) {
-        logTimeSince("muzzle sprites rendered: ", frameStart);
+        logTimeSince("lights binned: ", frameStart);
       }
     }
 
-    if (isMeasuredFrame) {
-      logTimeSince("player rendered: ", frameStart);
-    }
-    wigglyShader.use();
-    wigglyShader.setBool("useLight", true);
-    drawWigglyBois(wigglyBoi, wigglyShader, enemies);
-
-    if (isMeasuredFrame) {
-      logTimeSince("wiggly bois rendered: ", frameStart);
-      std::cout << "  (" << enemies.size() << " wiggly bois)" << std::endl;
-    }
-
-    {  // Bullet impact sprites
-      glEnable(GL_BLEND);
-      spriteShader.use();
-      glUniformMatrix4fv(glGetUniformLocation(spriteShader.id, "PV"), 1, GL_FALSE,
-                         glm::value_ptr(PV));
-      glBindVertexArray(unitSquareVAO);
-      spriteShader.setInt("numCols", bulletImpactSpritesheet.numCols);
-      spriteShader.setInt("spritesheet", bulletImpactSpritesheet.textureUnit);
-      spriteShader.setFloat("timePerSprite", bulletImpactSpritesheet.timePerSprite);
-      const float scale = 0.25f;
-      for (const auto& sprite : bulletImpactSprites) {
-        glm::mat4 model = glm::translate(
-                glm::mat4(1.0f),
-                sprite.worldPos);
-        // Billboarding
-        for (int i = 0; i < 3; i++) {
-          for (int j = 0; j < 3; j++) {
-            model[i][j] = viewTransform[j][i];
-          }
+    {
+      FrameGraph::GpuTimes gpuTimes;
+      if (frameGraph.takeGpuTimes(&gpuTimes)) {
+        dynamicResolution.update(gpuTimes.fixedMs, gpuTimes.scaledMs, gpuTimes.renderScale);
+        totalGpuMs += gpuTimes.fixedMs + gpuTimes.scaledMs;
+        totalRenderScale += gpuTimes.renderScale;
+        gpuSamples++;
+        totalPassMs.resize(gpuTimes.passMs.size());
+        runPassMs.resize(gpuTimes.passMs.size());
+        for (int i = 0; i < gpuTimes.passMs.size(); ++i) {
+          totalPassMs[i] += gpuTimes.passMs[i];
+          runPassMs[i] += gpuTimes.passMs[i];
         }
-        model = glm::scale(model, glm::vec3(scale, scale, scale));
-
-        spriteShader.setFloat("age", sprite.age);
-        glUniformMatrix4fv(glGetUniformLocation(spriteShader.id, "model"), 1, GL_FALSE,
-                           glm::value_ptr(model));
-
-        glDrawArrays(GL_TRIANGLES, 0, 6);
+        runGpuSamples++;
       }
-      glDisable(GL_BLEND);
-      if (isMeasuredFrame) {
-        logTimeSince("impact sprites rendered: ", frameStart);
-        std::cout << "  (" << bulletImpactSprites.size() << " sprites)" << std::endl;
+      frameGraph.setRenderScale(dynamicResolution.scale());
+    }
+    {  // Late latch
+      // Cursor motion that arrived during the update re-aims the player's draws
+      // without re-simulating. Bullets already left along the simulated aim.
+      if (!headless) {
+        glfwPollEvents();
+      }
+      float lateTheta = aimTheta;
+      if (isAlive) {
+        float lateDx, lateDz;
+        lateTheta = aimAt(mouseClipX, mouseClipY, viewTransform, projInv, &lateDx, &lateDz);
       }
+      framePacer.latchInput();
+      const glm::mat4 aimCorrection =
+          glm::rotate(glm::mat4(1.0f), lateTheta - aimTheta, glm::vec3(0.0f, 1.0f, 0.0f));
+      glstate::bindBuffer(GL_UNIFORM_BUFFER, lateLatchedUbo);
+      glBufferData(GL_UNIFORM_BUFFER, sizeof(aimCorrection), glm::value_ptr(aimCorrection),
+                   GL_STREAM_DRAW);
     }
+    frameGraph.execute();
 
-    if (isMeasuredFrame) {
-      logTimeSince("bullets rendered: ", frameStart);
+    if (headless) {
+      if (frameCapture) {
+        frameCapture->capture(headlessFbo, headlessFrame);
+      }
+      headlessFrame++;
+    } else {
+      glfwSwapBuffers(window);
     }
+    framePacer.endFrame();
 
-    glDisable(GL_DEPTH_TEST);
-#if DEBUG
-    nodeShader.use();
-    for (int i = 0; i < 3; ++i) { // Axis markers
-      const bool isX = i == 0;
-      const bool isY = i == 1;
-      const bool isZ = i == 2;
-      const glm::vec3 pointVec(isX ? 1.0f : 0.0f, monsterY + isY ? 1.0f : 0.0f,
-                               isZ ? 1.0f : 0.0f);
-      const glm::mat4 pointPos = glm::translate(glm::mat4(1.0f), pointVec);
-      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "model"), 1,
-                         GL_FALSE, glm::value_ptr(pointPos));
-      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "PV"), 1,
-                         GL_FALSE, glm::value_ptr(PV));
-      nodeShader.setVec3("color", pointVec);
-      glPointSize(7.0f);
-      glBindVertexArray(singlePointVAO);
-      glDrawArrays(GL_POINTS, 0, 1);
-    }
-    { // Projectile spawn point debug
-      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "model"), 1,
-                         GL_FALSE,
-                         glm::value_ptr(glm::translate(glm::mat4(1.0f),
-                                                       projectileSpawnPoint)));
-      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "PV"), 1,
-                         GL_FALSE, glm::value_ptr(PV));
-      nodeShader.setVec3("color", glm::vec3(1.0f, 0.0f, 0.0f));
-      glPointSize(7.0f);
-      glBindVertexArray(singlePointVAO);
-      glDrawArrays(GL_POINTS, 0, 1);
+    if (isMeasuredFrame) {
+      logTimeSince("frame complete: ", frameStart);
     }
-    { // Capsule collider debug
-      nodeShader.use();
-      glUniformMatrix4fv(glGetUniformLocation(nodeShader.id, "PV"), 1,
-                         GL_FALSE, glm::value_ptr(PV));
-      nodeShader.setVec3("color", glm::vec3(0.0f, 1.0f, 1.0f));
-      for (const Enemy& e : enemies) {
-        drawCapsuleBounds(nodeShader, e.position, e.dir, ENEMY_COLLIDER);
+    FrameArena::nextFrame();
+    totalHeapAllocations += allocs::sinceLastFrame().allocations;
+    if (allocCheck) {
+      if (allocs::checkFailed()) {
+        std::cerr << "Allocation check failed on frame " << headlessFrame << std::endl;
+        exit(1);
+      }
+      if (headlessFrame == allocCheckWarmupFrames) {
+        allocs::armZoneCheck();
       }
     }
-#endif
-    glEnable(GL_DEPTH_TEST);
-
-    glDisable(GL_DEPTH_TEST);
-    glBindFramebuffer(GL_FRAMEBUFFER, horzBlurFBO);
-    glViewport(0, 0, viewportWidth / blurScale, viewportHeight / blurScale);
-    glBindVertexArray(moreObnoxiousQuadVAO);
-    blurShader.use();
-    blurShader.setInt("image", texUnit_emissionFBO);
-    blurShader.setInt("horizontal", true);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, vertBlurFBO);
-    glBindVertexArray(moreObnoxiousQuadVAO);
-    blurShader.use();
-    blurShader.setInt("image", texUnit_horzBlur);
-    blurShader.setInt("horizontal", false);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-
-    glViewport(0, 0, viewportWidth, viewportHeight);
-
-    glBindFramebuffer(GL_FRAMEBUFFER, 0);
-    sceneDrawShader.use();
-    glBindVertexArray(moreObnoxiousQuadVAO);
-    sceneDrawShader.setInt("base_texture", texUnit_scene);
-    sceneDrawShader.setInt("emission_texture", texUnit_vertBlur);
-    sceneDrawShader.setInt("bright_texture", texUnit_emissionFBO);
-    glDrawArrays(GL_TRIANGLES, 0, 6);
-    glEnable(GL_DEPTH_TEST);
-
-    glfwSwapBuffers(window);
-    glBindFramebuffer(GL_FRAMEBUFFER, sceneRenderFBO);
+  }
 
-    if (isMeasuredFrame) {
-      logTimeSince("frame complete: ", frameStart);
+  framePacer.finish();
+  if (headless) {
+    glFinish();
+    const float seconds = std::chrono::duration<float>(
+        std::chrono::high_resolution_clock::now() - runStart).count();
+    std::cout << "Rendered " << headlessFrames << " frames in " << seconds << "s ("
+              << (headlessFrames / seconds) << " fps, including capture)" << std::endl;
+    if (runGpuSamples > 0) {
+      std::cout << "Average GPU ms per pass over " << runGpuSamples << " frames:" << std::endl;
+      float total = 0.0f;
+      for (int i = 0; i < runPassMs.size(); ++i) {
+        std::cout << "  " << frameGraph.passName(i) << ": " << (runPassMs[i] / runGpuSamples) << std::endl;
+        total += runPassMs[i] / runGpuSamples;
+      }
+      std::cout << "  total: " << total << std::endl;
     }
+    frameCapture.reset();
   }
 
+  resources::dump();
+  if (allocs::hooked()) {
+    allocs::dump();
+  }
+  if (allocCheck) {
+    std::cout << "Allocation check passed: no allocations in the combat loop after frame "
+              << allocCheckWarmupFrames << std::endl;
+  }
   std::cout << "Terminating" << std::endl;
-  glfwTerminate();
+  if (!headless) {
+    glfwTerminate();
+  }
   return 0;
 }
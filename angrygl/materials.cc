@@ -0,0 +1,55 @@
+#include "angrygl/materials.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+int MaterialLibrary::add(const Material &m) {
+  if (materials.size() == maxMaterials) {
+    std::cerr << "Too many materials, raise MAX_MATERIALS" << std::endl;
+    exit(1);
+  }
+  materials.push_back(m);
+  return materials.size() - 1;
+}
+
+namespace {
+
+int layerOrNone(const TextureLayer &t) { return t.array < 0 ? -1 : t.layer; }
+
+// Unset roles still need their sampler on a unit holding an array.
+int arrayOrDiffuse(const TextureLayer &t, const Material &m) {
+  return t.array < 0 ? m.diffuse.array : t.array;
+}
+
+} // namespace
+
+void MaterialLibrary::uploadTable(const Shader &shader) const {
+  std::vector<int> table;
+  for (const Material &m : materials) {
+    table.push_back(m.diffuse.layer);
+    table.push_back(layerOrNone(m.spec));
+    table.push_back(layerOrNone(m.normal));
+    table.push_back(layerOrNone(m.emission));
+  }
+  shader.use();
+  glUniform4iv(glGetUniformLocation(shader.id, "material_layers"), materials.size(),
+               table.data());
+}
+
+std::vector<std::pair<std::string, int>> MaterialLibrary::uniforms(int material) const {
+  const Material &m = materials[material];
+  return {
+      {"texture_diffuse", pool->unit(m.diffuse.array)},
+      {"texture_spec", pool->unit(arrayOrDiffuse(m.spec, m))},
+      {"texture_normal", pool->unit(arrayOrDiffuse(m.normal, m))},
+      {"texture_emission", pool->unit(arrayOrDiffuse(m.emission, m))},
+      {"material", material},
+  };
+}
+
+void MaterialLibrary::use(const Shader &shader, int material) const {
+  for (const auto &u : uniforms(material)) {
+    shader.setInt(u.first, u.second);
+  }
+}
@@ -0,0 +1,46 @@
+#ifndef _SD_ANG_MATERIALS_H_
+#define _SD_ANG_MATERIALS_H_
+
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "opengl/shader.h"
+#include "opengl/texture_array.h"
+
+// The texture layers a surface samples. Roles a material doesn't have are left
+// unset; shaders see their layer as -1 and skip them.
+struct Material {
+  TextureLayer diffuse;
+  TextureLayer spec;
+  TextureLayer normal;
+  TextureLayer emission;
+};
+
+// Shaders pick a material with the "material" uniform, which indexes their
+// material_layers[] table, and sample each role's sampler2DArray at that
+// layer. Materials whose textures share arrays differ only in the index.
+class MaterialLibrary {
+public:
+  // Must match MAX_MATERIALS in the shaders.
+  static const int maxMaterials = 16;
+
+  explicit MaterialLibrary(const TextureArrayPool *pool) : pool(pool) {}
+
+  int add(const Material &m);
+  // Uploads the layer table. Call once per program after all materials are
+  // added and the pool is built.
+  void uploadTable(const Shader &shader) const;
+  // Sampler and index uniforms selecting material, e.g. for
+  // RenderQueue::addMaterial.
+  std::vector<std::pair<std::string, int>> uniforms(int material) const;
+  // Sets those uniforms on shader, which must be in use.
+  void use(const Shader &shader, int material) const;
+
+private:
+  // Not owned.
+  const TextureArrayPool *pool;
+  std::vector<Material> materials;
+};
+
+#endif // _SD_ANG_MATERIALS_H_
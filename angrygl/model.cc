@@ -1,59 +1,62 @@
 #include "angrygl/model.h"
 
+#include <algorithm>
 #include <cfloat>
 
 #include "assimp/Importer.hpp"
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
+#include "opengl/gl_state.h"
+#include "opengl/mesh_optimizer.h"
+#include "opengl/mesh_simplifier.h"
+#include "opengl/resource_registry.h"
 #include "stb/image.h"
 
 namespace {
 
-unsigned int TextureFromFile(const char *path, const std::string &directory) {
-  std::string filename = path;
-  filename = directory + '/' + filename;
-
+unsigned int uploadTexture(int width, int height, int nrComponents,
+                           unsigned char *data) {
   unsigned int textureID;
   glGenTextures(1, &textureID);
 
-  int width, height, nrComponents;
-  unsigned char *data =
-      stbi_load(filename.c_str(), &width, &height, &nrComponents, 0);
-  if (data) {
-    GLenum format;
-    if (nrComponents == 1)
-      format = GL_RED;
-    else if (nrComponents == 3)
-      format = GL_RGB;
-    else if (nrComponents == 4)
-      format = GL_RGBA;
-
-    glBindTexture(GL_TEXTURE_2D, textureID);
-    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
-                 GL_UNSIGNED_BYTE, data);
-    glGenerateMipmap(GL_TEXTURE_2D);
-
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
-                    GL_LINEAR_MIPMAP_LINEAR);
-    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-
-    stbi_image_free(data);
-  } else {
-    std::cout << "Texture failed to load at path: " << path << std::endl;
-    stbi_image_free(data);
-  }
+  GLenum format;
+  if (nrComponents == 1)
+    format = GL_RED;
+  else if (nrComponents == 3)
+    format = GL_RGB;
+  else if (nrComponents == 4)
+    format = GL_RGBA;
+
+  glstate::bindTexture(glstate::activeTextureUnit(), GL_TEXTURE_2D, textureID);
+  glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, format,
+               GL_UNSIGNED_BYTE, data);
+  glGenerateMipmap(GL_TEXTURE_2D);
+  resources::track(resources::TEXTURE, textureID,
+                   resources::textureBytes(format, width, height, 1, true), "model textures");
+
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER,
+                  GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
 
   return textureID;
 }
 
 } // namespace
 
-void Model::Draw(Shader shader) const {
+void Model::Draw(Shader shader, int lod) const {
   for (unsigned int i = 0; i < meshes.size(); i++) {
-    meshes[i].Draw(shader);
+    meshes[i].Draw(shader, lod);
+  }
+}
+
+int Model::numLods() const {
+  int result = 0;
+  for (const PlayerMesh &mesh : meshes) {
+    result = std::max(result, mesh.numLods());
   }
+  return result;
 }
 
 void Model::loadModel(std::string path) {
@@ -69,13 +72,48 @@ void Model::loadModel(std::string path) {
   }
   directory = path.substr(0, path.find_last_of('/'));
   processNode(scene->mRootNode, scene);
+  // One box for every mesh so shaders can take it once per program.
+  for (const PendingMesh &p : pendingMeshes) {
+    bounds.include(p.vertices);
+  }
+  for (const PendingMesh &p : pendingMeshes) {
+    checkPackingPrecision(p.vertices, bounds);
+  }
+}
+
+void Model::uploadMeshes() {
+  for (PendingTexture &p : pendingTextures) {
+    Texture texture;
+    if (p.data) {
+      texture.openGlId = uploadTexture(p.width, p.height, p.nrComponents, p.data);
+    } else {
+      std::cout << "Texture failed to load at path: " << p.path << std::endl;
+      glGenTextures(1, &texture.openGlId);
+    }
+    stbi_image_free(p.data);
+    texture.type = p.type;
+    texture.path = p.path;
+    texturesLoaded.push_back(texture);
+  }
+  pendingTextures.clear();
+
+  meshes.reserve(meshes.size() + pendingMeshes.size());
+  for (PendingMesh &p : pendingMeshes) {
+    std::vector<Texture> textures;
+    for (const int t : p.textures) {
+      textures.push_back(texturesLoaded[t]);
+    }
+    meshes.emplace_back(std::move(p.vertices), std::move(p.indices), std::move(textures),
+                        bounds, std::move(p.coarserLods));
+  }
+  pendingMeshes.clear();
 }
 
 void Model::processNode(aiNode *node, const aiScene *scene) {
   // process all the node's meshes (if any)
   for (unsigned int i = 0; i < node->mNumMeshes; i++) {
     aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    meshes.push_back(processMesh(mesh, scene));
+    pendingMeshes.push_back(processMesh(mesh, scene));
   }
   // then do the same for each of its children
   for (unsigned int i = 0; i < node->mNumChildren; i++) {
@@ -83,10 +121,12 @@ void Model::processNode(aiNode *node, const aiScene *scene) {
   }
 }
 
-PlayerMesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
-  std::vector<Vertex> vertices;
-  std::vector<unsigned int> indices;
-  std::vector<Texture> textures;
+Model::PendingMesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
+  PendingMesh result;
+  std::vector<Vertex>& vertices = result.vertices;
+  std::vector<unsigned int>& indices = result.indices;
+  vertices.reserve(mesh->mNumVertices);
+  indices.reserve(mesh->mNumFaces * 3);
 
   for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
     Vertex vertex;
@@ -130,41 +170,49 @@ PlayerMesh Model::processMesh(aiMesh *mesh, const aiScene *scene) {
   // process material
   if (enableTextures && mesh->mMaterialIndex >= 0) {
     aiMaterial *material = scene->mMaterials[mesh->mMaterialIndex];
-    std::vector<Texture> diffuseMaps = loadMaterialTextures(
+    std::vector<int> diffuseMaps = loadMaterialTextures(
         material, aiTextureType_DIFFUSE, TextureType::DIFFUSE);
-    textures.insert(textures.end(), diffuseMaps.begin(), diffuseMaps.end());
-    std::vector<Texture> specularMaps = loadMaterialTextures(
+    result.textures.insert(result.textures.end(), diffuseMaps.begin(), diffuseMaps.end());
+    std::vector<int> specularMaps = loadMaterialTextures(
         material, aiTextureType_SPECULAR, TextureType::SPECULAR);
-    textures.insert(textures.end(), specularMaps.begin(), specularMaps.end());
+    result.textures.insert(result.textures.end(), specularMaps.begin(), specularMaps.end());
   }
 
+  const int welded = weldVertices(&vertices, &indices);
   std::cout << "Loaded mesh with vertices: " << vertices.size()
-            << ", indices: " << indices.size() << std::endl;
-  return PlayerMesh(vertices, indices, textures);
+            << " (" << welded << " duplicates welded), indices: " << indices.size()
+            << std::endl;
+  std::vector<std::vector<unsigned int>> lods = buildLodChain(vertices, indices, maxLods);
+  vertices = remapVertices(vertices, optimizeMeshOrder(&lods, vertices.size()));
+  indices = lods[0];
+  result.coarserLods.assign(lods.begin() + 1, lods.end());
+  return result;
 }
 
-std::vector<Texture> Model::loadMaterialTextures(aiMaterial *mat,
-                                                 aiTextureType type,
-                                                 TextureType type2) {
-  std::vector<Texture> textures;
+std::vector<int> Model::loadMaterialTextures(aiMaterial *mat,
+                                             aiTextureType type,
+                                             TextureType type2) {
+  std::vector<int> textures;
   for (unsigned int i = 0; i < mat->GetTextureCount(type); i++) {
     aiString str;
     mat->GetTexture(type, i, &str);
     bool skip = false;
-    for (unsigned int j = 0; j < texturesLoaded.size(); j++) {
-      if (std::strcmp(texturesLoaded[j].path.data(), str.C_Str()) == 0) {
-        textures.push_back(texturesLoaded[j]);
+    for (unsigned int j = 0; j < pendingTextures.size(); j++) {
+      if (std::strcmp(pendingTextures[j].path.data(), str.C_Str()) == 0) {
+        textures.push_back(texturesLoaded.size() + j);
         skip = true;
         break;
       }
     }
-    if (!skip) { // if texture hasn't been loaded already, load it
-      Texture texture;
-      texture.openGlId = TextureFromFile(str.C_Str(), directory);
-      texture.type = type2;
+    if (!skip) { // if texture hasn't been loaded already, decode it
+      PendingTexture texture;
       texture.path = str.C_Str();
-      textures.push_back(texture);
-      texturesLoaded.push_back(texture); // add to loaded textures
+      texture.type = type2;
+      const std::string filename = directory + '/' + texture.path;
+      texture.data = stbi_load(filename.c_str(), &texture.width,
+                               &texture.height, &texture.nrComponents, 0);
+      textures.push_back(texturesLoaded.size() + pendingTextures.size());
+      pendingTextures.push_back(texture);
     }
   }
   return textures;
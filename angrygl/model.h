@@ -4,6 +4,7 @@
 #include <vector>
 
 #include "angrygl/player_mesh.h"
+#include "opengl/packed_vertex.h"
 #include "opengl/shader.h"
 #include "opengl/texture.h"
 #include "opengl/vertex.h"
@@ -15,22 +16,58 @@ public:
   Model(char *path, bool enableTextures = true) {
     this->enableTextures = enableTextures;
     loadModel(path);
+    uploadMeshes();
   }
 
-  void Draw(Shader shader) const;
+  // For split loading: loadModel() off the GL thread, then uploadMeshes() on
+  // it. Meshes get up to maxLods levels of detail, see buildLodChain().
+  explicit Model(bool enableTextures, int maxLods = 1)
+      : enableTextures(enableTextures), maxLods(maxLods) {}
+
+  // Imports the file and builds vertex/index data and decoded textures. Makes
+  // no GL calls.
+  void loadModel(std::string path);
+  // Creates the GL meshes and textures from what loadModel produced.
+  void uploadMeshes();
+
+  void Draw(Shader shader, int lod = 0) const;
+  int numLods() const;
+  const std::vector<PlayerMesh> &getMeshes() const { return meshes; }
+  // Decode box for every mesh's packed positions.
+  const PositionBounds &positionBounds() const { return bounds; }
 
 private:
+  // Decoded image waiting for upload.
+  struct PendingTexture {
+    std::string path;
+    TextureType type;
+    int width;
+    int height;
+    int nrComponents;
+    unsigned char *data;
+  };
+  struct PendingMesh {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+    std::vector<std::vector<unsigned int>> coarserLods;
+    // Indices into pendingTextures.
+    std::vector<int> textures;
+  };
+
   /*  Model Data  */
   bool enableTextures;
+  int maxLods = 1;
   std::vector<PlayerMesh> meshes;
+  PositionBounds bounds;
   std::string directory;
   std::vector<Texture> texturesLoaded;
+  std::vector<PendingMesh> pendingMeshes;
+  std::vector<PendingTexture> pendingTextures;
   /*  Functions   */
-  void loadModel(std::string path);
   void processNode(aiNode *node, const aiScene *scene);
-  PlayerMesh processMesh(aiMesh *mesh, const aiScene *scene);
-  std::vector<Texture> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
-                                            TextureType type2);
+  PendingMesh processMesh(aiMesh *mesh, const aiScene *scene);
+  std::vector<int> loadMaterialTextures(aiMaterial *mat, aiTextureType type,
+                                        TextureType type2);
 };
 
 #endif // ANG_SD_MODEL_H_
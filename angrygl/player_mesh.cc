@@ -2,67 +2,127 @@
 
 #include <string>
 
+#include "opengl/gl_state.h"
+#include "opengl/resource_registry.h"
+
 PlayerMesh::PlayerMesh(std::vector<Vertex> _vertices,
                        std::vector<unsigned int> _indices,
-                       std::vector<Texture> _textures)
-    : vertices(std::move(_vertices)),
-      indices(std::move(_indices)),
-      textures(std::move(_textures)) {
-  setupMesh();
+                       std::vector<Texture> _textures,
+                       const PositionBounds &_bounds,
+                       std::vector<std::vector<unsigned int>> _coarserLods)
+    : textures(std::move(_textures)),
+      bounds(_bounds),
+      vertices(std::move(_vertices)),
+      numVertices(vertices.size()) {
+  setupMesh(_indices, _coarserLods);
+}
+
+void PlayerMesh::Draw(Shader shader, int lod) const {
+  syncVertices();
+  glstate::bindVertexArray(VAO);
+  const Lod &l = lodFor(lod);
+  glDrawElements(GL_TRIANGLES, l.count, elementType,
+                 (void *)(l.firstIndex * (elementType == GL_UNSIGNED_SHORT
+                                              ? sizeof(unsigned short)
+                                              : sizeof(unsigned int))));
 }
 
-void PlayerMesh::Draw(Shader shader) const {
-  glBindVertexArray(VAO);
+void PlayerMesh::syncVertices() const {
   if (verticesDirty) {
-    glBindBuffer(GL_ARRAY_BUFFER, VBO);
-    glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(Vertex), &vertices[0],
-                 GL_STREAM_DRAW);
+    glstate::bindBuffer(GL_ARRAY_BUFFER, VBO);
+    packVertices(vertices, bounds, &packedVertices);
+    glBufferData(GL_ARRAY_BUFFER, packedVertices.size() * sizeof(PackedVertex),
+                 packedVertices.data(), GL_STREAM_DRAW);
+    resources::track(resources::BUFFER, VBO, packedVertices.size() * sizeof(PackedVertex),
+                     "meshes");
     verticesDirty = false;
+    std::vector<Vertex>().swap(vertices);
+    std::vector<PackedVertex>().swap(packedVertices);
+    trackCpuCopies();
   }
-  glDrawElements(GL_TRIANGLES, indices.size(), GL_UNSIGNED_INT, 0);
-  glBindVertexArray(0);
 }
 
-void PlayerMesh::updateVertices(std::vector<Vertex> newVertices) {
-  this->vertices = newVertices;
-  verticesDirty = true;
+PackedVertex *PlayerMesh::mapVertices() {
+  // The first upload gives the buffer its storage.
+  syncVertices();
+  glstate::bindBuffer(GL_ARRAY_BUFFER, VBO);
+  return (PackedVertex *)glMapBufferRange(GL_ARRAY_BUFFER, 0, numVertices * sizeof(PackedVertex),
+                                          GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+}
+
+void PlayerMesh::unmapVertices() {
+  glstate::bindBuffer(GL_ARRAY_BUFFER, VBO);
+  // False if the contents were lost, e.g. to a display mode change. The next
+  // frame rewrites them anyway.
+  glUnmapBuffer(GL_ARRAY_BUFFER);
+}
+
+void PlayerMesh::trackCpuCopies() const {
+  resources::trackCpu(this,
+                      vertices.capacity() * sizeof(Vertex) +
+                      packedVertices.capacity() * sizeof(PackedVertex),
+                      "meshes");
 }
 
-void PlayerMesh::setupMesh() {
+void PlayerMesh::setupMesh(const std::vector<unsigned int> &indices,
+                           const std::vector<std::vector<unsigned int>> &coarserLods) {
   verticesDirty = true;
   glGenVertexArrays(1, &VAO);
   glGenBuffers(1, &VBO);
   glGenBuffers(1, &EBO);
 
-  glBindVertexArray(VAO);
-  glBindBuffer(GL_ARRAY_BUFFER, VBO);
-
-  glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
-  glBufferData(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(unsigned int),
-               &indices[0], GL_STATIC_DRAW);
-
-  // vertex positions
-  glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex), (void *)0);
-  glEnableVertexAttribArray(0);
-  // vertex normals
-  glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)offsetof(Vertex, normal));
-  glEnableVertexAttribArray(1);
-  // vertex texture coords
-  glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(Vertex),
-                        (void *)offsetof(Vertex, texCoords));
-  glEnableVertexAttribArray(2);
-
-  glBindVertexArray(0);
+  glstate::bindVertexArray(VAO);
+  glstate::bindBuffer(GL_ARRAY_BUFFER, VBO);
+
+  std::vector<unsigned int> allIndices = indices;
+  lods = {{0, (int)indices.size()}};
+  for (const std::vector<unsigned int> &lod : coarserLods) {
+    lods.push_back({(int)allIndices.size(), (int)lod.size()});
+    allIndices.insert(allIndices.end(), lod.begin(), lod.end());
+  }
+
+  glstate::bindBuffer(GL_ELEMENT_ARRAY_BUFFER, EBO);
+  if (vertices.size() <= 65536) {
+    // Halves index fetch bandwidth.
+    elementType = GL_UNSIGNED_SHORT;
+    std::vector<unsigned short> shortIndices(allIndices.begin(), allIndices.end());
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, shortIndices.size() * sizeof(unsigned short),
+                 shortIndices.data(), GL_STATIC_DRAW);
+    resources::track(resources::BUFFER, EBO, shortIndices.size() * sizeof(unsigned short),
+                     "meshes");
+  } else {
+    elementType = GL_UNSIGNED_INT;
+    glBufferData(GL_ELEMENT_ARRAY_BUFFER, allIndices.size() * sizeof(unsigned int),
+                 allIndices.data(), GL_STATIC_DRAW);
+    resources::track(resources::BUFFER, EBO, allIndices.size() * sizeof(unsigned int),
+                     "meshes");
+  }
+
+  setupPackedVertexAttributes();
+
+  glstate::bindVertexArray(0);
+  trackCpuCopies();
 }
 
 PlayerMesh::PlayerMesh(PlayerMesh &&m)
-    : vertices(std::move(m.vertices)), indices(std::move(m.indices)), textures(std::move(m.textures)) {
-  setupMesh();
+    : textures(std::move(m.textures)), bounds(m.bounds), vertices(std::move(m.vertices)),
+      numVertices(m.numVertices), lods(std::move(m.lods)), verticesDirty(m.verticesDirty),
+      packedVertices(std::move(m.packedVertices)), VAO(m.VAO), VBO(m.VBO), EBO(m.EBO),
+      elementType(m.elementType) {
+  m.VAO = m.VBO = m.EBO = 0;
+  m.verticesDirty = false;
+  resources::untrackCpu(&m);
+  trackCpuCopies();
 }
 
 PlayerMesh::~PlayerMesh() {
-  glDeleteBuffers(1, &VBO);
-  glDeleteBuffers(1, &EBO);
-  glDeleteVertexArrays(1, &VAO);
+  resources::untrackCpu(this);
+  if (VAO == 0) {
+    return;
+  }
+  glstate::deleteBuffer(VBO);
+  glstate::deleteBuffer(EBO);
+  glstate::deleteVertexArray(VAO);
+  resources::untrack(resources::BUFFER, VBO);
+  resources::untrack(resources::BUFFER, EBO);
 }
@@ -1,33 +1,71 @@
 #ifndef ANG_SD_MESH_H_
 #define ANG_SD_MESH_H_
 
+#include <algorithm>
 #include <vector>
 
+#include "opengl/packed_vertex.h"
 #include "opengl/shader.h"
 #include "opengl/texture.h"
 #include "opengl/vertex.h"
 
 class PlayerMesh {
 public:
-  std::vector<Vertex> vertices;
-  std::vector<unsigned int> indices;
   std::vector<Texture> textures;
 
+  // The GL copy of vertices is packed within bounds, which shaders drawing
+  // the mesh need via usePositionBounds().
+  // coarserLods are extra index lists over the same vertices, LOD 1 first.
+  // Only the GL copies are kept once uploaded.
   PlayerMesh(std::vector<Vertex> vertices, std::vector<unsigned int> indices,
-             std::vector<Texture> textures);
+             std::vector<Texture> textures, const PositionBounds &bounds,
+             std::vector<std::vector<unsigned int>> coarserLods = {});
 
-  void Draw(Shader shader) const;
+  void Draw(Shader shader, int lod = 0) const;
   ~PlayerMesh();
 
-  PlayerMesh(PlayerMesh &&);
+  // Takes over m's GL objects, leaving m empty.
+  PlayerMesh(PlayerMesh &&m);
   PlayerMesh(const PlayerMesh &) = delete;
 
-  void updateVertices(std::vector<Vertex> newVertices);
+  // Uploads the vertices passed in. Draw() does this itself, for anything
+  // drawing the VAO directly.
+  void syncVertices() const;
+  // Maps the vertex buffer for rewriting every vertex, orphaning the storage
+  // the GPU may still be reading. Any thread may write through the pointer,
+  // but unmapVertices() must be called, on the GL thread, before drawing.
+  PackedVertex *mapVertices();
+  void unmapVertices();
+  int vertexCount() const { return numVertices; }
+
+  unsigned int vao() const { return VAO; }
+  int numLods() const { return lods.size(); }
+  // Levels past the last one clamp to it.
+  int indexCount(int lod = 0) const { return lodFor(lod).count; }
+  int firstIndex(int lod = 0) const { return lodFor(lod).firstIndex; }
+  // GL_UNSIGNED_SHORT when every vertex fits in 16 bits, else GL_UNSIGNED_INT.
+  unsigned int indexType() const { return elementType; }
 
 private:
+  struct Lod {
+    int firstIndex;
+    int count;
+  };
+
+  PositionBounds bounds;
+  // Pending upload, released by syncVertices().
+  mutable std::vector<Vertex> vertices;
+  int numVertices;
+  // All levels share the element buffer, LOD 0 first.
+  std::vector<Lod> lods;
   mutable bool verticesDirty = false;
-  unsigned int VAO, VBO, EBO;
-  void setupMesh();
+  mutable std::vector<PackedVertex> packedVertices;
+  unsigned int VAO = 0, VBO = 0, EBO = 0;
+  unsigned int elementType;
+  void setupMesh(const std::vector<unsigned int> &indices,
+                 const std::vector<std::vector<unsigned int>> &coarserLods);
+  void trackCpuCopies() const;
+  const Lod &lodFor(int lod) const { return lods[std::min(lod, (int)lods.size() - 1)]; }
 };
 
 #endif // ANG_SD_MESH_H_
@@ -3,21 +3,12 @@
 #include <chrono>
 #include <algorithm>
 #include <cfloat>
-#include <functional>
 
+#include "opengl/mesh_optimizer.h"
 #include "stb/image.h"
 
 namespace {
 
-// Previous animation weights
-float lastAnimTime = 0.0f;
-float prev_idleWeight = 0.0f;
-float prev_rightWeight = 0.0f;
-float prev_forwardWeight = 0.0f;
-float prev_backWeight = 0.0f;
-float prev_leftWeight = 0.0f;
-const float animTransitionTime = 0.2f;
-
 aiMatrix4x4 zeroAiMat() {
   aiMatrix4x4 m;
   for (int i = 0; i < 4; i++) {
@@ -32,64 +23,89 @@ void logTimeSince(const std::string& label, std::chrono::time_point<std::chrono:
   std::cout << label << y << "ms" << std::endl;
 }
 
-void appendNodePoints(
-    float targetAnimTicks, aiAnimation *anim, aiMatrix4x4 transform,
-    aiNode *node,
-    std::unordered_map<std::string, aiMatrix4x4> *nodeTransformMap) {
-  aiMatrix4x4 animTransform;
-  bool animFound = false;
-  for (int channelIndex = 0; channelIndex < anim->mNumChannels;
-       channelIndex++) {
-    const aiNodeAnim *const nodeAnim = anim->mChannels[channelIndex];
-    if (nodeAnim->mNodeName != node->mName) {
-      continue;
-    }
-    animFound = true;
-    for (int x = 0; x < nodeAnim->mNumRotationKeys; ++x) {
-      aiQuatKey k = nodeAnim->mRotationKeys[x];
-      if (k.mTime >= targetAnimTicks) {
-        animTransform = aiMatrix4x4(k.mValue.GetMatrix()) * animTransform;
-        break;
-      }
+std::string_view nameOf(const aiString &name) {
+  return std::string_view(name.data, name.length);
+}
+
+// Index of the last key at or before ticks, or 0 if there is none.
+template <class Key>
+int keyAtOrBefore(const Key *keys, const int numKeys, const double ticks) {
+  const Key *after = std::upper_bound(keys, keys + numKeys, ticks,
+      [](const double t, const Key &k) { return t < k.mTime; });
+  return std::max(0, (int)(after - keys) - 1);
+}
+
+// How far ticks is from keys[i] to keys[i + 1], clamped to the ends.
+template <class Key>
+float keyFraction(const Key *keys, const int numKeys, const int i, const double ticks) {
+  if (i + 1 >= numKeys || keys[i + 1].mTime <= keys[i].mTime) {
+    return 0.0f;
+  }
+  return std::min(1.0, std::max(0.0, (ticks - keys[i].mTime) / (keys[i + 1].mTime - keys[i].mTime)));
+}
+
+aiVector3D sampleVectorKeys(const aiVectorKey *keys, const int numKeys, const double ticks,
+                            const aiVector3D &fallback) {
+  if (numKeys == 0) {
+    return fallback;
+  }
+  const int i = keyAtOrBefore(keys, numKeys, ticks);
+  const float t = keyFraction(keys, numKeys, i, ticks);
+  return t == 0.0f ? keys[i].mValue : keys[i].mValue + (keys[i + 1].mValue - keys[i].mValue) * t;
+}
+
+aiQuaternion sampleQuatKeys(const aiQuatKey *keys, const int numKeys, const double ticks) {
+  if (numKeys == 0) {
+    return aiQuaternion();
+  }
+  const int i = keyAtOrBefore(keys, numKeys, ticks);
+  const float t = keyFraction(keys, numKeys, i, ticks);
+  if (t == 0.0f) {
+    return keys[i].mValue;
+  }
+  aiQuaternion q;
+  aiQuaternion::Interpolate(q, keys[i].mValue, keys[i + 1].mValue, t);
+  return q;
+}
+
+// Dropped keys may be off by a ten thousandth of the largest translation,
+// 0.06 degrees or a ten thousandth of a scale.
+const CompressedAnimation::Tolerance animationTolerance = {1e-4f, 1e-3f, 1e-4f};
+
+void toBoneMatrix(const aiMatrix4x4 &m, BoneMatrix *out) {
+  for (int r = 0; r < 3; ++r) {
+    for (int c = 0; c < 4; ++c) {
+      out->rows[r][c] = m[r][c];
     }
-    for (int x = 0; x < nodeAnim->mNumPositionKeys; ++x) {
-      aiVectorKey k = nodeAnim->mPositionKeys[x];
-      if (k.mTime >= targetAnimTicks) {
-        if (std::abs(k.mTime - targetAnimTicks) > 2.0f) {
-        }
-        animTransform.a4 += k.mValue.x;
-        animTransform.b4 += k.mValue.y;
-        animTransform.c4 += k.mValue.z;
-        break;
-      }
+  }
+}
+
+void appendMeshNodes(const aiMesh *mesh, const aiScene *scene, aiNode *node,
+                     ArenaVector<aiNode *> *meshNodes) {
+  for (int i = 0; i < node->mNumMeshes; i++) {
+    if (scene->mMeshes[node->mMeshes[i]] == mesh) {
+      meshNodes->push_back(node);
     }
   }
-  transform *= animFound ? animTransform : node->mTransformation;
-  const std::string name = node->mName.C_Str();
-  nodeTransformMap->emplace(name, transform);
-  for (int i = 0; i < node->mNumChildren; ++i) {
-    appendNodePoints(targetAnimTicks, anim, transform, node->mChildren[i],
-                     nodeTransformMap);
+  for (int i = 0; i < node->mNumChildren; i++) {
+    appendMeshNodes(mesh, scene, node->mChildren[i], meshNodes);
   }
 }
 
 } // namespace
 
-glm::mat4 PlayerModel::getAnimatedGunTransform() const {
-  return gunTransform;
-}
-
-void PlayerModel::Draw(Shader shader, bool applyTextures) const {
+void PlayerModel::Draw(Shader shader) const {
   for (unsigned int i = 0; i < meshes.size(); i++) {
-    if (applyTextures) {
-      shader.setInt("texture_diffuse", i);
-      shader.setInt("texture_spec", i == 0 ? 19 : 20);
-    }
     meshes[i].Draw(shader);
   }
 }
 
 void PlayerModel::loadModel(std::string path) {
+  importScene(path);
+  initGlResources();
+}
+
+void PlayerModel::importScene(std::string path) {
   scene = importer.ReadFile(path, aiProcess_Triangulate | aiProcess_FlipUVs);
   if (!scene || scene->mFlags & AI_SCENE_FLAGS_INCOMPLETE ||
       !scene->mRootNode) {
@@ -100,160 +116,224 @@ void PlayerModel::loadModel(std::string path) {
   globalInv = scene->mRootNode->mTransformation;
   globalInv = globalInv.Inverse();
   directory = path.substr(0, path.find_last_of('/'));
+
+  buildJoints(scene->mRootNode, -1);
+  compressed = CompressedAnimation(scene->mAnimations[0], animationTolerance);
+  reportCompression();
+
+  // Meshes start in the bind pose so the packing bounds, and the meshes
+  // themselves, exist before the first skin().
+  std::vector<aiMatrix4x4> bindPose(joints.size());
+  computeGlobals(nullptr, bindPose.data());
+  addPendingMeshes(scene->mRootNode, bindPose);
+  for (const PendingMesh &p : pendingMeshes) {
+    bounds.include(p.vertices);
+  }
+  bounds.expandForAnimation();
+  for (const PendingMesh &p : pendingMeshes) {
+    checkPackingPrecision(p.vertices, bounds);
+  }
+  for (int m = 0; m < skins.size(); ++m) {
+    for (int v = 0; v < skins[m].bindPose.size(); v += skinChunkSize) {
+      skinChunks.push_back({m, v});
+    }
+  }
+}
+
+void PlayerModel::initGlResources() {
   // Make node vao
   glGenVertexArrays(1, &nodeVAO);
   glGenBuffers(1, &nodeVBO);
-}
 
-void PlayerModel::setPlayerDead(float time) {
-  if (deathTime < 0.0f) {
-    deathTime = time;
+  meshes.reserve(pendingMeshes.size());
+  for (PendingMesh &p : pendingMeshes) {
+    // Player textures handled externally
+    meshes.emplace_back(std::move(p.vertices), std::move(p.indices),
+                        std::vector<Texture>(), bounds);
   }
+  pendingMeshes.clear();
 }
 
-void PlayerModel::UpdatePointsForAnim(
-    const bool isMeasuredFrame,
-    const glm::vec2 movementDir,
-    const float aimTheta,
-    float time) {
+void PlayerModel::skin(ThreadPool *pool, const std::vector<aiMatrix4x4> &globals,
+                       const bool isMeasuredFrame) {
   const auto start = std::chrono::high_resolution_clock::now();
-
-  aiAnimation *const anim = scene->mAnimations[0];
-  aiNode *const rootNode = scene->mRootNode;
-  std::unordered_map<std::string, aiMatrix4x4> mergedNodeTransformMap;
-  const auto processAnim = [&mergedNodeTransformMap, rootNode, anim, time](
-      const float weight,
-      const float minTicks,
-      const float maxTicks,
-      const float tickOffset,
-      // For non-looped
-      const float* opt_animStart = nullptr) {
-    if (weight == 0.0f) {
-      return;
-    }
-    const float tickRange = maxTicks - minTicks;
-    float targetAnimTicks = opt_animStart
-        ? std::min((float)((time - *opt_animStart) * anim->mTicksPerSecond + tickOffset), tickRange)
-        : fmod(time * anim->mTicksPerSecond + tickOffset, tickRange);
-    targetAnimTicks += minTicks;
-    if (targetAnimTicks < (minTicks - 0.01f) || targetAnimTicks > (maxTicks + 0.01f)) {
-      std::cerr << targetAnimTicks << std::endl;
-      exit(1);
-    }
-    std::unordered_map<std::string, aiMatrix4x4> localNodeTransformMap;
-    appendNodePoints(targetAnimTicks, anim, aiMatrix4x4(), rootNode,
-                     &localNodeTransformMap);
-    for (const auto &localNodeTransform : localNodeTransformMap) {
-      if (mergedNodeTransformMap.find(localNodeTransform.first) == mergedNodeTransformMap.end()) {
-        mergedNodeTransformMap[localNodeTransform.first] = zeroAiMat();
+  for (int m = 0; m < skins.size(); ++m) {
+    MeshSkin &s = skins[m];
+    if (s.rigid) {
+      aiMatrix4x4 transform;
+      for (const int joint : s.boneJoints) {
+        transform *= globals[joint];
+      }
+      toBoneMatrix(transform, &s.palette[0]);
+    } else {
+      for (int b = 0; b < s.boneJoints.size(); ++b) {
+        toBoneMatrix(globalInv * globals[s.boneJoints[b]] * s.boneOffsets[b], &s.palette[b]);
       }
-      // TODO +=???
-      mergedNodeTransformMap[localNodeTransform.first] = mergedNodeTransformMap[localNodeTransform.first]+
-          localNodeTransform.second * weight;
     }
-  };
-  const bool isPlayerMoving = glm::length(movementDir) > 0.1f;
-  const float movementTheta = atan(movementDir.x / movementDir.y) + (movementDir.y < 0.0f ? 3.14f : 0.0f);
-  const float thetaDelta = movementTheta - aimTheta;
-  const glm::vec2 movementAnim(sin(thetaDelta), cos(thetaDelta));
-
-  const float deltaTime = time - lastAnimTime;
-  lastAnimTime = time;
-  prev_idleWeight = std::max(0.0f, prev_idleWeight - deltaTime / animTransitionTime);
-  prev_rightWeight = std::max(0.0f, prev_rightWeight - deltaTime / animTransitionTime);
-  prev_leftWeight = std::max(0.0f, prev_leftWeight - deltaTime / animTransitionTime);
-  prev_forwardWeight = std::max(0.0f, prev_forwardWeight - deltaTime / animTransitionTime);
-  prev_backWeight = std::max(0.0f, prev_backWeight - deltaTime / animTransitionTime);
-
-  const bool isDead = deathTime >= 0.0f;
-  float deathWeight = isDead ? 1.0f : 0.0f;
-  float idleWeight = prev_idleWeight + ((isDead || isPlayerMoving) ? 0.0f : 1.0f);
-  float rightWeight = prev_rightWeight + (isPlayerMoving ? std::max(0.0f, -movementAnim.x) : 0.0f);
-  float forwardWeight = prev_forwardWeight + (isPlayerMoving ? std::max(0.0f, movementAnim.y) : 0.0f);
-  float backWeight = prev_backWeight + (isPlayerMoving ? std::max(0.0f, -movementAnim.y) : 0.0f);
-  float leftWeight = prev_leftWeight + (isPlayerMoving ? std::max(0.0f, movementAnim.x) : 0.0f);
-  const float weightSum = deathWeight + idleWeight + rightWeight + forwardWeight + backWeight + leftWeight;
-  deathWeight /= weightSum;
-  idleWeight /= weightSum;
-  rightWeight /= weightSum;
-  forwardWeight /= weightSum;
-  backWeight /= weightSum;
-  leftWeight /= weightSum;
-  prev_idleWeight = std::max(prev_idleWeight, idleWeight);
-  prev_rightWeight = std::max(rightWeight, prev_rightWeight);
-  prev_leftWeight = std::max(prev_leftWeight, leftWeight);
-  prev_forwardWeight = std::max(prev_forwardWeight, forwardWeight);
-  prev_backWeight = std::max(prev_backWeight, backWeight);
-  if (abs(rightWeight + forwardWeight + backWeight + leftWeight + idleWeight + deathWeight - 1.0f) > 0.001f) {
-    std::cerr << "anims did not add to 1.0f" << std::endl;
-    std::cerr << "aimTheta: " << aimTheta << std::endl;
-    std::cerr << "idleWeight: " << idleWeight << std::endl;
-    std::cerr << "deathWeight: " << deathWeight << std::endl;
-    std::cerr << "rightWeight: " << rightWeight << std::endl;
-    std::cerr << "forwardWeight: " << forwardWeight << std::endl;
-    std::cerr << "backWeight: " << backWeight << std::endl;
-    std::cerr << "leftWeight: " << leftWeight << std::endl;
-    exit(1);
+    s.mapped = meshes[m].mapVertices();
+  }
+  pool->parallelFor(skinChunks.size(), [this](const int i) {
+    const MeshSkin &s = skins[skinChunks[i].mesh];
+    const int begin = skinChunks[i].firstVertex;
+    s.bindPose.skin(s.palette.data(), bounds, begin,
+                    std::min(begin + skinChunkSize, s.bindPose.size()), s.mapped);
+  });
+  for (int m = 0; m < skins.size(); ++m) {
+    meshes[m].unmapVertices();
+    skins[m].mapped = nullptr;
+  }
+  if (isMeasuredFrame) {
+    logTimeSince("  meshes skinned: ", start);
   }
+}
 
-  processAnim(deathWeight, 234.0f, 293.0f, 0.0f, &deathTime);
-  processAnim(idleWeight, 55.0f, 130.0f, 0.0f);
-  const float movementAnimDur = 20.0f;
-  processAnim(forwardWeight, 134.0f, 134.0f + movementAnimDur, 0.0f);
-  processAnim(rightWeight, 184.0f, 184.0f + movementAnimDur, 10.0f);
-  processAnim(backWeight, 159.0f, 159.0f + movementAnimDur, 10.0f);
-  processAnim(leftWeight, 209.0f, 209.0f + movementAnimDur, 0.0f);
+unsigned int PlayerModel::GetNodeVAO() const { return nodeVAO; }
 
-  if (isMeasuredFrame) {
-    logTimeSince("  anims processed: ", start);
+void PlayerModel::buildJoints(aiNode *node, const int parent) {
+  const aiAnimation *const anim = scene->mAnimations[0];
+  Joint joint;
+  joint.node = node;
+  joint.parent = parent;
+  joint.channel = -1;
+  for (int c = 0; c < anim->mNumChannels; ++c) {
+    if (anim->mChannels[c]->mNodeName == node->mName) {
+      joint.channel = c;
+      break;
+    }
+  }
+  const int index = joints.size();
+  joints.push_back(joint);
+  jointIndex.emplace(nameOf(node->mName), index);
+  for (int i = 0; i < node->mNumChildren; ++i) {
+    buildJoints(node->mChildren[i], index);
   }
+}
 
-  gunTransform = glm::mat4(0.0f);
-  const aiMatrix4x4& gunAiMat = mergedNodeTransformMap["Gun"];
-  for (int i = 0; i < 4; ++i) {
-    for (int j = 0; j < 4; ++j) {
-      gunTransform[j][i] = gunAiMat[i][j];
+void PlayerModel::samplePose(const float ticks, Pose *out,
+                             CompressedAnimation::Cursor *cursor) const {
+  for (int j = 0; j < joints.size(); ++j) {
+    if (joints[j].channel < 0) {
+      continue;
     }
+    float t[3], r[4], s[3];
+    compressed.sample(joints[j].channel, ticks, cursor, t, r, s);
+    out->set(j, t[0], t[1], t[2], r[0], r[1], r[2], r[3], s[0], s[1], s[2]);
   }
+}
 
-  int meshesProcessed = 0;
-  processNode(&meshesProcessed, isMeasuredFrame, scene->mRootNode, scene, 0, mergedNodeTransformMap);
-  if (isMeasuredFrame) {
-    logTimeSince("  nodes processed: ", start);
+void PlayerModel::sampleOriginalPose(const float ticks, Pose *out) const {
+  const aiAnimation *const anim = scene->mAnimations[0];
+  const aiVector3D one(1.0f, 1.0f, 1.0f);
+  for (int j = 0; j < joints.size(); ++j) {
+    if (joints[j].channel < 0) {
+      continue;
+    }
+    const aiNodeAnim *const a = anim->mChannels[joints[j].channel];
+    const aiVector3D t = sampleVectorKeys(a->mPositionKeys, a->mNumPositionKeys, ticks, aiVector3D());
+    const aiQuaternion r = sampleQuatKeys(a->mRotationKeys, a->mNumRotationKeys, ticks);
+    const aiVector3D s = sampleVectorKeys(a->mScalingKeys, a->mNumScalingKeys, ticks, one);
+    out->set(j, t.x, t.y, t.z, r.x, r.y, r.z, r.w, s.x, s.y, s.z);
   }
 }
 
-unsigned int PlayerModel::GetNodeVAO() const { return nodeVAO; }
+void PlayerModel::reportCompression() const {
+  const aiAnimation *const anim = scene->mAnimations[0];
+  // Dropped keys are where the error peaks.
+  std::vector<double> keyTimes;
+  for (int c = 0; c < anim->mNumChannels; ++c) {
+    const aiNodeAnim *const a = anim->mChannels[c];
+    for (int k = 0; k < a->mNumPositionKeys; ++k) {
+      keyTimes.push_back(a->mPositionKeys[k].mTime);
+    }
+    for (int k = 0; k < a->mNumRotationKeys; ++k) {
+      keyTimes.push_back(a->mRotationKeys[k].mTime);
+    }
+    for (int k = 0; k < a->mNumScalingKeys; ++k) {
+      keyTimes.push_back(a->mScalingKeys[k].mTime);
+    }
+  }
+  std::sort(keyTimes.begin(), keyTimes.end());
+  keyTimes.erase(std::unique(keyTimes.begin(), keyTimes.end()), keyTimes.end());
 
-void PlayerModel::processNode(int* meshesProcessed, const bool isMeasuredFrame,
-    aiNode *node, const aiScene *scene, int depth,
-    std::unordered_map<std::string, aiMatrix4x4> &transformMap) {
-  for (unsigned int i = 0; i < node->mNumMeshes; i++) {
-    const auto start = std::chrono::high_resolution_clock::now();
-    aiMesh *mesh = scene->mMeshes[node->mMeshes[i]];
-    if (meshes.size() > *meshesProcessed) {
-      meshes[*meshesProcessed].updateVertices(getMeshVertices(isMeasuredFrame, mesh, scene, transformMap));
-    } else {
-      meshes.push_back(std::move(processMesh(isMeasuredFrame, mesh, scene, transformMap)));
+  Pose original, decoded;
+  original.resize(joints.size());
+  decoded.resize(joints.size());
+  std::vector<aiMatrix4x4> originalGlobals(joints.size());
+  std::vector<aiMatrix4x4> decodedGlobals(joints.size());
+  float maxDistance = 0.0f;
+  float maxAngle = 0.0f;
+  for (const double ticks : keyTimes) {
+    sampleOriginalPose(ticks, &original);
+    samplePose(ticks, &decoded);
+    computeGlobals(&original, originalGlobals.data());
+    computeGlobals(&decoded, decodedGlobals.data());
+    for (int j = 0; j < joints.size(); ++j) {
+      const aiMatrix4x4 &o = originalGlobals[j];
+      const aiMatrix4x4 &d = decodedGlobals[j];
+      maxDistance = std::max(maxDistance, (aiVector3D(o.a4, o.b4, o.c4) - aiVector3D(d.a4, d.b4, d.c4)).Length());
+      if (joints[j].channel >= 0) {
+        float dot = 0.0f;
+        for (int c = Pose::QX; c <= Pose::QW; ++c) {
+          dot += original.channel((Pose::Channel)c)[j] * decoded.channel((Pose::Channel)c)[j];
+        }
+        maxAngle = std::max(maxAngle, 2.0f * acosf(std::min(1.0f, std::abs(dot))));
+      }
+    }
+  }
+  std::cout << "Animation keys: " << compressed.originalKeys() << " in "
+            << compressed.originalBytes() / 1024 << "KB compressed to " << compressed.keptKeys()
+            << " in " << compressed.compressedBytes() / 1024 << "KB, max joint error "
+            << maxDistance << " units, " << maxAngle * 180.0f / 3.14159265f << " degrees local"
+            << std::endl;
+}
+
+void PlayerModel::computeGlobals(const Pose *pose, aiMatrix4x4 *globals) const {
+  const float *c[Pose::NUM_CHANNELS];
+  if (pose) {
+    for (int i = 0; i < Pose::NUM_CHANNELS; ++i) {
+      c[i] = pose->channel((Pose::Channel)i);
     }
-    (*meshesProcessed)++;
-    if (isMeasuredFrame) {
-      logTimeSince("    mesh processed in: ", start);
+  }
+  for (int j = 0; j < joints.size(); ++j) {
+    const Joint &joint = joints[j];
+    aiMatrix4x4 local = joint.node->mTransformation;
+    if (pose && joint.channel >= 0) {
+      local = aiMatrix4x4(aiVector3D(c[Pose::SX][j], c[Pose::SY][j], c[Pose::SZ][j]),
+                          aiQuaternion(c[Pose::QW][j], c[Pose::QX][j], c[Pose::QY][j], c[Pose::QZ][j]),
+                          aiVector3D(c[Pose::TX][j], c[Pose::TY][j], c[Pose::TZ][j]));
     }
+    globals[j] = joint.parent < 0 ? local : globals[joint.parent] * local;
+  }
+}
+
+int PlayerModel::jointIndexOf(const std::string_view nodeName) const {
+  const auto found = jointIndex.find(nodeName);
+  return found == jointIndex.end() ? -1 : found->second;
+}
+
+const aiMatrix4x4 &PlayerModel::globalTransform(const std::vector<aiMatrix4x4> &globals,
+                                                const std::string_view nodeName) const {
+  static const aiMatrix4x4 identity;
+  const int joint = jointIndexOf(nodeName);
+  return joint < 0 ? identity : globals[joint];
+}
+
+void PlayerModel::addPendingMeshes(aiNode *node, const std::vector<aiMatrix4x4> &globals) {
+  for (unsigned int i = 0; i < node->mNumMeshes; i++) {
+    pendingMeshes.push_back(processMesh(scene->mMeshes[node->mMeshes[i]], globals));
   }
   for (unsigned int i = 0; i < node->mNumChildren; i++) {
-    aiNode* childNode = node->mChildren[i];
-    processNode(meshesProcessed, isMeasuredFrame, childNode, scene, depth + 1, transformMap);
+    addPendingMeshes(node->mChildren[i], globals);
   }
 }
 
-PlayerMesh PlayerModel::processMesh(const bool isMeasuredFrame,
-    aiMesh *mesh, const aiScene *scene,
-    std::unordered_map<std::string, aiMatrix4x4> &nodeTransformMap) {
-  const auto start = std::chrono::high_resolution_clock::now();
-  const std::vector<Vertex> vertices = getMeshVertices(isMeasuredFrame,
-      mesh, scene, nodeTransformMap);
-  std::vector<unsigned int> indices;
+PlayerModel::PendingMesh PlayerModel::processMesh(aiMesh *mesh,
+    const std::vector<aiMatrix4x4> &globals) {
+  PendingMesh result;
+  std::vector<Vertex> &vertices = result.vertices;
+  std::vector<unsigned int> &indices = result.indices;
+  const ArenaVector<Vertex> bindPose = getMeshVertices(mesh, scene, globals);
+  vertices.assign(bindPose.begin(), bindPose.end());
 
   // process indices
   indices.reserve(mesh->mNumFaces * 3);
@@ -269,75 +349,99 @@ PlayerMesh PlayerModel::processMesh(const bool isMeasuredFrame,
       indices.push_back(vertexIndex);
     }
   }
-  if (isMeasuredFrame) {
-    logTimeSince("      indices processed: ", start);
+  // Not welded: vertices with equal bind poses can still have different bone
+  // weights.
+  std::cout << "Player mesh " << skins.size() << ":" << std::endl;
+  const std::vector<unsigned int> newToOld = optimizeMeshOrder(&indices, vertices.size());
+  vertices = remapVertices(vertices, newToOld);
+  skins.push_back(buildSkin(mesh, newToOld));
+  return result;
+}
+
+PlayerModel::MeshSkin PlayerModel::buildSkin(aiMesh *mesh,
+                                             const std::vector<unsigned int> &newToOld) const {
+  MeshSkin skin;
+  skin.bindPose = SkinnedMesh(newToOld.size());
+  std::vector<int> oldToNew(mesh->mNumVertices, -1);
+  for (int v = 0; v < newToOld.size(); ++v) {
+    const unsigned int old = newToOld[v];
+    oldToNew[old] = v;
+    const glm::vec2 uv = mesh->mTextureCoords[0]
+        ? glm::vec2(mesh->mTextureCoords[0][old].x, mesh->mTextureCoords[0][old].y)
+        : glm::vec2(0.0f);
+    skin.bindPose.setVertex(
+        v, glm::vec3(mesh->mVertices[old].x, mesh->mVertices[old].y, mesh->mVertices[old].z),
+        glm::vec3(mesh->mNormals[old].x, mesh->mNormals[old].y, mesh->mNormals[old].z), uv);
   }
-  // Player textures handled externally
-  std::vector<Texture> textures;
-  return std::move(PlayerMesh(std::move(vertices), std::move(indices), std::move(textures)));
+  skin.rigid = mesh->mNumBones == 0;
+  if (skin.rigid) {
+    ArenaVector<aiNode *> meshNodes;
+    appendMeshNodes(mesh, scene, scene->mRootNode, &meshNodes);
+    for (aiNode *node : meshNodes) {
+      skin.boneJoints.push_back(jointIndexOf(nameOf(node->mName)));
+    }
+    for (int v = 0; v < newToOld.size(); ++v) {
+      skin.bindPose.addInfluence(v, 0, 1.0f);
+    }
+    skin.palette.resize(1);
+    return skin;
+  }
+  for (int b = 0; b < mesh->mNumBones; ++b) {
+    const aiBone *bone = mesh->mBones[b];
+    const int joint = jointIndexOf(nameOf(bone->mName));
+    if (joint < 0) {
+      std::cerr << "Bone " << bone->mName.C_Str() << " isn't a node" << std::endl;
+      exit(1);
+    }
+    skin.boneJoints.push_back(joint);
+    skin.boneOffsets.push_back(bone->mOffsetMatrix);
+    for (int w = 0; w < bone->mNumWeights; ++w) {
+      const int v = oldToNew[bone->mWeights[w].mVertexId];
+      if (v >= 0) {
+        skin.bindPose.addInfluence(v, b, bone->mWeights[w].mWeight);
+      }
+    }
+  }
+  skin.bindPose.normalizeWeights();
+  skin.palette.resize(mesh->mNumBones);
+  return skin;
 }
 
-std::vector<Vertex> PlayerModel::getMeshVertices(const bool isMeasuredFrame,
-    aiMesh *mesh, const aiScene *scene,
-    std::unordered_map<std::string, aiMatrix4x4> &nodeTransformMap) {
-  const auto start = std::chrono::high_resolution_clock::now();
-  std::vector<Vertex> vertices;
+ArenaVector<Vertex> PlayerModel::getMeshVertices(aiMesh *mesh, const aiScene *scene,
+                                                 const std::vector<aiMatrix4x4> &globals) {
+  ArenaVector<Vertex> vertices;
   vertices.reserve(mesh->mNumVertices);
 
-  const aiAnimation *const anim = scene->mAnimations[0];
-  const float targetAnimTicks = 2.0f * anim->mTicksPerSecond;
-
-  std::vector<aiMatrix4x4> boneAnimTransform(mesh->mNumVertices, zeroAiMat());
+  ArenaVector<aiMatrix4x4> boneAnimTransform(mesh->mNumVertices, zeroAiMat());
   for (int boneIndex = 0; boneIndex < mesh->mNumBones; boneIndex++) {
     aiBone *bone = mesh->mBones[boneIndex];
-    const std::string boneName = bone->mName.C_Str();
-    const aiMatrix4x4 nodeTransform = globalInv * nodeTransformMap[boneName] * bone->mOffsetMatrix;
+    const aiMatrix4x4 nodeTransform = globalInv * globalTransform(globals, nameOf(bone->mName)) * bone->mOffsetMatrix;
     for (int weightIndex = 0; weightIndex < bone->mNumWeights; weightIndex++) {
       aiVertexWeight w = bone->mWeights[weightIndex];
       scaledAdd(boneAnimTransform[w.mVertexId], w.mWeight, nodeTransform);
     }
   }
-  if (isMeasuredFrame) {
-    logTimeSince("      bones processed: ", start);
-  }
   aiMatrix4x4 nodeAnimTransform;
   if (mesh->mNumBones == 0) {
-    std::vector<aiNode *> meshNodes;
-    std::function<void(aiNode *)> r;
-    r = [mesh, scene, &meshNodes, &r](aiNode *n) {
-      for (int xx = 0; xx < n->mNumMeshes; xx++) {
-        aiMesh *tmpMesh = scene->mMeshes[n->mMeshes[xx]];
-        if (tmpMesh == mesh) {
-          meshNodes.push_back(n);
-        }
-      }
-      for (int xx = 0; xx < n->mNumChildren; xx++) {
-        r(n->mChildren[xx]);
-      }
-    };
-    r(scene->mRootNode);
+    ArenaVector<aiNode *> meshNodes;
+    appendMeshNodes(mesh, scene, scene->mRootNode, &meshNodes);
     for (auto *meshNode : meshNodes) {
-      nodeAnimTransform *= nodeTransformMap[std::string(meshNode->mName.data)];
+      nodeAnimTransform *= globalTransform(globals, nameOf(meshNode->mName));
     }
   }
-  if (isMeasuredFrame) {
-    logTimeSince("      boneless nodes processed: ", start);
-  }
   for (unsigned int i = 0; i < mesh->mNumVertices; i++) {
+    const aiMatrix4x4 &transform = mesh->mNumBones > 0 ? boneAnimTransform[i] : nodeAnimTransform;
     Vertex vertex;
     { // Position
-      aiVector3D v =
-        (mesh->mNumBones > 0 ? boneAnimTransform[i] : nodeAnimTransform)
-            * mesh->mVertices[i];
+      aiVector3D v = transform * mesh->mVertices[i];
       vertex.position.x = v.x;
       vertex.position.y = v.y;
       vertex.position.z = v.z;
     }
     { // Normal
-      // TODO apply animation
-      vertex.normal.x = mesh->mNormals[i].x;
-      vertex.normal.y = mesh->mNormals[i].y;
-      vertex.normal.z = mesh->mNormals[i].z;
+      const aiVector3D n = aiMatrix3x3(transform) * mesh->mNormals[i];
+      const glm::vec3 normal(n.x, n.y, n.z);
+      vertex.normal = glm::length(normal) > 0.0f ? glm::normalize(normal) : normal;
     }
     if (mesh->mTextureCoords[0]) {
       glm::vec2 vec;
@@ -349,8 +453,5 @@ std::vector<Vertex> PlayerModel::getMeshVertices(const bool isMeasuredFrame,
     }
     vertices.push_back(vertex);
   }
-  if (isMeasuredFrame) {
-    logTimeSince("      vertices processed: ", start);
-  }
   return vertices;
 }
@@ -1,37 +1,70 @@
 #ifndef ANG__SD_MODEL_H_
 #define ANG__SD_MODEL_H_
 
+#include <string_view>
 #include <unordered_map>
 #include <vector>
 
+#include "angrygl/compressed_animation.h"
 #include "angrygl/player_mesh.h"
+#include "angrygl/pose.h"
+#include "angrygl/skinning.h"
 #include "assimp/Importer.hpp"
 #include "assimp/postprocess.h"
 #include "assimp/scene.h"
 #include "assimp/vector3.h"
+#include "lib/ThreadPool.h"
+#include "lib/frame_arena.h"
+#include "opengl/packed_vertex.h"
 #include "opengl/shader.h"
 #include "opengl/vertex.h"
 #include <assimp/scene.h>
 
+// An animated model's shared data: the scene, its skeleton and clips, and the
+// meshes. Per-character state lives in AnimationInstance, which only reads
+// the model, so instances can share it and be posed concurrently.
 class PlayerModel {
 public:
   /*  Functions   */
   PlayerModel(char *path) { loadModel(path); }
 
-  void Draw(Shader shader, bool applyTextures = true) const;
+  // For split loading: importScene() off the GL thread, then
+  // initGlResources() on it.
+  PlayerModel() {}
+  // Reads the file with assimp and builds the meshes' bind pose vertices.
+  // Makes no GL calls.
+  void importScene(std::string path);
+  void initGlResources();
+
+  // Textures are left to the caller, see MaterialLibrary.
+  void Draw(Shader shader) const;
   unsigned int GetNodeVAO() const;
-  void setPlayerDead(float time);
-  void UpdatePointsForAnim(
-      bool isMeasuredFrame,
-      const glm::vec2 movementDir,
-      const float aimTheta,
-      float time);
-  glm::mat4 getAnimatedGunTransform() const;
+  // Decode box for every mesh's packed positions.
+  const PositionBounds &positionBounds() const { return bounds; }
+
+  const aiAnimation *animation() const { return scene->mAnimations[0]; }
+  const CompressedAnimation &compressedAnimation() const { return compressed; }
+  int numJoints() const { return joints.size(); }
+  // -1 for names that aren't nodes.
+  int jointIndexOf(std::string_view nodeName) const;
+  // Writes the joints the animation moves at ticks, leaving the rest.
+  // Samples the compressed keys, through cursor if given.
+  void samplePose(float ticks, Pose *out, CompressedAnimation::Cursor *cursor = nullptr) const;
+  // One global transform per joint from a blended pose, or the bind pose if
+  // pose is null.
+  void computeGlobals(const Pose *pose, aiMatrix4x4 *globals) const;
+  // Re-skins the meshes to a set of global transforms, such as an
+  // AnimationInstance's, on the pool and straight into the vertex buffers.
+  // Call on the GL thread.
+  void skin(ThreadPool *pool, const std::vector<aiMatrix4x4> &globals, bool isMeasuredFrame);
 
   std::vector<PlayerMesh> meshes;
 private:
-  float deathTime = -1.0f;
-  glm::mat4 gunTransform;
+  struct PendingMesh {
+    std::vector<Vertex> vertices;
+    std::vector<unsigned int> indices;
+  };
+
   unsigned int nodeVAO;
   unsigned int nodeVBO;
   int numNodes;
@@ -40,15 +73,57 @@ private:
   aiMatrix4x4 globalInv;
   /*  Model Data  */
   std::string directory;
+  // Sized for any pose, see PositionBounds::expandForAnimation().
+  PositionBounds bounds;
+  std::vector<PendingMesh> pendingMeshes;
+  // Per mesh, in GL vertex order.
+  struct MeshSkin {
+    SkinnedMesh bindPose;
+    // Palette entry i follows joint boneJoints[i] after boneOffsets[i]. Meshes
+    // without bones have a single entry, the product of boneJoints.
+    bool rigid;
+    std::vector<int> boneJoints;
+    std::vector<aiMatrix4x4> boneOffsets;
+    std::vector<BoneMatrix> palette;
+    PackedVertex *mapped = nullptr;
+  };
+  std::vector<MeshSkin> skins;
+  // Vertices per skinning task, which skin() spreads over the pool.
+  static const int skinChunkSize = 1024;
+  struct SkinChunk {
+    int mesh;
+    int firstVertex;
+  };
+  std::vector<SkinChunk> skinChunks;
+  // The node hierarchy flattened parents first, so one pass over it builds
+  // every global transform.
+  struct Joint {
+    aiNode *node;
+    int parent;
+    // The animation channel moving the node, or -1 to keep its own transform.
+    int channel;
+  };
+  std::vector<Joint> joints;
+  CompressedAnimation compressed;
+  // Keys point into the scene's node names.
+  std::unordered_map<std::string_view, int> jointIndex;
   /*  Functions   */
   void loadModel(std::string path);
-  void processNode(int* meshesProcessed, bool isMeasuredFrame, aiNode *node, const aiScene *scene, int depth,
-                  std::unordered_map<std::string, aiMatrix4x4> &);
-  PlayerMesh processMesh(bool isMeasuredFrame, aiMesh *mesh, const aiScene *scene,
-                         std::unordered_map<std::string, aiMatrix4x4> &);
-  std::vector<Vertex> getMeshVertices(const bool isMeasuredFrame,
-      aiMesh *mesh, const aiScene *scene,
-      std::unordered_map<std::string, aiMatrix4x4> &nodeTransformMap);
+  void buildJoints(aiNode *node, int parent);
+  // From the original keys, to measure the compression error against.
+  void sampleOriginalPose(float ticks, Pose *out) const;
+  // Prints the memory compression saved and the largest joint error it
+  // causes at any original key time.
+  void reportCompression() const;
+  // Identity for names that aren't nodes.
+  const aiMatrix4x4 &globalTransform(const std::vector<aiMatrix4x4> &globals,
+                                     std::string_view nodeName) const;
+  void addPendingMeshes(aiNode *node, const std::vector<aiMatrix4x4> &globals);
+  PendingMesh processMesh(aiMesh *mesh, const std::vector<aiMatrix4x4> &globals);
+  // Posed by globals, in assimp order.
+  ArenaVector<Vertex> getMeshVertices(aiMesh *mesh, const aiScene *scene,
+                                      const std::vector<aiMatrix4x4> &globals);
+  MeshSkin buildSkin(aiMesh *mesh, const std::vector<unsigned int> &newToOld) const;
 };
 
 inline void scaledAdd(aiMatrix4x4& m1, const float scale, const aiMatrix4x4& m2)
@@ -1,6 +1,6 @@
 #version 330 core
 layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNorm;
+layout (location = 1) in vec2 inNorm;
 layout (location = 2) in vec2 inTexCoord;
 
 out vec2 TexCoord;
@@ -14,10 +14,29 @@ uniform mat4 PV;
 uniform mat4 aimRot;
 uniform mat4 lightSpaceMatrix;
 
+// Written just before the frame's passes run. aimCorrection turns the player
+// from the simulated aim to the latest cursor position, in model space.
+layout (std140) uniform LateLatched {
+  mat4 aimCorrection;
+};
+
+// Packed vertices, see opengl/packed_vertex.h.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodeNormal(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
 void main() {
-  gl_Position = PV * model * vec4(inPos, 1.0);
+  vec3 pos = vec3(aimCorrection * vec4(positionOffset + positionScale * inPos, 1.0));
+  gl_Position = PV * model * vec4(pos, 1.0);
   TexCoord = inTexCoord;
-  Norm = vec3(aimRot * vec4(inNorm, 1.0));
-  FragWorldPos = vec3(model * vec4(inPos, 1.0));
+  Norm = vec3(aimRot * aimCorrection * vec4(decodeNormal(inNorm), 1.0));
+  FragWorldPos = vec3(model * vec4(pos, 1.0));
   FragPosLightSpace = lightSpaceMatrix * vec4(FragWorldPos, 1.0);
 }
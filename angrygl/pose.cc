@@ -0,0 +1,101 @@
+#include "angrygl/pose.h"
+
+#include <algorithm>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SD_POSE_SSE 1
+#endif
+
+void Pose::resize(const int joints) {
+  numJoints = joints;
+  stride = (joints + 3) & ~3;
+  data.assign(NUM_CHANNELS * stride, 0.0f);
+}
+
+void Pose::set(const int joint, const float tx, const float ty, const float tz, const float qx,
+               const float qy, const float qz, const float qw, const float sx, const float sy,
+               const float sz) {
+  const float values[NUM_CHANNELS] = {tx, ty, tz, qx, qy, qz, qw, sx, sy, sz};
+  for (int c = 0; c < NUM_CHANNELS; ++c) {
+    data[c * stride + joint] = values[c];
+  }
+}
+
+void Pose::clear() { std::fill(data.begin(), data.end(), 0.0f); }
+
+void accumulatePose(const Pose &in, const float weight, Pose *out) {
+  const float *src[Pose::NUM_CHANNELS];
+  float *dst[Pose::NUM_CHANNELS];
+  for (int c = 0; c < Pose::NUM_CHANNELS; ++c) {
+    src[c] = in.channel((Pose::Channel)c);
+    dst[c] = out->channel((Pose::Channel)c);
+  }
+  const int n = in.size();
+#ifdef SD_POSE_SSE
+  const __m128 w = _mm_set1_ps(weight);
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+  for (int j = 0; j < n; j += 4) {
+    __m128 dot = _mm_setzero_ps();
+    for (int c = Pose::QX; c <= Pose::QW; ++c) {
+      dot = _mm_add_ps(dot, _mm_mul_ps(_mm_loadu_ps(src[c] + j), _mm_loadu_ps(dst[c] + j)));
+    }
+    // Negative weight for rotations facing away from the running sum.
+    const __m128 qw = _mm_xor_ps(w, _mm_and_ps(_mm_cmplt_ps(dot, _mm_setzero_ps()), signBit));
+    for (int c = 0; c < Pose::NUM_CHANNELS; ++c) {
+      const bool isRotation = c >= Pose::QX && c <= Pose::QW;
+      const __m128 sum = _mm_add_ps(_mm_loadu_ps(dst[c] + j),
+                                    _mm_mul_ps(isRotation ? qw : w, _mm_loadu_ps(src[c] + j)));
+      _mm_storeu_ps(dst[c] + j, sum);
+    }
+  }
+#else
+  for (int j = 0; j < n; ++j) {
+    float dot = 0.0f;
+    for (int c = Pose::QX; c <= Pose::QW; ++c) {
+      dot += src[c][j] * dst[c][j];
+    }
+    const float qw = dot < 0.0f ? -weight : weight;
+    for (int c = 0; c < Pose::NUM_CHANNELS; ++c) {
+      const bool isRotation = c >= Pose::QX && c <= Pose::QW;
+      dst[c][j] += (isRotation ? qw : weight) * src[c][j];
+    }
+  }
+#endif
+}
+
+void normalizePose(Pose *pose) {
+  float *const x = pose->channel(Pose::QX);
+  float *const y = pose->channel(Pose::QY);
+  float *const z = pose->channel(Pose::QZ);
+  float *const w = pose->channel(Pose::QW);
+  const int n = pose->size();
+#ifdef SD_POSE_SSE
+  // Keeps all-zero padding lanes finite.
+  const __m128 tiny = _mm_set1_ps(1e-20f);
+  for (int j = 0; j < n; j += 4) {
+    const __m128 qx = _mm_loadu_ps(x + j);
+    const __m128 qy = _mm_loadu_ps(y + j);
+    const __m128 qz = _mm_loadu_ps(z + j);
+    const __m128 qw = _mm_loadu_ps(w + j);
+    const __m128 lengthSq = _mm_add_ps(_mm_add_ps(_mm_mul_ps(qx, qx), _mm_mul_ps(qy, qy)),
+                                       _mm_add_ps(_mm_mul_ps(qz, qz), _mm_mul_ps(qw, qw)));
+    const __m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), _mm_sqrt_ps(_mm_max_ps(lengthSq, tiny)));
+    _mm_storeu_ps(x + j, _mm_mul_ps(qx, inv));
+    _mm_storeu_ps(y + j, _mm_mul_ps(qy, inv));
+    _mm_storeu_ps(z + j, _mm_mul_ps(qz, inv));
+    _mm_storeu_ps(w + j, _mm_mul_ps(qw, inv));
+  }
+#else
+  for (int j = 0; j < n; ++j) {
+    const float length = std::sqrt(x[j] * x[j] + y[j] * y[j] + z[j] * z[j] + w[j] * w[j]);
+    if (length > 0.0f) {
+      x[j] /= length;
+      y[j] /= length;
+      z[j] /= length;
+      w[j] /= length;
+    }
+  }
+#endif
+}
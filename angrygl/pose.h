@@ -0,0 +1,36 @@
+#ifndef _SD_ANG_POSE_H_
+#define _SD_ANG_POSE_H_
+
+#include <vector>
+
+// Local-space translation, rotation and scale for a set of joints, stored as
+// one array per component so blends work on four joints at a time.
+class Pose {
+public:
+  enum Channel { TX, TY, TZ, QX, QY, QZ, QW, SX, SY, SZ, NUM_CHANNELS };
+
+  void resize(int numJoints);
+  int size() const { return numJoints; }
+  // Padded to a multiple of four; the padding is never read back.
+  float *channel(Channel c) { return &data[c * stride]; }
+  const float *channel(Channel c) const { return &data[c * stride]; }
+
+  void set(int joint, float tx, float ty, float tz, float qx, float qy, float qz, float qw,
+           float sx, float sy, float sz);
+  // Zeroes every channel, ready to accumulate into.
+  void clear();
+
+private:
+  int numJoints = 0;
+  int stride = 0;
+  std::vector<float> data;
+};
+
+// out += weight * in. Each quaternion is flipped first if it's in the other
+// hemisphere from out's, so the sum takes the short way round.
+void accumulatePose(const Pose &in, float weight, Pose *out);
+// Normalises the rotations, finishing an nlerp of the accumulated poses.
+// Weights are expected to sum to one.
+void normalizePose(Pose *pose);
+
+#endif // _SD_ANG_POSE_H_
@@ -1,9 +1,11 @@
 #version 330 core
-out vec4 FragColor;
+layout (location = 0) out vec4 FragColor;
+layout (location = 1) out vec4 EmissionColor;
 
 uniform vec3 color;
 
 void main() {
   FragColor = vec4(color, 1.0);
+  EmissionColor = vec4(0.0);
 }
 
@@ -0,0 +1,180 @@
+#include "angrygl/skinning.h"
+
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define SD_SKINNING_SSE 1
+#endif
+
+SkinnedMesh::SkinnedMesh(const int numVertices) : numVertices(numVertices) {
+  const int padded = (numVertices + 3) & ~3;
+  for (std::vector<float> *axis : {&px, &py, &pz, &nx, &ny, &nz}) {
+    axis->assign(padded, 0.0f);
+  }
+  bones.assign(padded * maxInfluences, 0);
+  weights.assign(padded * maxInfluences, 0.0f);
+  texCoords.assign(2 * numVertices, 0);
+}
+
+void SkinnedMesh::setVertex(const int v, const glm::vec3 &position, const glm::vec3 &normal,
+                            const glm::vec2 &uv) {
+  px[v] = position.x;
+  py[v] = position.y;
+  pz[v] = position.z;
+  nx[v] = normal.x;
+  ny[v] = normal.y;
+  nz[v] = normal.z;
+  packTexCoords(uv, &texCoords[2 * v]);
+}
+
+void SkinnedMesh::addInfluence(const int v, const int bone, const float weight) {
+  float *const w = &weights[v * maxInfluences];
+  const int weakest = std::min_element(w, w + maxInfluences) - w;
+  if (weight > w[weakest]) {
+    w[weakest] = weight;
+    bones[v * maxInfluences + weakest] = bone;
+  }
+}
+
+void SkinnedMesh::normalizeWeights() {
+  for (int v = 0; v < numVertices; ++v) {
+    float *const w = &weights[v * maxInfluences];
+    float sum = 0.0f;
+    for (int k = 0; k < maxInfluences; ++k) {
+      sum += w[k];
+    }
+    if (sum > 0.0f) {
+      for (int k = 0; k < maxInfluences; ++k) {
+        w[k] /= sum;
+      }
+    }
+  }
+}
+
+void SkinnedMesh::skin(const BoneMatrix *palette, const PositionBounds &bounds, const int begin,
+                       const int end, PackedVertex *out) const {
+#ifdef SD_SKINNING_SSE
+  // Quantisation as in packPosition() and packNormal(), but 4 lanes at a
+  // time. Ties round to even rather than away from zero.
+  __m128 boundsMin[3];
+  __m128 toUnorm[3];
+  for (int axis = 0; axis < 3; ++axis) {
+    const float scale = bounds.max[axis] - bounds.min[axis];
+    boundsMin[axis] = _mm_set1_ps(bounds.min[axis]);
+    toUnorm[axis] = _mm_set1_ps(scale > 0.0f ? 65535.0f / scale : 0.0f);
+  }
+  const __m128 zero = _mm_setzero_ps();
+  const __m128 one = _mm_set1_ps(1.0f);
+  const __m128 signBit = _mm_set1_ps(-0.0f);
+#endif
+  for (int v = begin; v < end; v += 4) {
+    // The group's packed positions and normals, per component then lane.
+    int position[3][4];
+    int normal[2][4];
+#ifdef SD_SKINNING_SSE
+    // Each lane's blended matrix, as rows.
+    __m128 m[4][3];
+    for (int lane = 0; lane < 4; ++lane) {
+      const unsigned short *const b = &bones[(v + lane) * maxInfluences];
+      const float *const w = &weights[(v + lane) * maxInfluences];
+      __m128 r0 = _mm_setzero_ps();
+      __m128 r1 = _mm_setzero_ps();
+      __m128 r2 = _mm_setzero_ps();
+      for (int k = 0; k < maxInfluences; ++k) {
+        const __m128 weight = _mm_set1_ps(w[k]);
+        const BoneMatrix &bone = palette[b[k]];
+        r0 = _mm_add_ps(r0, _mm_mul_ps(weight, _mm_loadu_ps(bone.rows[0])));
+        r1 = _mm_add_ps(r1, _mm_mul_ps(weight, _mm_loadu_ps(bone.rows[1])));
+        r2 = _mm_add_ps(r2, _mm_mul_ps(weight, _mm_loadu_ps(bone.rows[2])));
+      }
+      m[lane][0] = r0;
+      m[lane][1] = r1;
+      m[lane][2] = r2;
+    }
+    const __m128 x = _mm_loadu_ps(&px[v]);
+    const __m128 y = _mm_loadu_ps(&py[v]);
+    const __m128 z = _mm_loadu_ps(&pz[v]);
+    const __m128 normalX = _mm_loadu_ps(&nx[v]);
+    const __m128 normalY = _mm_loadu_ps(&ny[v]);
+    const __m128 normalZ = _mm_loadu_ps(&nz[v]);
+    __m128 n[3];
+    for (int r = 0; r < 3; ++r) {
+      // Turns row r of the 4 matrices into its 4 columns across lanes.
+      __m128 c0 = m[0][r], c1 = m[1][r], c2 = m[2][r], c3 = m[3][r];
+      _MM_TRANSPOSE4_PS(c0, c1, c2, c3);
+      const __m128 p = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(c0, x), _mm_mul_ps(c1, y)),
+          _mm_add_ps(_mm_mul_ps(c2, z), c3));
+      n[r] = _mm_add_ps(
+          _mm_add_ps(_mm_mul_ps(c0, normalX), _mm_mul_ps(c1, normalY)),
+          _mm_mul_ps(c2, normalZ));
+      const __m128 q = _mm_mul_ps(_mm_sub_ps(p, boundsMin[r]), toUnorm[r]);
+      _mm_storeu_si128((__m128i *)position[r],
+                       _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(q, zero), _mm_set1_ps(65535.0f))));
+    }
+    // Octahedral encoding, see packNormal().
+    const __m128 absX = _mm_andnot_ps(signBit, n[0]);
+    const __m128 absY = _mm_andnot_ps(signBit, n[1]);
+    const __m128 absZ = _mm_andnot_ps(signBit, n[2]);
+    const __m128 l1 = _mm_add_ps(_mm_add_ps(absX, absY), absZ);
+    const __m128 nonZero = _mm_cmpgt_ps(l1, zero);
+    const __m128 invL1 = _mm_and_ps(nonZero, _mm_div_ps(one, _mm_or_ps(l1, _mm_andnot_ps(nonZero, one))));
+    const __m128 ox = _mm_mul_ps(n[0], invL1);
+    const __m128 oy = _mm_mul_ps(n[1], invL1);
+    const __m128 signX = _mm_or_ps(one, _mm_andnot_ps(_mm_cmpge_ps(ox, zero), signBit));
+    const __m128 signY = _mm_or_ps(one, _mm_andnot_ps(_mm_cmpge_ps(oy, zero), signBit));
+    const __m128 foldX = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, oy)), signX);
+    const __m128 foldY = _mm_mul_ps(_mm_sub_ps(one, _mm_andnot_ps(signBit, ox)), signY);
+    const __m128 lower = _mm_cmplt_ps(n[2], zero);
+    const __m128 snorm = _mm_set1_ps(32767.0f);
+    const __m128 ex = _mm_or_ps(_mm_and_ps(lower, foldX), _mm_andnot_ps(lower, ox));
+    const __m128 ey = _mm_or_ps(_mm_and_ps(lower, foldY), _mm_andnot_ps(lower, oy));
+    _mm_storeu_si128((__m128i *)normal[0], _mm_cvtps_epi32(_mm_mul_ps(ex, snorm)));
+    _mm_storeu_si128((__m128i *)normal[1], _mm_cvtps_epi32(_mm_mul_ps(ey, snorm)));
+#else
+    for (int lane = 0; lane < 4; ++lane) {
+      const int i = v + lane;
+      float m[3][4] = {};
+      for (int k = 0; k < maxInfluences; ++k) {
+        const float w = weights[i * maxInfluences + k];
+        const BoneMatrix &bone = palette[bones[i * maxInfluences + k]];
+        for (int r = 0; r < 3; ++r) {
+          for (int c = 0; c < 4; ++c) {
+            m[r][c] += w * bone.rows[r][c];
+          }
+        }
+      }
+      glm::vec3 p, n;
+      for (int r = 0; r < 3; ++r) {
+        p[r] = m[r][0] * px[i] + m[r][1] * py[i] + m[r][2] * pz[i] + m[r][3];
+        n[r] = m[r][0] * nx[i] + m[r][1] * ny[i] + m[r][2] * nz[i];
+      }
+      unsigned short packedPosition[4];
+      short packedNormal[2];
+      packPosition(p, bounds, packedPosition);
+      packNormal(n, packedNormal);
+      for (int r = 0; r < 3; ++r) {
+        position[r][lane] = packedPosition[r];
+      }
+      normal[0][lane] = packedNormal[0];
+      normal[1][lane] = packedNormal[1];
+    }
+#endif
+    const int count = std::min(4, end - v);
+    for (int lane = 0; lane < count; ++lane) {
+      // Built whole before the store, since out is normally write-combined
+      // mapped memory.
+      PackedVertex p;
+      p.position[0] = position[0][lane];
+      p.position[1] = position[1][lane];
+      p.position[2] = position[2][lane];
+      p.position[3] = 0;
+      p.normal[0] = normal[0][lane];
+      p.normal[1] = normal[1][lane];
+      p.texCoords[0] = texCoords[2 * (v + lane)];
+      p.texCoords[1] = texCoords[2 * (v + lane) + 1];
+      out[v + lane] = p;
+    }
+  }
+}
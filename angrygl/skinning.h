@@ -0,0 +1,51 @@
+#ifndef _SD_ANG_SKINNING_H_
+#define _SD_ANG_SKINNING_H_
+
+#include <vector>
+
+#include "opengl/packed_vertex.h"
+#include <glm/glm.hpp>
+
+// An affine bone transform, the top three rows of a 4x4 matrix.
+struct BoneMatrix {
+  float rows[3][4];
+};
+
+// A mesh's bind pose laid out for skinning on the CPU. Positions and normals
+// are stored as separate arrays per axis, padded to a multiple of 4 vertices
+// so the kernel only ever works on whole groups of 4.
+class SkinnedMesh {
+public:
+  static const int maxInfluences = 4;
+
+  SkinnedMesh() {}
+  explicit SkinnedMesh(int numVertices);
+
+  int size() const { return numVertices; }
+  void setVertex(int v, const glm::vec3 &position, const glm::vec3 &normal,
+                 const glm::vec2 &texCoords);
+  // Past maxInfluences the weakest influence is dropped.
+  void addInfluence(int v, int bone, float weight);
+  // Rescales every vertex's weights to sum to 1, making up for dropped
+  // influences. Vertices without any are left collapsed to the origin.
+  void normalizeWeights();
+
+  // Skins vertices [begin, end) by the palette, which must have an entry for
+  // every bone used, and packs them into out[begin, end). begin must be a
+  // multiple of 4. Only reads the mesh, so disjoint ranges can be skinned
+  // from different threads.
+  void skin(const BoneMatrix *palette, const PositionBounds &bounds, int begin, int end,
+            PackedVertex *out) const;
+
+private:
+  int numVertices = 0;
+  std::vector<float> px, py, pz;
+  std::vector<float> nx, ny, nz;
+  // maxInfluences per vertex. Unused slots are bone 0 with weight 0.
+  std::vector<unsigned short> bones;
+  std::vector<float> weights;
+  // Already packed, since skinning doesn't change them.
+  std::vector<unsigned short> texCoords;
+};
+
+#endif // _SD_ANG_SKINNING_H_
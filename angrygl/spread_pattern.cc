@@ -0,0 +1,84 @@
+#include "angrygl/spread_pattern.h"
+
+#include <cmath>
+
+namespace {
+
+const glm::vec3 canonicalDir(0.0f, 0.0f, 1.0f);
+
+} // namespace
+
+// static
+SpreadPattern SpreadPattern::create(const int spreadAmount, const float rotPerBullet) {
+  SpreadPattern p;
+  p.numBullets = spreadAmount * spreadAmount;
+  p.dirX.resize(p.numBullets);
+  p.dirY.resize(p.numBullets);
+  p.dirZ.resize(p.numBullets);
+  p.quatW.resize(p.numBullets);
+  p.quatX.resize(p.numBullets);
+  p.quatY.resize(p.numBullets);
+  p.quatZ.resize(p.numBullets);
+
+  const glm::quat identity(1.0f, 0.0f, 0.0f, 0.0f);
+  for (int i = 0; i < spreadAmount; ++i) {
+    const glm::quat yQuat = glm::rotate(
+        identity,
+        rotPerBullet * (i - spreadAmount / 2),
+        glm::vec3(0.0f, 1.0f, 0.0f));
+    for (int j = 0; j < spreadAmount; ++j) {
+      const glm::quat rotQuat = glm::rotate(
+          yQuat,
+          rotPerBullet * (j - spreadAmount / 2),
+          glm::vec3(1.0f, 0.0f, 0.0f));
+      const glm::vec3 dir = rotQuat * canonicalDir;
+      const int idx = i * spreadAmount + j;
+      p.dirX[idx] = dir.x;
+      p.dirY[idx] = dir.y;
+      p.dirZ[idx] = dir.z;
+      p.quatW[idx] = rotQuat.w;
+      p.quatX[idx] = rotQuat.x;
+      p.quatY[idx] = rotQuat.y;
+      p.quatZ[idx] = rotQuat.z;
+    }
+  }
+  return p;
+}
+
+void SpreadPattern::applyYaw(const float yaw, glm::vec3* const dirsOut, glm::quat* const quatsOut) const {
+  // Yaw as a quaternion is (c, 0, s, 0), so yawQuat * q expands to the
+  // products below. Directions just get the equivalent 2D rotation in xz.
+  const float c = cos(yaw * 0.5f);
+  const float s = sin(yaw * 0.5f);
+  const float cosYaw = cos(yaw);
+  const float sinYaw = sin(yaw);
+  const float* const dx = dirX.data();
+  const float* const dy = dirY.data();
+  const float* const dz = dirZ.data();
+  for (int i = 0; i < numBullets; ++i) {
+    dirsOut[i] = glm::vec3(
+        dx[i] * cosYaw + dz[i] * sinYaw,
+        dy[i],
+        dz[i] * cosYaw - dx[i] * sinYaw);
+  }
+  const float* const qw = quatW.data();
+  const float* const qx = quatX.data();
+  const float* const qy = quatY.data();
+  const float* const qz = quatZ.data();
+  for (int i = 0; i < numBullets; ++i) {
+    quatsOut[i] = glm::quat(
+        c * qw[i] - s * qy[i],
+        c * qx[i] + s * qz[i],
+        c * qy[i] + s * qw[i],
+        c * qz[i] - s * qx[i]);
+  }
+}
+
+const SpreadPattern& SpreadPatternCache::get(const int spreadAmount, const float rotPerBullet) {
+  const std::pair<int, float> key(spreadAmount, rotPerBullet);
+  auto it = patterns.find(key);
+  if (it == patterns.end()) {
+    it = patterns.emplace(key, SpreadPattern::create(spreadAmount, rotPerBullet)).first;
+  }
+  return it->second;
+}
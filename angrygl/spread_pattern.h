@@ -0,0 +1,41 @@
+#ifndef _SD_ANG_SPREAD_PATTERN_H_
+#define _SD_ANG_SPREAD_PATTERN_H_
+
+#include <map>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "glm/gtc/quaternion.hpp"
+
+// Directions and orientations of a square bullet spread, relative to a volley
+// fired straight down +z. Kept as SoA so that yawing the whole pattern is a
+// flat loop the compiler can vectorise.
+struct SpreadPattern {
+  int numBullets = 0;
+
+  std::vector<float> dirX;
+  std::vector<float> dirY;
+  std::vector<float> dirZ;
+
+  std::vector<float> quatW;
+  std::vector<float> quatX;
+  std::vector<float> quatY;
+  std::vector<float> quatZ;
+
+  static SpreadPattern create(int spreadAmount, float rotPerBullet);
+
+  // Rotates the pattern by yaw (radians, about +y) and writes it to numBullets
+  // consecutive entries of dirsOut and quatsOut.
+  void applyYaw(float yaw, glm::vec3* dirsOut, glm::quat* quatsOut) const;
+};
+
+class SpreadPatternCache {
+ public:
+  const SpreadPattern& get(int spreadAmount, float rotPerBullet);
+
+ private:
+  std::map<std::pair<int, float>, SpreadPattern> patterns;
+};
+
+#endif  // _SD_ANG_SPREAD_PATTERN_H_
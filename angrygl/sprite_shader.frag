@@ -1,7 +1,10 @@
 #version 330 core
 in vec2 TexCoord;
 
-out vec4 FragColor;
+// Weighted blended OIT, see the transparency pass in main.cc.
+layout (location = 0) out vec4 AccumColor;
+layout (location = 1) out vec4 Revealage;
+layout (location = 2) out vec4 EmissionColor;
 
 uniform sampler2D spritesheet;
 
@@ -9,10 +12,20 @@ uniform int numCols;
 uniform float timePerSprite;
 uniform float age;
 
+// McGuire and Bavoil's depth weight, equation 10. Nearer fragments win.
+float oitWeight(float alpha) {
+  float d = 1.0 - gl_FragCoord.z;
+  return clamp(alpha * max(1e-2, 3e3 * d * d * d), 1e-2, 3e3);
+}
+
 void main() {
   // Doing this for every fragment is pretty wasteful...
   int col = int(age / timePerSprite);
   vec2 spriteTexCoord = vec2(TexCoord.x / numCols + col * (1.0 / numCols), TexCoord.y);
   // TODO interpolation
-  FragColor = texture(spritesheet, spriteTexCoord);
+  vec4 color = texture(spritesheet, spriteTexCoord);
+  float w = oitWeight(color.a);
+  AccumColor = vec4(color.rgb * color.a * w, color.a);
+  Revealage = vec4(color.a * w, 0.0, 0.0, color.a);
+  EmissionColor = vec4(0.0);
 }
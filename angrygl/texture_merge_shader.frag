@@ -6,7 +6,13 @@ out vec4 FragColor;
 uniform sampler2D base_texture;
 uniform sampler2D emission_texture;
 uniform sampler2D bright_texture;
+// Weighted blended transparency, see the transparency pass in main.cc.
+uniform sampler2D accum_texture;
+uniform sampler2D revealage_texture;
 uniform bool lagSystemOut;
+// The inputs are drawn at a reduced render scale into the corner of their
+// textures; bilinear filtering upscales them to the screen.
+uniform float uvScale;
 
 float CalcBrightness(vec3 col) {
   return (col.x + col.y + col.z) / (3 );
@@ -16,9 +22,22 @@ vec4 ScaleColor(float scale, vec4 color) {
   return vec4(min(1.0, scale * color.r), min(1.0, scale * color.g), min(1.0, scale * color.b), color.a);
 }
 
+// Keeps bilinear taps at the top and right edges from blending in stale
+// texels beyond the scaled image.
+vec4 SampleScaled(sampler2D tex, vec2 uv) {
+  return texture(tex, min(uv, uvScale - 0.5 / vec2(textureSize(tex, 0))));
+}
+
 void main() {
-  FragColor = vec4(texture(base_texture, TexCoord).rgb + texture(emission_texture, TexCoord).rgb * 2.9, 1.0);
-  vec3 rawBright = texture(bright_texture, TexCoord).rgb;
+  vec2 uv = TexCoord * uvScale;
+  vec3 base = SampleScaled(base_texture, uv).rgb;
+  vec4 revealage = SampleScaled(revealage_texture, uv);
+  if (revealage.a < 1.0) {
+    vec3 transparent = SampleScaled(accum_texture, uv).rgb / max(revealage.r, 1e-5);
+    base = mix(transparent, base, revealage.a);
+  }
+  FragColor = vec4(base + SampleScaled(emission_texture, uv).rgb * 2.9, 1.0);
+  vec3 rawBright = SampleScaled(bright_texture, uv).rgb;
   if (CalcBrightness(rawBright) > 0.05) {
     float mult = 1.5;
     float additive = CalcBrightness(rawBright) > 0.3 ? 1.8 : 0.4;
@@ -1,11 +1,12 @@
 #version 330 core
 layout (location = 0) in vec3 inPos;
-layout (location = 1) in vec3 inNorm;
+layout (location = 1) in vec2 inNorm;
 layout (location = 2) in vec2 inTexCoord;
 
 out vec2 TexCoord;
 out vec3 Norm;
 out vec4 FragPosLightSpace;
+out vec3 FragWorldPos;
 
 // Transformation matrices
 uniform mat4 model;
@@ -13,6 +14,18 @@ uniform mat4 PV;
 uniform mat4 aimRot;
 uniform mat4 lightSpaceMatrix;
 
+// Packed vertices, see opengl/packed_vertex.h.
+uniform vec3 positionOffset;
+uniform vec3 positionScale;
+
+vec3 decodeNormal(vec2 e) {
+  vec3 n = vec3(e, 1.0 - abs(e.x) - abs(e.y));
+  float t = max(-n.z, 0.0);
+  n.x += n.x >= 0.0 ? -t : t;
+  n.y += n.y >= 0.0 ? -t : t;
+  return normalize(n);
+}
+
 uniform vec3 nosePos;
 uniform float time;
 
@@ -21,11 +34,13 @@ const float wiggleDistModifier = 0.12;
 const float wiggleTimeModifier = 9.4;
 
 void main() {
-  float xOffset = sin(wiggleTimeModifier * time + wiggleDistModifier * distance(nosePos, inPos)) * wiggleMagnitude;
-  gl_Position = PV * model * vec4(inPos.x + xOffset, inPos.y, inPos.z, 1.0);
+  vec3 pos = positionOffset + positionScale * inPos;
+  float xOffset = sin(wiggleTimeModifier * time + wiggleDistModifier * distance(nosePos, pos)) * wiggleMagnitude;
+  FragWorldPos = vec3(model * vec4(pos.x + xOffset, pos.y, pos.z, 1.0));
+  gl_Position = PV * vec4(FragWorldPos, 1.0);
   TexCoord = inTexCoord;
-  FragPosLightSpace = lightSpaceMatrix * model * vec4(inPos, 1.0);
+  FragPosLightSpace = lightSpaceMatrix * model * vec4(pos, 1.0);
   // TODO fix norm for wiggle
-  Norm = vec3(aimRot * vec4(inNorm, 1.0));
+  Norm = vec3(aimRot * vec4(decodeNormal(inNorm), 1.0));
 }
 
@@ -3,6 +3,7 @@
 
 // https://github.com/progschj/ThreadPool
 
+#include <atomic>
 #include <vector>
 #include <queue>
 #include <memory>
@@ -13,15 +14,35 @@
 #include <functional>
 #include <stdexcept>
 
+#include "lib/alloc_tracker.h"
+
 class ThreadPool {
 public:
     ThreadPool(size_t);
     template<class F, class... Args>
     auto enqueue(F&& f, Args&&... args) 
         -> std::future<typename std::result_of<F(Args...)>::type>;
+    // Runs f(i) for every i in [0, count) on the workers and the calling
+    // thread, returning once all are done. Unlike enqueue() this doesn't
+    // allocate, so it suits per-frame work.
+    template<class F>
+    void parallelFor(int count, F&& f);
     size_t numWorkers() const;
     ~ThreadPool();
 private:
+    // A parallelFor() in progress, owned by its caller.
+    struct Batch {
+        void (*run)(void*, int);
+        void* f;
+        int count;
+        std::atomic<int> next;
+        int workersInside;
+        // The caller's allocation zone, which the workers adopt.
+        int zone;
+    };
+    static void runBatch(Batch* b);
+    bool batchHasWork() const { return batch && batch->next < batch->count; }
+
     // need to keep track of threads so we can join them
     std::vector< std::thread > workers;
     // the task queue
@@ -31,6 +52,8 @@ private:
     std::mutex queue_mutex;
     std::condition_variable condition;
     bool stop;
+    Batch* batch = nullptr;
+    std::condition_variable batchDone;
 };
 
 inline size_t ThreadPool::numWorkers() const {
@@ -52,7 +75,18 @@ inline ThreadPool::ThreadPool(size_t threads)
                     {
                         std::unique_lock<std::mutex> lock(this->queue_mutex);
                         this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
+                            [this]{ return this->stop || this->batchHasWork() || !this->tasks.empty(); });
+                        if(this->batchHasWork())
+                        {
+                            Batch* b = this->batch;
+                            b->workersInside++;
+                            lock.unlock();
+                            runBatch(b);
+                            lock.lock();
+                            if(--b->workersInside == 0)
+                                this->batchDone.notify_all();
+                            continue;
+                        }
                         if(this->stop && this->tasks.empty())
                             return;
                         task = std::move(this->tasks.front());
@@ -90,6 +124,42 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     return res;
 }
 
+inline void ThreadPool::runBatch(Batch* b)
+{
+    allocs::AdoptZone zone(b->zone);
+    for(int i = b->next++; i < b->count; i = b->next++)
+        b->run(b->f, i);
+}
+
+template<class F>
+void ThreadPool::parallelFor(int count, F&& f)
+{
+    using Fn = typename std::remove_reference<F>::type;
+    Batch b;
+    b.run = [](void* f, int i) { (*static_cast<Fn*>(f))(i); };
+    b.f = const_cast<void*>(static_cast<const void*>(std::addressof(f)));
+    b.count = count;
+    b.next = 0;
+    b.workersInside = 0;
+    b.zone = allocs::currentZoneId();
+    {
+        std::unique_lock<std::mutex> lock(queue_mutex);
+        // Only one batch at a time; a nested or concurrent call runs inline.
+        if(batch)
+        {
+            lock.unlock();
+            runBatch(&b);
+            return;
+        }
+        batch = &b;
+    }
+    condition.notify_all();
+    runBatch(&b);
+    std::unique_lock<std::mutex> lock(queue_mutex);
+    batch = nullptr;
+    batchDone.wait(lock, [&b]{ return b.workersInside == 0; });
+}
+
 // the destructor joins all threads
 inline ThreadPool::~ThreadPool()
 {
@@ -0,0 +1,81 @@
+// Replacement global allocation functions that report to allocs::record().
+// Linked in by --define alloc_hooks=1, see lib/BUILD.
+
+#include <cstdlib>
+#include <new>
+
+#include "lib/alloc_tracker.h"
+
+namespace {
+
+struct MarkHooked {
+  MarkHooked() { allocs::setHooked(); }
+} markHooked;
+
+void *allocate(std::size_t size) {
+  allocs::record(size);
+  void *p = std::malloc(size == 0 ? 1 : size);
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void *allocateAligned(std::size_t size, std::align_val_t alignment) {
+  allocs::record(size);
+  const std::size_t a = static_cast<std::size_t>(alignment);
+#ifdef _WIN32
+  void *p = _aligned_malloc(size == 0 ? 1 : size, a);
+#else
+  // aligned_alloc wants a multiple of the alignment.
+  void *p = std::aligned_alloc(a, ((size == 0 ? 1 : size) + a - 1) / a * a);
+#endif
+  if (p == nullptr) {
+    throw std::bad_alloc();
+  }
+  return p;
+}
+
+void freeAligned(void *p) {
+#ifdef _WIN32
+  _aligned_free(p);
+#else
+  std::free(p);
+#endif
+}
+
+} // namespace
+
+void *operator new(std::size_t size) { return allocate(size); }
+void *operator new[](std::size_t size) { return allocate(size); }
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void *operator new[](std::size_t size, const std::nothrow_t &) noexcept {
+  try {
+    return allocate(size);
+  } catch (const std::bad_alloc &) {
+    return nullptr;
+  }
+}
+void *operator new(std::size_t size, std::align_val_t alignment) {
+  return allocateAligned(size, alignment);
+}
+void *operator new[](std::size_t size, std::align_val_t alignment) {
+  return allocateAligned(size, alignment);
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete[](void *p) noexcept { std::free(p); }
+void operator delete(void *p, std::size_t) noexcept { std::free(p); }
+void operator delete[](void *p, std::size_t) noexcept { std::free(p); }
+void operator delete(void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete[](void *p, const std::nothrow_t &) noexcept { std::free(p); }
+void operator delete(void *p, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete[](void *p, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete(void *p, std::size_t, std::align_val_t) noexcept { freeAligned(p); }
+void operator delete[](void *p, std::size_t, std::align_val_t) noexcept { freeAligned(p); }
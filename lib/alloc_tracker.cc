@@ -0,0 +1,208 @@
+#include "lib/alloc_tracker.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <iostream>
+#include <mutex>
+
+#if defined(__GLIBC__)
+#include <execinfo.h>
+#include <unistd.h>
+#define SD_HAVE_BACKTRACE 1
+#endif
+
+namespace allocs {
+namespace {
+
+// Fixed tables so that recording never allocates.
+const int maxThreads = 64;
+const int maxZones = 32;
+const int maxStackDepth = 32;
+
+struct Slot {
+  std::atomic<long long> allocations{0};
+  std::atomic<long long> bytes{0};
+  std::atomic<const char *> name{nullptr};
+};
+
+Slot threads[maxThreads];
+std::atomic<int> numThreads(0);
+// Threads past the table share the last slot.
+thread_local int threadSlot = -1;
+
+Slot zones[maxZones];
+std::atomic<int> numZones(0);
+std::mutex zoneMutex;
+thread_local int currentZone = -1;
+
+std::atomic<bool> isHooked(false);
+std::atomic<long long> totalAllocations(0);
+std::atomic<long long> totalBytes(0);
+long long frameAllocations = 0;
+long long frameBytes = 0;
+
+std::atomic<bool> armed(false);
+std::atomic<bool> violated(false);
+struct Violation {
+  const char *zone;
+  size_t bytes;
+  int threadSlot;
+  void *stack[maxStackDepth];
+  int stackDepth;
+} violation;
+// Set while capturing a stack, which may itself allocate.
+thread_local bool capturing = false;
+
+Slot &threadStats() {
+  if (threadSlot < 0) {
+    threadSlot = std::min(numThreads.fetch_add(1), maxThreads - 1);
+  }
+  return threads[threadSlot];
+}
+
+int findZone(const char *name) {
+  const int n = numZones.load();
+  for (int i = 0; i < n; ++i) {
+    if (strcmp(zones[i].name.load(), name) == 0) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void print(const char *label, const Counts &c) {
+  std::cout << "  " << label << ": " << c.allocations << " allocations, " << c.bytes
+            << " bytes" << std::endl;
+}
+
+Counts read(const Slot &s) {
+  Counts c;
+  c.allocations = s.allocations.load(std::memory_order_relaxed);
+  c.bytes = s.bytes.load(std::memory_order_relaxed);
+  return c;
+}
+
+} // namespace
+
+bool hooked() { return isHooked; }
+
+void setHooked() { isHooked = true; }
+
+Zone::Zone(const char *name) : previous(currentZone) {
+  int id = findZone(name);
+  if (id < 0) {
+    std::lock_guard<std::mutex> lock(zoneMutex);
+    id = findZone(name);
+    if (id < 0 && numZones < maxZones) {
+      id = numZones;
+      zones[id].name = name;
+      numZones++;
+    }
+  }
+  currentZone = id;
+}
+
+Zone::~Zone() { currentZone = previous; }
+
+int currentZoneId() { return currentZone; }
+
+AdoptZone::AdoptZone(const int id) : previous(currentZone) { currentZone = id; }
+
+AdoptZone::~AdoptZone() { currentZone = previous; }
+
+void nameThread(const char *name) { threadStats().name = name; }
+
+void record(const size_t bytes) {
+  totalAllocations.fetch_add(1, std::memory_order_relaxed);
+  totalBytes.fetch_add(bytes, std::memory_order_relaxed);
+  Slot &t = threadStats();
+  t.allocations.fetch_add(1, std::memory_order_relaxed);
+  t.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  if (currentZone < 0) {
+    return;
+  }
+  Slot &z = zones[currentZone];
+  z.allocations.fetch_add(1, std::memory_order_relaxed);
+  z.bytes.fetch_add(bytes, std::memory_order_relaxed);
+  if (armed && !capturing && !violated.exchange(true)) {
+    violation.zone = z.name;
+    violation.bytes = bytes;
+    violation.threadSlot = threadSlot;
+    violation.stackDepth = 0;
+#ifdef SD_HAVE_BACKTRACE
+    capturing = true;
+    violation.stackDepth = backtrace(violation.stack, maxStackDepth);
+    capturing = false;
+#endif
+  }
+}
+
+Counts total() {
+  Counts c;
+  c.allocations = totalAllocations;
+  c.bytes = totalBytes;
+  return c;
+}
+
+Counts zone(const char *name) {
+  const int id = findZone(name);
+  return id < 0 ? Counts() : read(zones[id]);
+}
+
+Counts sinceLastFrame() {
+  const Counts now = total();
+  Counts c;
+  c.allocations = now.allocations - frameAllocations;
+  c.bytes = now.bytes - frameBytes;
+  frameAllocations = now.allocations;
+  frameBytes = now.bytes;
+  return c;
+}
+
+void armZoneCheck() {
+#ifdef SD_HAVE_BACKTRACE
+  // The first backtrace() loads the unwinder, which allocates.
+  void *warmup[1];
+  backtrace(warmup, 1);
+#endif
+  armed = true;
+}
+
+bool checkFailed() {
+  if (!violated) {
+    return false;
+  }
+  armed = false;
+  const char *thread = threads[violation.threadSlot].name;
+  std::cerr << "Allocation of " << violation.bytes << " bytes in zone " << violation.zone
+            << " on thread " << (thread ? thread : "") << "#" << violation.threadSlot
+            << " after warm up" << std::endl;
+#ifdef SD_HAVE_BACKTRACE
+  std::cerr << "Call stack (addr2line -Cfe <binary> resolves the addresses):" << std::endl;
+  // Skips record().
+  const int skip = std::min(1, violation.stackDepth);
+  backtrace_symbols_fd(violation.stack + skip, violation.stackDepth - skip, STDERR_FILENO);
+#else
+  std::cerr << "No call stack on this platform" << std::endl;
+#endif
+  return true;
+}
+
+void dump() {
+  std::cout << "Heap allocations:" << std::endl;
+  print("total", total());
+  const int n = std::min(numThreads.load(), maxThreads);
+  for (int i = 0; i < n; ++i) {
+    const char *name = threads[i].name;
+    const Counts c = read(threads[i]);
+    std::cout << "  thread " << (name ? name : "") << "#" << i << ": " << c.allocations
+              << " allocations, " << c.bytes << " bytes" << std::endl;
+  }
+  const int z = numZones;
+  for (int i = 0; i < z; ++i) {
+    print(zones[i].name, read(zones[i]));
+  }
+}
+
+} // namespace allocs
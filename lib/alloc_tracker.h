@@ -0,0 +1,77 @@
+#ifndef SD_ALLOC_TRACKER_H_
+#define SD_ALLOC_TRACKER_H_
+
+#include <cstddef>
+
+// Counts heap allocations per thread and per zone. The counting happens in
+// replacement global operator new/delete, which are only linked in with
+// --define alloc_hooks=1; without them everything here reads zero.
+//
+// A zone is a named scope on one thread. Other threads working on its behalf
+// count against it only if they adopt it, as ThreadPool::parallelFor() workers
+// do.
+namespace allocs {
+
+struct Counts {
+  long long allocations = 0;
+  long long bytes = 0;
+};
+
+// Whether the hooks are linked in.
+bool hooked();
+
+// Attributes the calling thread's allocations to name while in scope. Zones
+// nest, the innermost wins. Names must be string literals.
+class Zone {
+public:
+  explicit Zone(const char *name);
+  ~Zone();
+  Zone(const Zone &) = delete;
+  Zone &operator=(const Zone &) = delete;
+
+private:
+  int previous;
+};
+
+// The calling thread's innermost zone, -1 outside any, for handing to an
+// AdoptZone on another thread.
+int currentZoneId();
+
+// Attributes the calling thread's allocations to a zone another thread got
+// from currentZoneId() while in scope. Doesn't allocate.
+class AdoptZone {
+public:
+  explicit AdoptZone(int id);
+  ~AdoptZone();
+  AdoptZone(const AdoptZone &) = delete;
+  AdoptZone &operator=(const AdoptZone &) = delete;
+
+private:
+  int previous;
+};
+
+// Labels the calling thread in dump().
+void nameThread(const char *name);
+
+Counts total();
+Counts zone(const char *name);
+// Everything allocated since the previous call, from every thread.
+Counts sinceLastFrame();
+
+// From now on the first allocation made inside any zone is recorded, with its
+// call stack, and checkFailed() reports it.
+void armZoneCheck();
+// Prints the offending allocation, if there was one, and returns whether
+// there was.
+bool checkFailed();
+
+// Per thread and per zone totals.
+void dump();
+
+// Called by the hooks for every allocation. Must not allocate.
+void record(size_t bytes);
+void setHooked();
+
+} // namespace allocs
+
+#endif // SD_ALLOC_TRACKER_H_
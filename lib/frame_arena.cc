@@ -0,0 +1,61 @@
+#include "lib/frame_arena.h"
+
+#include <algorithm>
+#include <atomic>
+
+namespace {
+
+std::atomic<unsigned int> currentFrame(0);
+
+} // namespace
+
+FrameArena &FrameArena::get() {
+  static thread_local FrameArena arena;
+  return arena;
+}
+
+void FrameArena::nextFrame() { currentFrame.fetch_add(1, std::memory_order_relaxed); }
+
+FrameArena::~FrameArena() {
+  for (char *b : spilled) {
+    delete[] b;
+  }
+  delete[] block;
+}
+
+void FrameArena::rewind() {
+  for (char *b : spilled) {
+    delete[] b;
+  }
+  spilled.clear();
+  spilledBytes = 0;
+  top = 0;
+  frame = currentFrame.load(std::memory_order_relaxed);
+}
+
+void *FrameArena::allocate(const size_t bytes, const size_t alignment) {
+  if (frame != currentFrame.load(std::memory_order_relaxed)) {
+    rewind();
+  }
+  size_t start = (top + alignment - 1) & ~(alignment - 1);
+  if (block == nullptr || start + bytes > blockSize) {
+    // new[] memory is aligned for any fundamental type.
+    const size_t size = std::max({initialBlockSize, 2 * blockSize, bytes});
+    if (block != nullptr) {
+      spilled.push_back(block);
+      spilledBytes += top;
+    }
+    block = new char[size];
+    blockSize = size;
+    start = 0;
+  }
+  top = start + bytes;
+  return block + start;
+}
+
+void FrameArena::deallocate(void *p, const size_t bytes) {
+  char *const c = static_cast<char *>(p);
+  if (block != nullptr && c >= block && c + bytes == block + top) {
+    top = c - block;
+  }
+}
@@ -0,0 +1,78 @@
+#ifndef SD_FRAME_ARENA_H_
+#define SD_FRAME_ARENA_H_
+
+#include <cstddef>
+#include <vector>
+
+// Bump allocator for data that lives no longer than a frame. Each thread has
+// its own; nextFrame() rewinds them all, each on its next allocation.
+//
+// Memory comes from one block per thread. A frame that outgrows it spills
+// into a bigger one, and the smaller blocks are freed at the rewind, so
+// after a few frames the block covers the peak and the arena stops touching
+// the heap.
+class FrameArena {
+public:
+  // The calling thread's arena.
+  static FrameArena &get();
+  // Frees everything allocated so far, from every thread's arena. Nothing
+  // allocated before the call may be used after it.
+  static void nextFrame();
+
+  FrameArena() {}
+  ~FrameArena();
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+  void *allocate(size_t bytes, size_t alignment);
+  // Only gives memory back if p was the latest allocation, so a vector
+  // growing at the top reuses its old space.
+  void deallocate(void *p, size_t bytes);
+
+  // Bytes handed out this frame, and the size of the current block.
+  size_t used() const { return spilledBytes + top; }
+  size_t capacity() const { return blockSize; }
+
+private:
+  static const size_t initialBlockSize = 256 * 1024;
+
+  void rewind();
+
+  char *block = nullptr;
+  size_t blockSize = 0;
+  size_t top = 0;
+  // Blocks outgrown this frame, freed at the next rewind.
+  std::vector<char *> spilled;
+  size_t spilledBytes = 0;
+  unsigned int frame = 0;
+};
+
+// Stateless, allocates from the arena of whichever thread asks. Containers
+// using it must not outlive the frame.
+template <class T>
+struct ArenaAllocator {
+  using value_type = T;
+
+  ArenaAllocator() {}
+  template <class U>
+  ArenaAllocator(const ArenaAllocator<U> &) {}
+
+  T *allocate(size_t n) {
+    return static_cast<T *>(FrameArena::get().allocate(n * sizeof(T), alignof(T)));
+  }
+  void deallocate(T *p, size_t n) { FrameArena::get().deallocate(p, n * sizeof(T)); }
+};
+
+template <class T, class U>
+bool operator==(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+  return true;
+}
+template <class T, class U>
+bool operator!=(const ArenaAllocator<T> &, const ArenaAllocator<U> &) {
+  return false;
+}
+
+template <class T>
+using ArenaVector = std::vector<T, ArenaAllocator<T>>;
+
+#endif // SD_FRAME_ARENA_H_
@@ -0,0 +1,63 @@
+#include "opengl/dynamic_resolution.h"
+
+#include <algorithm>
+#include <cmath>
+
+float DynamicResolution::update(const float fixedMs, const float scaledMs,
+                                const float measuredScale) {
+  const float fullScaleMs = scaledMs / (measuredScale * measuredScale);
+  if (!haveSamples) {
+    fixedAvg = fixedMs;
+    fullScaleAvg = fullScaleMs;
+    haveSamples = true;
+  } else {
+    fixedAvg += settings.smoothing * (fixedMs - fixedAvg);
+    fullScaleAvg += settings.smoothing * (fullScaleMs - fullScaleAvg);
+  }
+  if (!dynamic) {
+    return current;
+  }
+
+  const float predicted = fixedAvg + fullScaleAvg * current * current;
+  float next = current;
+  if (predicted > settings.targetMs) {
+    next = std::max(scaleFor(settings.settle * settings.targetMs), current - settings.maxStep);
+    framesUnder = 0;
+  } else if (predicted < settings.lowWater * settings.targetMs) {
+    if (++framesUnder >= settings.framesBeforeRaise) {
+      next = std::min(scaleFor(settings.settle * settings.targetMs), current + settings.maxStep);
+      framesUnder = 0;
+    }
+  } else {
+    framesUnder = 0;
+  }
+  current = std::min(std::max(next, settings.minScale), settings.maxScale);
+  return current;
+}
+
+float DynamicResolution::scaleFor(const float ms) const {
+  const float budget = ms - fixedAvg;
+  if (budget <= 0.0f) {
+    return settings.minScale;
+  }
+  if (fullScaleAvg <= 0.0f) {
+    return settings.maxScale;
+  }
+  return sqrtf(budget / fullScaleAvg);
+}
+
+void DynamicResolution::setTargetMs(const float ms) {
+  settings.targetMs = std::max(ms, 1.0f);
+  framesUnder = 0;
+}
+
+void DynamicResolution::setFixedScale(const float scale) {
+  // Not limited to minScale, so lower scales can be tried by hand.
+  current = std::min(std::max(scale, 0.1f), 1.0f);
+  dynamic = false;
+}
+
+void DynamicResolution::setDynamic() {
+  dynamic = true;
+  framesUnder = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SD_DYNAMIC_RESOLUTION_H_
+#define SD_DYNAMIC_RESOLUTION_H_
+
+// Picks a render scale that keeps GPU frame time near a target. Frame cost is
+// modelled as fixed + perPixel * scale^2, fitted from measured timings.
+//
+// There are two thresholds so the scale doesn't flip-flop: it drops as soon as
+// the predicted time goes over the target, but only rises once the frame has
+// stayed under lowWater * target for a while. Either way it moves to where
+// the model predicts settle * target.
+class DynamicResolution {
+public:
+  struct Settings {
+    float targetMs = 1000.0f / 60.0f;
+    float minScale = 0.5f;
+    float maxScale = 1.0f;
+    float lowWater = 0.8f;
+    float settle = 0.9f;
+    int framesBeforeRaise = 30;
+    // Largest change per update.
+    float maxStep = 0.1f;
+    // Weight of the newest sample in the running averages.
+    float smoothing = 0.1f;
+  };
+
+  explicit DynamicResolution(const Settings &settings) : settings(settings) {}
+
+  // Feeds one frame's GPU timings, taken at measuredScale, and returns the
+  // scale to render at next.
+  float update(float fixedMs, float scaledMs, float measuredScale);
+
+  float scale() const { return current; }
+  float targetMs() const { return settings.targetMs; }
+  void setTargetMs(float ms);
+  // Pins the scale; setDynamic() hands control back to the timings.
+  void setFixedScale(float scale);
+  void setDynamic();
+  bool isDynamic() const { return dynamic; }
+
+private:
+  float scaleFor(float ms) const;
+
+  Settings settings;
+  float current = 1.0f;
+  bool dynamic = true;
+  bool haveSamples = false;
+  float fixedAvg = 0.0f;
+  // Scaled pass time at scale 1.
+  float fullScaleAvg = 0.0f;
+  int framesUnder = 0;
+};
+
+#endif // SD_DYNAMIC_RESOLUTION_H_
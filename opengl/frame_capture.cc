@@ -0,0 +1,196 @@
+#include "opengl/frame_capture.h"
+
+#include <algorithm>
+#include <cstdio>
+#include <iostream>
+#include <vector>
+
+#include "opengl/gl_state.h"
+#include "opengl/resource_registry.h"
+
+namespace {
+
+unsigned int crc32(const unsigned char *data, size_t length, unsigned int crc = 0) {
+  static unsigned int table[256];
+  static bool tableBuilt = false;
+  if (!tableBuilt) {
+    for (unsigned int n = 0; n < 256; ++n) {
+      unsigned int c = n;
+      for (int k = 0; k < 8; ++k) {
+        c = c & 1 ? 0xedb88320u ^ (c >> 1) : c >> 1;
+      }
+      table[n] = c;
+    }
+    tableBuilt = true;
+  }
+  crc = ~crc;
+  for (size_t i = 0; i < length; ++i) {
+    crc = table[(crc ^ data[i]) & 0xff] ^ (crc >> 8);
+  }
+  return ~crc;
+}
+
+void appendBigEndian(std::vector<unsigned char> *out, unsigned int v) {
+  out->push_back(v >> 24);
+  out->push_back(v >> 16);
+  out->push_back(v >> 8);
+  out->push_back(v);
+}
+
+void appendChunk(std::vector<unsigned char> *out, const char *type,
+                 const std::vector<unsigned char> &data) {
+  appendBigEndian(out, data.size());
+  const size_t typeStart = out->size();
+  out->insert(out->end(), type, type + 4);
+  out->insert(out->end(), data.begin(), data.end());
+  appendBigEndian(out, crc32(&(*out)[typeStart], out->size() - typeStart));
+}
+
+} // namespace
+
+bool writePng(const std::string &path, const int width, const int height,
+              const unsigned char *rgb) {
+  // Each row is prefixed with filter type 0 (none).
+  const size_t rowBytes = 3 * width;
+  std::vector<unsigned char> raw;
+  raw.reserve((rowBytes + 1) * height);
+  for (int y = 0; y < height; ++y) {
+    raw.push_back(0);
+    raw.insert(raw.end(), rgb + y * rowBytes, rgb + (y + 1) * rowBytes);
+  }
+
+  // zlib stream of stored blocks.
+  std::vector<unsigned char> zlib = {0x78, 0x01};
+  const size_t maxBlock = 65535;
+  for (size_t offset = 0;; offset += maxBlock) {
+    const size_t length = std::min(maxBlock, raw.size() - offset);
+    const bool last = offset + length >= raw.size();
+    zlib.push_back(last ? 1 : 0);
+    zlib.push_back(length & 0xff);
+    zlib.push_back(length >> 8);
+    zlib.push_back(~length & 0xff);
+    zlib.push_back((~length >> 8) & 0xff);
+    zlib.insert(zlib.end(), raw.begin() + offset, raw.begin() + offset + length);
+    if (last) {
+      break;
+    }
+  }
+  unsigned int a = 1, b = 0;
+  for (const unsigned char c : raw) {
+    a = (a + c) % 65521;
+    b = (b + a) % 65521;
+  }
+  appendBigEndian(&zlib, (b << 16) | a);
+
+  std::vector<unsigned char> header;
+  appendBigEndian(&header, width);
+  appendBigEndian(&header, height);
+  // 8 bits per channel, RGB, default compression/filter, no interlace.
+  header.insert(header.end(), {8, 2, 0, 0, 0});
+
+  std::vector<unsigned char> png = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+  appendChunk(&png, "IHDR", header);
+  appendChunk(&png, "IDAT", zlib);
+  appendChunk(&png, "IEND", {});
+
+  FILE *file = fopen(path.c_str(), "wb");
+  if (file == NULL) {
+    return false;
+  }
+  const bool ok = fwrite(png.data(), 1, png.size(), file) == png.size();
+  return fclose(file) == 0 && ok;
+}
+
+FrameCapture::FrameCapture(const std::string &directory, const int width, const int height)
+    : directory(directory), width(width), height(height) {
+  for (Slot &slot : ring) {
+    glGenBuffers(1, &slot.pbo);
+    glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+    glBufferData(GL_PIXEL_PACK_BUFFER, 4 * width * height, NULL, GL_STREAM_READ);
+    resources::track(resources::BUFFER, slot.pbo, 4 * width * height, "frame capture");
+  }
+  glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+FrameCapture::~FrameCapture() {
+  finish();
+  for (Slot &slot : ring) {
+    glstate::deleteBuffer(slot.pbo);
+    resources::untrack(resources::BUFFER, slot.pbo);
+  }
+}
+
+void FrameCapture::capture(const unsigned int fbo, const int frameNumber) {
+  Slot &slot = ring[next];
+  next = (next + 1) % ringSize;
+  if (slot.frameNumber >= 0) {
+    writeOut(slot);
+  }
+  glstate::bindFramebuffer(fbo);
+  glReadBuffer(GL_COLOR_ATTACHMENT0);
+  glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  // RGBA rows are always 4 byte aligned, so the default pack alignment works.
+  glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, (void *)0);
+  glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  slot.frameNumber = frameNumber;
+}
+
+void FrameCapture::writeOut(Slot &slot) {
+  const GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    waited++;
+    glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+  }
+  glDeleteSync(slot.fence);
+  slot.fence = 0;
+
+  glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, slot.pbo);
+  const unsigned char *rgba = (const unsigned char *)glMapBufferRange(
+      GL_PIXEL_PACK_BUFFER, 0, 4 * width * height, GL_MAP_READ_BIT);
+  if (!rgba) {
+    // Nothing is mapped, so there's nothing to unmap.
+    std::cerr << "Failed to map the readback of frame " << slot.frameNumber
+              << " (GL error " << glGetError() << "), skipping it" << std::endl;
+    glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.frameNumber = -1;
+    return;
+  }
+  // GL rows start at the bottom.
+  std::vector<unsigned char> rgb(3 * width * height);
+  for (int y = 0; y < height; ++y) {
+    const unsigned char *src = rgba + 4 * width * (height - 1 - y);
+    unsigned char *dst = &rgb[3 * width * y];
+    for (int x = 0; x < width; ++x) {
+      dst[3 * x] = src[4 * x];
+      dst[3 * x + 1] = src[4 * x + 1];
+      dst[3 * x + 2] = src[4 * x + 2];
+    }
+  }
+  glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+  glstate::bindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  char name[32];
+  snprintf(name, sizeof(name), "/frame_%05d.png", slot.frameNumber);
+  if (!writePng(directory + name, width, height, rgb.data())) {
+    std::cerr << "Failed to write " << directory << name << std::endl;
+    exit(1);
+  }
+  written++;
+  slot.frameNumber = -1;
+}
+
+void FrameCapture::finish() {
+  for (int i = 0; i < ringSize; ++i) {
+    Slot &slot = ring[(next + i) % ringSize];
+    if (slot.frameNumber >= 0) {
+      writeOut(slot);
+    }
+  }
+  if (written > 0) {
+    std::cout << "Captured " << written << " frames to " << directory << ", "
+              << waited << " readbacks waited for the GPU" << std::endl;
+  }
+  written = 0;
+  waited = 0;
+}
@@ -0,0 +1,53 @@
+#ifndef SD_FRAME_CAPTURE_H_
+#define SD_FRAME_CAPTURE_H_
+
+#include <glad/glad.h>
+
+#include <string>
+
+// Writes rendered frames to PNG without stalling the pipeline. Each capture
+// reads into the next of a ring of pixel pack buffers and is only mapped once
+// the ring comes back round to it, by which time the copy has normally
+// finished.
+class FrameCapture {
+public:
+  static const int ringSize = 3;
+
+  // Frames are written to directory/frame_NNNNN.png, which must exist.
+  FrameCapture(const std::string &directory, int width, int height);
+  // Calls finish().
+  ~FrameCapture();
+
+  FrameCapture(const FrameCapture &) = delete;
+  FrameCapture &operator=(const FrameCapture &) = delete;
+
+  // Starts reading colour attachment 0 of fbo, which must be width x height.
+  void capture(unsigned int fbo, int frameNumber);
+  // Writes out every capture still in the ring and prints how many had to
+  // wait for the GPU.
+  void finish();
+
+private:
+  struct Slot {
+    unsigned int pbo = 0;
+    GLsync fence = 0;
+    int frameNumber = -1;
+  };
+
+  void writeOut(Slot &slot);
+
+  const std::string directory;
+  const int width;
+  const int height;
+  Slot ring[ringSize];
+  int next = 0;
+  int written = 0;
+  int waited = 0;
+};
+
+// 8 bit RGB, rows top to bottom. Uses stored (uncompressed) deflate blocks,
+// so files are about the size of the raw pixels. Returns false if the file
+// couldn't be written.
+bool writePng(const std::string &path, int width, int height, const unsigned char *rgb);
+
+#endif // SD_FRAME_CAPTURE_H_
@@ -0,0 +1,364 @@
+#include "opengl/frame_graph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+#include "opengl/gl_state.h"
+#include "opengl/resource_registry.h"
+
+namespace {
+
+bool isDepthFormat(const RenderTargetDesc &d) {
+  return d.format == GL_DEPTH_COMPONENT || d.format == GL_DEPTH_STENCIL;
+}
+
+bool canAlias(const RenderTargetDesc &a, const RenderTargetDesc &b) {
+  return a.internalFormat == b.internalFormat && a.format == b.format &&
+         a.type == b.type && a.scaleDivisor == b.scaleDivisor &&
+         a.fixedWidth == b.fixedWidth && a.fixedHeight == b.fixedHeight &&
+         a.renderbuffer == b.renderbuffer && a.filter == b.filter &&
+         a.wrap == b.wrap && a.compareMode == b.compareMode &&
+         a.dynamicScale == b.dynamicScale &&
+         std::memcmp(a.borderColor, b.borderColor, sizeof(a.borderColor)) == 0;
+}
+
+void targetSize(const RenderTargetDesc &d, int viewportWidth, int viewportHeight,
+                int *width, int *height) {
+  if (d.fixedWidth > 0) {
+    *width = d.fixedWidth;
+    *height = d.fixedHeight;
+  } else {
+    *width = std::max(1, viewportWidth / d.scaleDivisor);
+    *height = std::max(1, viewportHeight / d.scaleDivisor);
+  }
+}
+
+} // namespace
+
+FrameGraph::ResourceId FrameGraph::createTarget(const std::string &name,
+                                                const RenderTargetDesc &desc) {
+  Target t;
+  t.name = name;
+  t.desc = desc;
+  targets.push_back(t);
+  return targets.size() - 1;
+}
+
+void FrameGraph::addPass(const std::string &name, std::vector<ResourceId> reads,
+                         std::vector<ResourceId> writes,
+                         std::function<void()> execute) {
+  Pass p;
+  p.name = name;
+  p.reads = std::move(reads);
+  p.writes = std::move(writes);
+  p.execute = std::move(execute);
+  passes.push_back(std::move(p));
+}
+
+void FrameGraph::compile(const int _viewportWidth, const int _viewportHeight) {
+  viewportWidth = _viewportWidth;
+  viewportHeight = _viewportHeight;
+  cullPasses();
+  allocate();
+  for (Pass &pass : passes) {
+    if (!pass.culled) {
+      buildFramebuffer(pass);
+      for (const ResourceId w : pass.writes) {
+        pass.scaled |= w != BACKBUFFER && targets[w].desc.dynamicScale;
+      }
+    }
+  }
+  glstate::bindFramebuffer(0);
+}
+
+void FrameGraph::cullPasses() {
+  // Walk backwards from the backbuffer keeping only passes whose output
+  // something later (transitively) consumes.
+  std::vector<bool> needed(targets.size(), false);
+  for (int i = passes.size() - 1; i >= 0; --i) {
+    Pass &pass = passes[i];
+    bool live = false;
+    for (const ResourceId w : pass.writes) {
+      live |= w == BACKBUFFER || needed[w];
+    }
+    pass.culled = !live;
+    if (live) {
+      for (const ResourceId r : pass.reads) {
+        needed[r] = true;
+      }
+    }
+  }
+}
+
+void FrameGraph::allocate() {
+  for (int i = 0; i < passes.size(); ++i) {
+    if (passes[i].culled) {
+      continue;
+    }
+    const auto touch = [this, i](ResourceId id) {
+      if (id == BACKBUFFER) {
+        return;
+      }
+      Target &t = targets[id];
+      if (t.firstPass < 0) {
+        t.firstPass = i;
+      }
+      t.lastPass = i;
+    };
+    std::for_each(passes[i].reads.begin(), passes[i].reads.end(), touch);
+    std::for_each(passes[i].writes.begin(), passes[i].writes.end(), touch);
+  }
+
+  std::vector<ResourceId> order;
+  for (ResourceId id = 0; id < targets.size(); ++id) {
+    if (targets[id].firstPass >= 0) {
+      order.push_back(id);
+    }
+  }
+  std::sort(order.begin(), order.end(), [this](ResourceId a, ResourceId b) {
+    return targets[a].firstPass < targets[b].firstPass;
+  });
+  for (const ResourceId id : order) {
+    Target &t = targets[id];
+    for (int p = 0; p < physicals.size(); ++p) {
+      if (physicals[p].lastPass < t.firstPass && canAlias(physicals[p].desc, t.desc)) {
+        t.physical = p;
+        break;
+      }
+    }
+    if (t.physical < 0) {
+      Physical p;
+      p.desc = t.desc;
+      if (p.desc.renderbuffer) {
+        glGenRenderbuffers(1, &p.id);
+      } else {
+        glGenTextures(1, &p.id);
+      }
+      specifyStorage(p);
+      physicals.push_back(p);
+      t.physical = physicals.size() - 1;
+    }
+    physicals[t.physical].lastPass = t.lastPass;
+  }
+}
+
+void FrameGraph::specifyStorage(Physical &p) {
+  const RenderTargetDesc &d = p.desc;
+  targetSize(d, viewportWidth, viewportHeight, &p.width, &p.height);
+  const long long bytes = resources::textureBytes(d.internalFormat, p.width, p.height, 1, false);
+  if (d.renderbuffer) {
+    glstate::bindRenderbuffer(p.id);
+    glRenderbufferStorage(GL_RENDERBUFFER, d.internalFormat, p.width, p.height);
+    resources::track(resources::RENDERBUFFER, p.id, bytes, "frame graph");
+    return;
+  }
+  resources::track(resources::TEXTURE, p.id, bytes, "frame graph");
+  glstate::bindTexture(scratchTextureUnit, GL_TEXTURE_2D, p.id);
+  glTexImage2D(GL_TEXTURE_2D, 0, d.internalFormat, p.width, p.height, 0,
+               d.format, d.type, NULL);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, d.filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, d.filter);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, d.wrap);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, d.wrap);
+  if (d.wrap == GL_CLAMP_TO_BORDER) {
+    glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, d.borderColor);
+  }
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_MODE, d.compareMode);
+  if (d.compareMode != GL_NONE) {
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_COMPARE_FUNC, GL_LEQUAL);
+  }
+}
+
+void FrameGraph::buildFramebuffer(Pass &pass) {
+  bool writesBackbuffer = false;
+  for (const ResourceId w : pass.writes) {
+    writesBackbuffer |= w == BACKBUFFER;
+  }
+  if (writesBackbuffer) {
+    if (pass.writes.size() > 1) {
+      std::cerr << "Pass " << pass.name << " mixes the backbuffer with other targets" << std::endl;
+      exit(1);
+    }
+    pass.writesBackbuffer = true;
+    return;
+  }
+  glGenFramebuffers(1, &pass.fbo);
+  glstate::bindFramebuffer(pass.fbo);
+  std::vector<GLenum> drawBuffers;
+  for (const ResourceId w : pass.writes) {
+    const Physical &p = physicals[targets[w].physical];
+    GLenum attachment;
+    if (isDepthFormat(p.desc)) {
+      attachment = p.desc.format == GL_DEPTH_STENCIL ? GL_DEPTH_STENCIL_ATTACHMENT : GL_DEPTH_ATTACHMENT;
+    } else {
+      attachment = GL_COLOR_ATTACHMENT0 + drawBuffers.size();
+      drawBuffers.push_back(attachment);
+    }
+    if (p.desc.renderbuffer) {
+      glFramebufferRenderbuffer(GL_FRAMEBUFFER, attachment, GL_RENDERBUFFER, p.id);
+    } else {
+      glFramebufferTexture2D(GL_FRAMEBUFFER, attachment, GL_TEXTURE_2D, p.id, 0);
+    }
+  }
+  if (drawBuffers.empty()) {
+    glDrawBuffer(GL_NONE);
+    glReadBuffer(GL_NONE);
+  } else {
+    glDrawBuffers(drawBuffers.size(), drawBuffers.data());
+  }
+  if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
+    std::cerr << "Frame buffer for pass " << pass.name << " not complete!" << std::endl;
+    exit(1);
+  }
+}
+
+void FrameGraph::resize(const int _viewportWidth, const int _viewportHeight) {
+  if (_viewportWidth == viewportWidth && _viewportHeight == viewportHeight) {
+    return;
+  }
+  viewportWidth = _viewportWidth;
+  viewportHeight = _viewportHeight;
+  // Same GL objects, new storage, so the framebuffers stay valid.
+  for (Physical &p : physicals) {
+    if (p.desc.fixedWidth == 0) {
+      specifyStorage(p);
+    }
+  }
+}
+
+void FrameGraph::setRenderScale(const float _scale) {
+  scale = std::min(std::max(_scale, 0.01f), 1.0f);
+}
+
+void FrameGraph::passSize(const Pass &pass, int *width, int *height) const {
+  *width = viewportWidth;
+  *height = viewportHeight;
+  for (const ResourceId w : pass.writes) {
+    if (w != BACKBUFFER) {
+      const Physical &p = physicals[targets[w].physical];
+      *width = p.width;
+      *height = p.height;
+      if (p.desc.dynamicScale) {
+        *width = std::max(1, (int)lroundf(p.width * scale));
+        *height = std::max(1, (int)lroundf(p.height * scale));
+      }
+      return;
+    }
+  }
+}
+
+void FrameGraph::enableGpuTiming() {
+  if (timing) {
+    return;
+  }
+  timing = true;
+  for (Pass &pass : passes) {
+    glGenQueries(timerFrames, pass.timerQueries);
+  }
+  // Slots only hold results once they've gone round the ring.
+  framesExecuted = 0;
+}
+
+void FrameGraph::readTimers(const int slot) {
+  // Queries finish in order, so if the last pass's has the rest have too.
+  for (int i = passes.size() - 1; i >= 0; --i) {
+    if (!passes[i].culled) {
+      GLint available = 0;
+      glGetQueryObjectiv(passes[i].timerQueries[slot], GL_QUERY_RESULT_AVAILABLE, &available);
+      if (!available) {
+        // Reusing the queries drops this frame rather than waiting for it.
+        return;
+      }
+      break;
+    }
+  }
+  latestTimes.renderScale = slotScale[slot];
+  latestTimes.scaledMs = 0.0f;
+  latestTimes.fixedMs = 0.0f;
+  latestTimes.passMs.assign(passes.size(), 0.0f);
+  for (int i = 0; i < passes.size(); ++i) {
+    if (passes[i].culled) {
+      continue;
+    }
+    GLuint64 ns = 0;
+    glGetQueryObjectui64v(passes[i].timerQueries[slot], GL_QUERY_RESULT, &ns);
+    const float ms = ns / 1e6f;
+    latestTimes.passMs[i] = ms;
+    (passes[i].scaled ? latestTimes.scaledMs : latestTimes.fixedMs) += ms;
+  }
+  haveLatestTimes = true;
+}
+
+bool FrameGraph::takeGpuTimes(GpuTimes *times) {
+  if (!haveLatestTimes) {
+    return false;
+  }
+  *times = latestTimes;
+  haveLatestTimes = false;
+  return true;
+}
+
+void FrameGraph::execute() {
+  const int slot = framesExecuted % timerFrames;
+  if (timing) {
+    // The first frame's queries can include driver start-up (llvmpipe
+    // reports seconds), so the first time round the ring is dropped.
+    if (framesExecuted >= 2 * timerFrames) {
+      readTimers(slot);
+    }
+    slotScale[slot] = scale;
+  }
+  for (const Pass &pass : passes) {
+    if (pass.culled) {
+      continue;
+    }
+    if (timing) {
+      glBeginQuery(GL_TIME_ELAPSED, pass.timerQueries[slot]);
+    }
+    glstate::bindFramebuffer(pass.writesBackbuffer ? backbufferFbo : pass.fbo);
+    int width, height;
+    passSize(pass, &width, &height);
+    glstate::viewport(0, 0, width, height);
+    for (const ResourceId r : pass.reads) {
+      const Target &t = targets[r];
+      if (t.desc.textureUnit >= 0) {
+        glstate::bindTexture(t.desc.textureUnit, GL_TEXTURE_2D, physicals[t.physical].id);
+      }
+    }
+    glstate::activeTexture(scratchTextureUnit);
+    pass.execute();
+    if (timing) {
+      glEndQuery(GL_TIME_ELAPSED);
+    }
+  }
+  framesExecuted++;
+}
+
+void FrameGraph::logStats() const {
+  int numCulled = 0;
+  for (const Pass &pass : passes) {
+    if (pass.culled) {
+      std::cout << "  culled pass " << pass.name << std::endl;
+      numCulled++;
+    }
+  }
+  long long virtualBytes = 0;
+  for (const Target &t : targets) {
+    if (t.physical < 0) {
+      continue;
+    }
+    int width, height;
+    targetSize(t.desc, viewportWidth, viewportHeight, &width, &height);
+    virtualBytes += (long long)width * height * resources::bytesPerPixel(t.desc.internalFormat);
+  }
+  long long physicalBytes = 0;
+  for (const Physical &p : physicals) {
+    physicalBytes += (long long)p.width * p.height * resources::bytesPerPixel(p.desc.internalFormat);
+  }
+  std::cout << "Frame graph: " << (passes.size() - numCulled) << " passes ("
+            << numCulled << " culled), " << targets.size() << " targets backed by "
+            << physicals.size() << " GL objects, ~" << (physicalBytes >> 20)
+            << "MB (" << (virtualBytes >> 20) << "MB without aliasing)" << std::endl;
+}
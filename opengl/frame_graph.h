@@ -0,0 +1,138 @@
+#ifndef SD_FRAME_GRAPH_H_
+#define SD_FRAME_GRAPH_H_
+
+#include <glad/glad.h>
+
+#include <functional>
+#include <string>
+#include <vector>
+
+// Describes a render target. Unless fixedWidth/fixedHeight are set the target
+// follows the viewport size divided by scaleDivisor.
+struct RenderTargetDesc {
+  GLenum internalFormat = GL_RGB;
+  GLenum format = GL_RGB;
+  GLenum type = GL_FLOAT;
+  int scaleDivisor = 1;
+  int fixedWidth = 0;
+  int fixedHeight = 0;
+  // Depth/stencil targets that are never sampled can be renderbuffers.
+  bool renderbuffer = false;
+  GLenum filter = GL_LINEAR;
+  GLenum wrap = GL_CLAMP_TO_EDGE;
+  float borderColor[4] = {0.0f, 0.0f, 0.0f, 0.0f};
+  // GL_COMPARE_REF_TO_TEXTURE for depth targets read through sampler2DShadow;
+  // with GL_LINEAR filtering the hardware then does 2x2 PCF per tap.
+  GLenum compareMode = GL_NONE;
+  // Allocated for render scale 1, but passes writing it only draw into the
+  // bottom-left renderScale() of it. Readers scale their UVs to match.
+  bool dynamicScale = false;
+  // Texture unit the target is bound to for passes that read it, or -1.
+  int textureUnit = -1;
+};
+
+// Declarative description of a frame. Passes list the targets they read and
+// write; compile() then culls passes that don't contribute to the backbuffer,
+// works out each target's lifetime and backs targets whose lifetimes don't
+// overlap with the same GL object. Viewport-relative targets are reallocated
+// by resize().
+class FrameGraph {
+public:
+  typedef int ResourceId;
+  // The default framebuffer.
+  static const ResourceId BACKBUFFER = -1;
+  // Timer queries are read back this many frames after they're issued, so
+  // reading them never waits on the GPU.
+  static const int timerFrames = 3;
+
+  // GPU time of one executed frame.
+  struct GpuTimes {
+    // Render scale the frame was drawn at.
+    float renderScale = 1.0f;
+    // Passes that write dynamically scaled targets, and the rest.
+    float scaledMs = 0.0f;
+    float fixedMs = 0.0f;
+    // Per pass in addPass() order, 0 for culled passes.
+    std::vector<float> passMs;
+  };
+
+  // scratchTextureUnit is left bound to the graph's own textures while they're
+  // being (re)allocated, so it mustn't be used for anything else.
+  explicit FrameGraph(int scratchTextureUnit) : scratchTextureUnit(scratchTextureUnit) {}
+
+  ResourceId createTarget(const std::string &name, const RenderTargetDesc &desc);
+  // execute is called with the pass's framebuffer and viewport bound and its
+  // reads bound to their texture units.
+  void addPass(const std::string &name, std::vector<ResourceId> reads,
+               std::vector<ResourceId> writes, std::function<void()> execute);
+
+  // Must be called once after all targets and passes are added.
+  void compile(int viewportWidth, int viewportHeight);
+  void resize(int viewportWidth, int viewportHeight);
+  // Clamped to (0, 1]. Takes effect from the next execute().
+  void setRenderScale(float scale);
+  float renderScale() const { return scale; }
+  void execute();
+  // Framebuffer that passes writing BACKBUFFER draw into, e.g. an offscreen
+  // one when there's no window. Defaults to 0, the window's.
+  void setBackbuffer(unsigned int fbo) { backbufferFbo = fbo; }
+
+  // Wraps each pass in a GL_TIME_ELAPSED query from the next execute() on.
+  void enableGpuTiming();
+  // Fills times with the newest frame whose queries have finished, if there
+  // is one that hasn't been returned yet.
+  bool takeGpuTimes(GpuTimes *times);
+  const std::string &passName(int pass) const { return passes[pass].name; }
+
+  void logStats() const;
+
+private:
+  struct Target {
+    std::string name;
+    RenderTargetDesc desc;
+    int physical = -1;
+    int firstPass = -1;
+    int lastPass = -1;
+  };
+  struct Physical {
+    RenderTargetDesc desc;
+    unsigned int id = 0;
+    int width = 0;
+    int height = 0;
+    int lastPass = -1;
+  };
+  struct Pass {
+    std::string name;
+    std::vector<ResourceId> reads;
+    std::vector<ResourceId> writes;
+    std::function<void()> execute;
+    bool culled = false;
+    bool scaled = false;
+    bool writesBackbuffer = false;
+    unsigned int fbo = 0;
+    unsigned int timerQueries[timerFrames] = {};
+  };
+
+  void cullPasses();
+  void allocate();
+  void specifyStorage(Physical &p);
+  void buildFramebuffer(Pass &pass);
+  void passSize(const Pass &pass, int *width, int *height) const;
+  void readTimers(int slot);
+
+  const int scratchTextureUnit;
+  int viewportWidth = 0;
+  int viewportHeight = 0;
+  float scale = 1.0f;
+  unsigned int backbufferFbo = 0;
+  bool timing = false;
+  int framesExecuted = 0;
+  float slotScale[timerFrames] = {};
+  GpuTimes latestTimes;
+  bool haveLatestTimes = false;
+  std::vector<Target> targets;
+  std::vector<Physical> physicals;
+  std::vector<Pass> passes;
+};
+
+#endif // SD_FRAME_GRAPH_H_
@@ -0,0 +1,109 @@
+#include "opengl/frame_pacer.h"
+
+#include <algorithm>
+
+namespace {
+
+template <class Duration> float toMs(const Duration d) {
+  return std::chrono::duration<float, std::milli>(d).count();
+}
+
+} // namespace
+
+FramePacer::FramePacer(const Settings &_settings) : settings(_settings) {
+  setMaxFramesInFlight(settings.maxFramesInFlight);
+}
+
+void FramePacer::setMaxFramesInFlight(const int frames) {
+  settings.maxFramesInFlight = std::min(std::max(frames, 1), maxFramesLimit);
+}
+
+void FramePacer::beginFrame() {
+  const Clock::time_point start = Clock::now();
+  while (outstanding > 0) {
+    Slot &oldest = ring[(next - outstanding + maxFramesLimit) % maxFramesLimit];
+    if (!retire(oldest, outstanding >= settings.maxFramesInFlight)) {
+      break;
+    }
+    outstanding--;
+  }
+  stats.waitMs += toMs(Clock::now() - start);
+}
+
+void FramePacer::inputEvent() {
+  if (!havePendingInput) {
+    pendingInput = Clock::now();
+    havePendingInput = true;
+  }
+}
+
+void FramePacer::latchInput() {
+  if (havePendingInput && !haveLatchedInput) {
+    latchedInput = pendingInput;
+    haveLatchedInput = true;
+  }
+  havePendingInput = false;
+}
+
+void FramePacer::endFrame() {
+  Slot &slot = ring[next];
+  if (slot.query == 0) {
+    glGenQueries(1, &slot.query);
+  }
+  slot.hasInput = haveLatchedInput;
+  slot.input = latchedInput;
+  haveLatchedInput = false;
+  slot.swap = Clock::now();
+  // Read before the query is issued, so the query can only be later.
+  glGetInteger64v(GL_TIMESTAMP, &slot.gpuAtSwap);
+  glQueryCounter(slot.query, GL_TIMESTAMP);
+  slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+  next = (next + 1) % maxFramesLimit;
+  outstanding++;
+  stats.frames++;
+}
+
+bool FramePacer::retire(Slot &slot, const bool wait) {
+  GLenum status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 0);
+  if (status == GL_TIMEOUT_EXPIRED) {
+    if (!wait) {
+      return false;
+    }
+    glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, GL_TIMEOUT_IGNORED);
+  }
+  glDeleteSync(slot.fence);
+  slot.fence = 0;
+  if (slot.hasInput) {
+    GLuint64 gpuDone = 0;
+    glGetQueryObjectui64v(slot.query, GL_QUERY_RESULT, &gpuDone);
+    const float toSwapMs = toMs(slot.swap - slot.input);
+    const float afterSwapMs = std::max((GLint64)gpuDone - slot.gpuAtSwap, (GLint64)0) / 1e6f;
+    stats.inputFrames++;
+    stats.inputToSwapMs += toSwapMs;
+    stats.inputToGpuMs += toSwapMs + afterSwapMs;
+    stats.maxInputToGpuMs = std::max(stats.maxInputToGpuMs, toSwapMs + afterSwapMs);
+  }
+  return true;
+}
+
+void FramePacer::finish() {
+  for (; outstanding > 0; --outstanding) {
+    retire(ring[(next - outstanding + maxFramesLimit) % maxFramesLimit], true);
+  }
+  for (Slot &slot : ring) {
+    if (slot.query != 0) {
+      glDeleteQueries(1, &slot.query);
+      slot.query = 0;
+    }
+  }
+}
+
+FramePacer::Stats FramePacer::takeStats() {
+  Stats result = stats;
+  if (result.inputFrames > 0) {
+    result.inputToSwapMs /= result.inputFrames;
+    result.inputToGpuMs /= result.inputFrames;
+  }
+  stats = Stats();
+  return result;
+}
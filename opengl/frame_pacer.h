@@ -0,0 +1,93 @@
+#ifndef SD_FRAME_PACER_H_
+#define SD_FRAME_PACER_H_
+
+#include <glad/glad.h>
+
+#include <chrono>
+
+// Caps how many frames the driver may queue ahead of the GPU, with a fence per
+// frame, and measures input-to-display latency.
+//
+// Input sampled for a frame only reaches the screen once every frame queued
+// before it has drawn, so each frame in flight can add a frame of latency.
+// beginFrame() waits until fewer than maxFramesInFlight are outstanding, so
+// call it before the frame samples input.
+//
+// The latency probe stamps input events as they arrive. The frame that latches
+// them keeps the earliest unconsumed stamp, and its swap and a GPU timestamp
+// after the swap give input-to-swap and input-to-GPU-done times. The GPU
+// finishing the frame is as close to it being displayed as GL can see.
+//
+// Owns no GL objects until the first endFrame(), so it can be a global that
+// input callbacks reach. Call finish() before the context goes away.
+class FramePacer {
+public:
+  static const int maxFramesLimit = 8;
+
+  struct Settings {
+    int maxFramesInFlight = 2;
+  };
+
+  // Since the last takeStats(). Latencies are means over inputFrames.
+  struct Stats {
+    int frames = 0;
+    // Spent in beginFrame() waiting for the GPU.
+    float waitMs = 0.0f;
+    // Frames that latched at least one input event, and their latencies.
+    int inputFrames = 0;
+    float inputToSwapMs = 0.0f;
+    float inputToGpuMs = 0.0f;
+    float maxInputToGpuMs = 0.0f;
+  };
+
+  explicit FramePacer(const Settings &settings);
+
+  FramePacer(const FramePacer &) = delete;
+  FramePacer &operator=(const FramePacer &) = delete;
+
+  // Clamped to [1, maxFramesLimit]. Takes effect from the next beginFrame().
+  void setMaxFramesInFlight(int frames);
+  int maxFramesInFlight() const { return settings.maxFramesInFlight; }
+
+  // Retires finished frames and blocks while too many are still queued.
+  void beginFrame();
+  // Stamps an input event. Only the earliest one a frame latches counts.
+  void inputEvent();
+  // The frame being built consumes every input stamped so far.
+  void latchInput();
+  // Call right after the swap, or the frame's last command without a window.
+  void endFrame();
+  // Waits for every outstanding frame and deletes the GL objects.
+  void finish();
+
+  // Returns the totals and resets them.
+  Stats takeStats();
+
+private:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Slot {
+    GLsync fence = 0;
+    unsigned int query = 0;
+    bool hasInput = false;
+    Clock::time_point input;
+    Clock::time_point swap;
+    // GL_TIMESTAMP when the swap returned, to map the query onto Clock.
+    GLint64 gpuAtSwap = 0;
+  };
+
+  // Returns false if the frame hasn't finished and wait is false.
+  bool retire(Slot &slot, bool wait);
+
+  Settings settings;
+  Slot ring[maxFramesLimit];
+  int next = 0;
+  int outstanding = 0;
+  bool havePendingInput = false;
+  Clock::time_point pendingInput;
+  bool haveLatchedInput = false;
+  Clock::time_point latchedInput;
+  Stats stats;
+};
+
+#endif // SD_FRAME_PACER_H_
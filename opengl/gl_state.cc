@@ -0,0 +1,245 @@
+#include "opengl/gl_state.h"
+
+namespace glstate {
+namespace {
+
+const unsigned int unknown = ~0u;
+const int maxTextureUnits = 32;
+// Texture targets with shadowed bindings.
+const GLenum textureTargets[] = {GL_TEXTURE_2D, GL_TEXTURE_2D_ARRAY};
+const int numTextureTargets = sizeof(textureTargets) / sizeof(textureTargets[0]);
+const GLenum bufferTargets[] = {GL_ARRAY_BUFFER, GL_PIXEL_PACK_BUFFER, GL_PIXEL_UNPACK_BUFFER};
+const int numBufferTargets = sizeof(bufferTargets) / sizeof(bufferTargets[0]);
+const GLenum caps[] = {GL_BLEND, GL_DEPTH_TEST, GL_CULL_FACE};
+const int numCaps = sizeof(caps) / sizeof(caps[0]);
+
+struct State {
+  unsigned int program;
+  unsigned int vao;
+  unsigned int buffers[numBufferTargets];
+  unsigned int activeUnit;
+  unsigned int textures[maxTextureUnits][numTextureTargets];
+  unsigned int fbo;
+  unsigned int rbo;
+  // 0, 1 or unknown.
+  unsigned int caps[numCaps];
+  unsigned int depthMask;
+  unsigned int colorMask;
+  float clearColor[4];
+  bool clearColorKnown;
+  int viewport[4];
+  bool viewportKnown;
+};
+
+State state;
+bool initialised = false;
+Counters frameCounters;
+
+State &get() {
+  if (!initialised) {
+    invalidate();
+  }
+  return state;
+}
+
+// Updates *cached and returns true if the call needs issuing.
+bool change(unsigned int *cached, unsigned int value) {
+  if (*cached == value) {
+    frameCounters.elided++;
+    return false;
+  }
+  *cached = value;
+  frameCounters.issued++;
+  return true;
+}
+
+int indexOf(const GLenum *values, int n, GLenum value) {
+  for (int i = 0; i < n; ++i) {
+    if (values[i] == value) {
+      return i;
+    }
+  }
+  return -1;
+}
+
+void setCap(GLenum cap, bool enabled) {
+  const int i = indexOf(caps, numCaps, cap);
+  if (i >= 0 && !change(&get().caps[i], enabled)) {
+    return;
+  }
+  if (i < 0) {
+    frameCounters.issued++;
+  }
+  if (enabled) {
+    glEnable(cap);
+  } else {
+    glDisable(cap);
+  }
+}
+
+} // namespace
+
+void useProgram(unsigned int program) {
+  if (change(&get().program, program)) {
+    glUseProgram(program);
+  }
+}
+
+void bindVertexArray(unsigned int vao) {
+  if (change(&get().vao, vao)) {
+    glBindVertexArray(vao);
+  }
+}
+
+void bindBuffer(GLenum target, unsigned int buffer) {
+  const int i = indexOf(bufferTargets, numBufferTargets, target);
+  if (i < 0) {
+    frameCounters.issued++;
+    glBindBuffer(target, buffer);
+  } else if (change(&get().buffers[i], buffer)) {
+    glBindBuffer(target, buffer);
+  }
+}
+
+void activeTexture(int unit) {
+  if (change(&get().activeUnit, unit)) {
+    glActiveTexture(GL_TEXTURE0 + unit);
+  }
+}
+
+int activeTextureUnit() {
+  if (get().activeUnit == unknown) {
+    int unit;
+    glGetIntegerv(GL_ACTIVE_TEXTURE, &unit);
+    state.activeUnit = unit - GL_TEXTURE0;
+  }
+  return state.activeUnit;
+}
+
+void bindTexture(int unit, GLenum target, unsigned int texture) {
+  // Callers follow up with glTex* calls on the active unit, so it's switched
+  // even if the binding itself is already right.
+  activeTexture(unit);
+  const int i = indexOf(textureTargets, numTextureTargets, target);
+  if (i < 0 || unit >= maxTextureUnits) {
+    frameCounters.issued++;
+    glBindTexture(target, texture);
+  } else if (change(&state.textures[unit][i], texture)) {
+    glBindTexture(target, texture);
+  }
+}
+
+void bindFramebuffer(unsigned int fbo) {
+  if (change(&get().fbo, fbo)) {
+    glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+  }
+}
+
+void bindRenderbuffer(unsigned int rbo) {
+  if (change(&get().rbo, rbo)) {
+    glBindRenderbuffer(GL_RENDERBUFFER, rbo);
+  }
+}
+
+void enable(GLenum cap) { setCap(cap, true); }
+
+void disable(GLenum cap) { setCap(cap, false); }
+
+void depthMask(bool enabled) {
+  if (change(&get().depthMask, enabled)) {
+    glDepthMask(enabled ? GL_TRUE : GL_FALSE);
+  }
+}
+
+void colorMask(bool enabled) {
+  if (change(&get().colorMask, enabled)) {
+    const GLboolean b = enabled ? GL_TRUE : GL_FALSE;
+    glColorMask(b, b, b, b);
+  }
+}
+
+void clearColor(float r, float g, float b, float a) {
+  State &s = get();
+  if (s.clearColorKnown && s.clearColor[0] == r && s.clearColor[1] == g &&
+      s.clearColor[2] == b && s.clearColor[3] == a) {
+    frameCounters.elided++;
+    return;
+  }
+  s.clearColor[0] = r;
+  s.clearColor[1] = g;
+  s.clearColor[2] = b;
+  s.clearColor[3] = a;
+  s.clearColorKnown = true;
+  frameCounters.issued++;
+  glClearColor(r, g, b, a);
+}
+
+void viewport(int x, int y, int width, int height) {
+  State &s = get();
+  if (s.viewportKnown && s.viewport[0] == x && s.viewport[1] == y &&
+      s.viewport[2] == width && s.viewport[3] == height) {
+    frameCounters.elided++;
+    return;
+  }
+  s.viewport[0] = x;
+  s.viewport[1] = y;
+  s.viewport[2] = width;
+  s.viewport[3] = height;
+  s.viewportKnown = true;
+  frameCounters.issued++;
+  glViewport(x, y, width, height);
+}
+
+void deleteVertexArray(unsigned int vao) {
+  if (get().vao == vao) {
+    state.vao = 0;
+  }
+  glDeleteVertexArrays(1, &vao);
+}
+
+void deleteBuffer(unsigned int buffer) {
+  for (unsigned int &b : get().buffers) {
+    if (b == buffer) {
+      b = 0;
+    }
+  }
+  // Could also be the bound VAO's element buffer, which isn't shadowed.
+  glDeleteBuffers(1, &buffer);
+}
+
+void deleteProgram(unsigned int program) {
+  if (get().program == program) {
+    state.program = 0;
+  }
+  glDeleteProgram(program);
+}
+
+void invalidate() {
+  initialised = true;
+  state.program = unknown;
+  state.vao = unknown;
+  for (unsigned int &b : state.buffers) {
+    b = unknown;
+  }
+  state.activeUnit = unknown;
+  for (auto &unit : state.textures) {
+    for (unsigned int &t : unit) {
+      t = unknown;
+    }
+  }
+  state.fbo = unknown;
+  state.rbo = unknown;
+  for (unsigned int &c : state.caps) {
+    c = unknown;
+  }
+  state.depthMask = unknown;
+  state.colorMask = unknown;
+  state.clearColorKnown = false;
+  state.viewportKnown = false;
+}
+
+Counters counters() { return frameCounters; }
+
+void resetCounters() { frameCounters = Counters(); }
+
+} // namespace glstate
@@ -0,0 +1,53 @@
+#ifndef SD_GL_STATE_H_
+#define SD_GL_STATE_H_
+
+#include <glad/glad.h>
+
+// Shadows the GL state the renderer touches and drops calls that wouldn't
+// change it. Everything that binds programs, VAOs, buffers, textures or
+// framebuffers, or flips blend/depth/cull state, should go through here. A
+// direct GL call leaves the shadow stale until invalidate().
+//
+// Unknown state (at startup and after invalidate()) is never elided.
+namespace glstate {
+
+void useProgram(unsigned int program);
+void bindVertexArray(unsigned int vao);
+// GL_ELEMENT_ARRAY_BUFFER is VAO state so is always passed through, as are
+// targets other than the array and pixel pack/unpack buffers.
+void bindBuffer(GLenum target, unsigned int buffer);
+void activeTexture(int unit);
+// For code that binds on whatever unit is active.
+int activeTextureUnit();
+// Binds on the given unit and leaves it the active one.
+void bindTexture(int unit, GLenum target, unsigned int texture);
+void bindFramebuffer(unsigned int fbo);
+void bindRenderbuffer(unsigned int rbo);
+// GL_BLEND, GL_DEPTH_TEST and GL_CULL_FACE are tracked, anything else is
+// passed through.
+void enable(GLenum cap);
+void disable(GLenum cap);
+void depthMask(bool enabled);
+void colorMask(bool enabled);
+void clearColor(float r, float g, float b, float a);
+void viewport(int x, int y, int width, int height);
+
+// GL drops bindings of deleted objects, and names get reused, so deletes of
+// anything that might be bound go through here too.
+void deleteVertexArray(unsigned int vao);
+void deleteBuffer(unsigned int buffer);
+void deleteProgram(unsigned int program);
+
+void invalidate();
+
+struct Counters {
+  int issued = 0;
+  int elided = 0;
+};
+// Calls issued to GL vs dropped since the last resetCounters().
+Counters counters();
+void resetCounters();
+
+} // namespace glstate
+
+#endif // SD_GL_STATE_H_
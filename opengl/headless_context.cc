@@ -0,0 +1,111 @@
+#include "opengl/headless_context.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+
+#ifdef __linux__
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
+namespace {
+
+bool hasExtension(const char *extensions, const char *name) {
+  if (extensions == NULL) {
+    return false;
+  }
+  const size_t length = strlen(name);
+  for (const char *p = strstr(extensions, name); p != NULL; p = strstr(p + length, name)) {
+    if ((p == extensions || p[-1] == ' ') && (p[length] == ' ' || p[length] == '\0')) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void fail(const char *what) {
+  std::cerr << "Headless context: " << what << " (EGL error 0x" << std::hex
+            << eglGetError() << std::dec << ")" << std::endl;
+  exit(1);
+}
+
+} // namespace
+
+HeadlessContext::HeadlessContext(const int majorVersion, const int minorVersion) {
+  EGLDisplay eglDisplay = EGL_NO_DISPLAY;
+  const PFNEGLGETPLATFORMDISPLAYEXTPROC getPlatformDisplay =
+      (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+  if (getPlatformDisplay != NULL &&
+      hasExtension(eglQueryString(EGL_NO_DISPLAY, EGL_EXTENSIONS), "EGL_MESA_platform_surfaceless")) {
+    eglDisplay = getPlatformDisplay(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+  }
+  if (eglDisplay == EGL_NO_DISPLAY) {
+    eglDisplay = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+  }
+  EGLint eglMajor, eglMinor;
+  if (eglDisplay == EGL_NO_DISPLAY || !eglInitialize(eglDisplay, &eglMajor, &eglMinor)) {
+    fail("no EGL display");
+  }
+  if (!hasExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_surfaceless_context")) {
+    fail("EGL_KHR_surfaceless_context not supported");
+  }
+  if (!eglBindAPI(EGL_OPENGL_API)) {
+    fail("desktop GL not supported");
+  }
+
+  // Without a surface the config only matters if the driver insists on one.
+  // The default surface type is EGL_WINDOW_BIT, which surfaceless displays
+  // have no configs for.
+  EGLConfig config = EGL_NO_CONFIG_KHR;
+  if (!hasExtension(eglQueryString(eglDisplay, EGL_EXTENSIONS), "EGL_KHR_no_config_context")) {
+    const EGLint configAttribs[] = {
+      EGL_SURFACE_TYPE, EGL_PBUFFER_BIT,
+      EGL_RENDERABLE_TYPE, EGL_OPENGL_BIT,
+      EGL_NONE,
+    };
+    EGLint numConfigs = 0;
+    if (!eglChooseConfig(eglDisplay, configAttribs, &config, 1, &numConfigs) || numConfigs == 0) {
+      fail("no GL config");
+    }
+  }
+  const EGLint contextAttribs[] = {
+    EGL_CONTEXT_MAJOR_VERSION, majorVersion,
+    EGL_CONTEXT_MINOR_VERSION, minorVersion,
+    EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+    EGL_NONE,
+  };
+  EGLContext eglContext = eglCreateContext(eglDisplay, config, EGL_NO_CONTEXT, contextAttribs);
+  if (eglContext == EGL_NO_CONTEXT) {
+    fail("couldn't create context");
+  }
+  if (!eglMakeCurrent(eglDisplay, EGL_NO_SURFACE, EGL_NO_SURFACE, eglContext)) {
+    fail("couldn't make context current");
+  }
+  display = eglDisplay;
+  context = eglContext;
+  std::cout << "Headless EGL " << eglMajor << "." << eglMinor << ", "
+            << eglQueryString(eglDisplay, EGL_VENDOR) << std::endl;
+}
+
+HeadlessContext::~HeadlessContext() {
+  eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+  eglDestroyContext(display, context);
+  eglTerminate(display);
+}
+
+void *HeadlessContext::getProcAddress(const char *name) {
+  return (void *)eglGetProcAddress(name);
+}
+
+#else
+
+HeadlessContext::HeadlessContext(const int majorVersion, const int minorVersion) {
+  std::cerr << "Headless rendering is only supported on Linux" << std::endl;
+  exit(1);
+}
+
+HeadlessContext::~HeadlessContext() {}
+
+void *HeadlessContext::getProcAddress(const char *name) { return nullptr; }
+
+#endif
@@ -0,0 +1,26 @@
+#ifndef SD_HEADLESS_CONTEXT_H_
+#define SD_HEADLESS_CONTEXT_H_
+
+// A core profile GL context with no window, created through EGL on Mesa's
+// surfaceless platform so it works on machines without a display or GPU
+// (llvmpipe). There is no default framebuffer; everything has to be drawn
+// into FBOs. Only available on Linux.
+class HeadlessContext {
+public:
+  // Makes the context current, or prints why it couldn't and exits.
+  HeadlessContext(int majorVersion, int minorVersion);
+  ~HeadlessContext();
+
+  HeadlessContext(const HeadlessContext &) = delete;
+  HeadlessContext &operator=(const HeadlessContext &) = delete;
+
+  // For gladLoadGLLoader.
+  static void *getProcAddress(const char *name);
+
+private:
+  // EGLDisplay and EGLContext, kept opaque so users don't need EGL headers.
+  void *display = nullptr;
+  void *context = nullptr;
+};
+
+#endif // SD_HEADLESS_CONTEXT_H_
@@ -0,0 +1,193 @@
+#include "opengl/light_clusters.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include "opengl/gl_state.h"
+#include "opengl/resource_registry.h"
+
+namespace {
+
+enum Buffer { LIGHTS, GRID, INDICES };
+
+} // namespace
+
+LightClusters::LightClusters(const Settings &settings, const int firstTextureUnit)
+    : settings(settings), firstUnit(firstTextureUnit) {
+  const int numClusters = settings.tilesX * settings.tilesY * settings.slices;
+  lights.reserve(settings.maxLights);
+  extents.reserve(settings.maxLights);
+  grid.assign(2 * numClusters, 0);
+  written.assign(numClusters, 0);
+  indices.assign(settings.maxIndices, 0);
+
+  glGenBuffers(3, buffers);
+  glGenTextures(3, textures);
+  const GLenum formats[3] = {GL_RGBA32F, GL_RG32UI, GL_R16UI};
+  for (int i = 0; i < 3; ++i) {
+    // Texture buffers need storage before they're attached.
+    glstate::bindBuffer(GL_TEXTURE_BUFFER, buffers[i]);
+    glBufferData(GL_TEXTURE_BUFFER, sizeof(Light), NULL, GL_STREAM_DRAW);
+    glstate::bindTexture(firstUnit + i, GL_TEXTURE_BUFFER, textures[i]);
+    glTexBuffer(GL_TEXTURE_BUFFER, formats[i], buffers[i]);
+  }
+  glstate::bindBuffer(GL_TEXTURE_BUFFER, 0);
+  resources::trackCpu(this,
+                      lights.capacity() * sizeof(Light) + extents.capacity() * sizeof(Extent) +
+                      grid.size() * sizeof(unsigned int) + written.size() * sizeof(unsigned int) +
+                      indices.size() * sizeof(unsigned short),
+                      "lights");
+}
+
+LightClusters::~LightClusters() {
+  for (int i = 0; i < 3; ++i) {
+    glstate::deleteBuffer(buffers[i]);
+    resources::untrack(resources::BUFFER, buffers[i]);
+  }
+  glDeleteTextures(3, textures);
+  resources::untrackCpu(this);
+}
+
+void LightClusters::clear() {
+  lights.clear();
+  dropped = 0;
+}
+
+void LightClusters::addLight(const glm::vec3 &worldPos, const glm::vec3 &color,
+                             const float range) {
+  if (lights.size() >= settings.maxLights) {
+    dropped++;
+    return;
+  }
+  lights.push_back({worldPos, range, color, 0.0f});
+}
+
+int LightClusters::sliceOf(const float depth) const {
+  const float slice = std::log(depth / nearPlane) / std::log(farPlane / nearPlane) * settings.slices;
+  return std::min(std::max((int)std::floor(slice), 0), settings.slices - 1);
+}
+
+void LightClusters::build(const glm::mat4 &view, const glm::mat4 &projection) {
+  // As laid out by glm::perspective().
+  nearPlane = projection[3][2] / (projection[2][2] - 1.0f);
+  farPlane = projection[3][2] / (projection[2][2] + 1.0f);
+
+  // Count the lights overlapping each froxel.
+  const int tilesX = settings.tilesX;
+  const int tilesY = settings.tilesY;
+  for (int c = 0; c < written.size(); ++c) {
+    grid[2 * c + 1] = 0;
+    written[c] = 0;
+  }
+  extents.resize(lights.size());
+  for (int i = 0; i < lights.size(); ++i) {
+    const Light &light = lights[i];
+    const float r = light.range;
+    const glm::vec4 centre = view * glm::vec4(light.worldPos, 1.0f);
+    const float depth = -centre.z;
+    Extent &e = extents[i];
+    // Empty unless the light turns out to be on screen.
+    e = {0, -1, 0, -1, 0, -1};
+    if (depth + r < nearPlane || depth - r > farPlane) {
+      continue;
+    }
+    const float nearDepth = std::max(depth - r, nearPlane);
+    const float farDepth = std::min(depth + r, farPlane);
+    // Over the light's view space bounding box, x / depth and y / depth peak
+    // at the corners, so these tile ranges are conservative.
+    const auto tileRange = [&](const float c, const float scale, const int tiles,
+                               int *minTile, int *maxTile) {
+      float lo = FLT_MAX, hi = -FLT_MAX;
+      for (const float v : {c - r, c + r}) {
+        for (const float d : {nearDepth, farDepth}) {
+          lo = std::min(lo, scale * v / d);
+          hi = std::max(hi, scale * v / d);
+        }
+      }
+      if (hi < -1.0f || lo > 1.0f) {
+        return false;
+      }
+      *minTile = std::max((int)std::floor((lo * 0.5f + 0.5f) * tiles), 0);
+      *maxTile = std::min((int)std::floor((hi * 0.5f + 0.5f) * tiles), tiles - 1);
+      return true;
+    };
+    Extent bounds;
+    if (!tileRange(centre.x, projection[0][0], tilesX, &bounds.minX, &bounds.maxX) ||
+        !tileRange(centre.y, projection[1][1], tilesY, &bounds.minY, &bounds.maxY)) {
+      continue;
+    }
+    bounds.minZ = sliceOf(nearDepth);
+    bounds.maxZ = sliceOf(farDepth);
+    e = bounds;
+    for (int z = e.minZ; z <= e.maxZ; ++z) {
+      for (int y = e.minY; y <= e.maxY; ++y) {
+        for (int x = e.minX; x <= e.maxX; ++x) {
+          grid[2 * ((z * tilesY + y) * tilesX + x) + 1]++;
+        }
+      }
+    }
+  }
+
+  // Lay the froxels' lists out back to back, cutting them short where they
+  // would run past maxIndices.
+  unsigned int total = 0;
+  int busiest = 0;
+  for (int c = 0; c < written.size(); ++c) {
+    const unsigned int count = std::min<unsigned int>(grid[2 * c + 1], settings.maxIndices - total);
+    grid[2 * c] = total;
+    grid[2 * c + 1] = count;
+    total += count;
+    busiest = std::max(busiest, (int)count);
+  }
+  for (int i = 0; i < lights.size(); ++i) {
+    const Extent &e = extents[i];
+    for (int z = e.minZ; z <= e.maxZ; ++z) {
+      for (int y = e.minY; y <= e.maxY; ++y) {
+        for (int x = e.minX; x <= e.maxX; ++x) {
+          const int c = (z * tilesY + y) * tilesX + x;
+          if (written[c] < grid[2 * c + 1]) {
+            indices[grid[2 * c] + written[c]++] = i;
+          }
+        }
+      }
+    }
+  }
+
+  upload(buffers[LIGHTS], lights.data(), lights.size() * sizeof(Light));
+  upload(buffers[GRID], grid.data(), grid.size() * sizeof(unsigned int));
+  upload(buffers[INDICES], indices.data(), total * sizeof(unsigned short));
+  glstate::bindBuffer(GL_TEXTURE_BUFFER, 0);
+
+  lastStats.lights = lights.size();
+  lastStats.droppedLights = dropped;
+  lastStats.indices = total;
+  lastStats.busiestCluster = busiest;
+}
+
+void LightClusters::upload(const unsigned int buffer, const void *data, const int bytes) {
+  // Never empty, so the texture always has something to fetch.
+  const int size = std::max(bytes, (int)sizeof(Light));
+  glstate::bindBuffer(GL_TEXTURE_BUFFER, buffer);
+  glBufferData(GL_TEXTURE_BUFFER, size, NULL, GL_STREAM_DRAW);
+  if (bytes > 0) {
+    glBufferSubData(GL_TEXTURE_BUFFER, 0, bytes, data);
+  }
+  resources::track(resources::BUFFER, buffer, size, "lights");
+}
+
+void LightClusters::use(const Shader &shader, const glm::vec2 &renderSize) const {
+  const unsigned int id = shader.id;
+  glUniform1i(glGetUniformLocation(id, "clusterLights"), firstUnit + LIGHTS);
+  glUniform1i(glGetUniformLocation(id, "clusterGrid"), firstUnit + GRID);
+  glUniform1i(glGetUniformLocation(id, "clusterIndices"), firstUnit + INDICES);
+  glUniform3i(glGetUniformLocation(id, "clusterDims"), settings.tilesX, settings.tilesY,
+              settings.slices);
+  glUniform2f(glGetUniformLocation(id, "clusterTileScale"), settings.tilesX / renderSize.x,
+              settings.tilesY / renderSize.y);
+  glUniform2f(glGetUniformLocation(id, "clusterDepthRange"), nearPlane, farPlane);
+  // slice = log(depth) * scale + bias, matching sliceOf().
+  const float scale = settings.slices / std::log(farPlane / nearPlane);
+  glUniform2f(glGetUniformLocation(id, "clusterSliceScaleBias"), scale,
+              -std::log(nearPlane) * scale);
+}
@@ -0,0 +1,89 @@
+#ifndef SD_LIGHT_CLUSTERS_H_
+#define SD_LIGHT_CLUSTERS_H_
+
+#include <glad/glad.h>
+
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "opengl/shader.h"
+
+// Clustered forward point lights. Each frame the lights are binned on the CPU
+// into froxels: screen tiles split into depth slices spaced exponentially
+// between the near and far planes. Fragment shaders find their froxel from
+// gl_FragCoord and loop over only the lights overlapping it, so the cost per
+// pixel follows local light density rather than the total.
+//
+// The lights, each froxel's (first index, count) and the index lists are
+// texture buffers on three consecutive units. See clusteredPointLights() in
+// the fragment shaders for the lookup.
+class LightClusters {
+public:
+  struct Settings {
+    int tilesX = 16;
+    int tilesY = 9;
+    int slices = 24;
+    int maxLights = 1024;
+    // Light references across all froxels. A light that would overflow this
+    // is left out of the froxels that don't fit.
+    int maxIndices = 1 << 16;
+  };
+
+  LightClusters(const Settings &settings, int firstTextureUnit);
+  ~LightClusters();
+  LightClusters(const LightClusters &) = delete;
+  LightClusters &operator=(const LightClusters &) = delete;
+
+  // Starts a new frame's lights.
+  void clear();
+  // The light fades to nothing at range. Lights past maxLights are dropped,
+  // so add the important ones first.
+  void addLight(const glm::vec3 &worldPos, const glm::vec3 &color, float range);
+  // Bins the lights for a perspective camera and uploads the result.
+  void build(const glm::mat4 &view, const glm::mat4 &projection);
+  // Sets the cluster samplers and uniforms on shader, which must be in use.
+  // renderSize is the pixel size the shader is drawing at.
+  void use(const Shader &shader, const glm::vec2 &renderSize) const;
+
+  struct Stats {
+    int lights = 0;
+    int droppedLights = 0;
+    int indices = 0;
+    int busiestCluster = 0;
+  };
+  // For the last build().
+  const Stats &stats() const { return lastStats; }
+
+private:
+  struct Light {
+    glm::vec3 worldPos;
+    float range;
+    glm::vec3 color;
+    float padding;
+  };
+  // Inclusive froxel range a light overlaps.
+  struct Extent {
+    int minX, maxX, minY, maxY, minZ, maxZ;
+  };
+
+  int sliceOf(float depth) const;
+  void upload(unsigned int buffer, const void *data, int bytes);
+
+  const Settings settings;
+  const int firstUnit;
+  std::vector<Light> lights;
+  std::vector<Extent> extents;
+  // (first index, count) per froxel, x fastest then y then slice.
+  std::vector<unsigned int> grid;
+  std::vector<unsigned short> indices;
+  // Lights written so far per froxel while filling indices.
+  std::vector<unsigned int> written;
+  float nearPlane = 0.1f;
+  float farPlane = 1.0f;
+  int dropped = 0;
+  Stats lastStats;
+  unsigned int buffers[3] = {0, 0, 0};
+  unsigned int textures[3] = {0, 0, 0};
+};
+
+#endif // SD_LIGHT_CLUSTERS_H_
@@ -0,0 +1,24 @@
+#include "opengl/lod_selector.h"
+
+#include <cmath>
+
+int LodSelector::select(float projectedPixels, int numLods) const {
+  const float pixels = projectedPixels * exp2f(-bias);
+  int lod = 0;
+  while (lod < thresholds.size() && lod + 1 < numLods && pixels < thresholds[lod]) {
+    lod++;
+  }
+  return lod;
+}
+
+float LodSelector::perspectivePixels(float radius, float distance, float fovY,
+                                     int viewportHeight) {
+  if (distance <= radius) {
+    return viewportHeight;
+  }
+  return radius / (distance * tanf(0.5f * fovY)) * viewportHeight;
+}
+
+float LodSelector::orthographicPixels(float radius, float orthoHeight, int targetHeight) {
+  return 2.0f * radius / orthoHeight * targetHeight;
+}
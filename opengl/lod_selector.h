@@ -0,0 +1,33 @@
+#ifndef SD_LOD_SELECTOR_H_
+#define SD_LOD_SELECTOR_H_
+
+#include <utility>
+#include <vector>
+
+// Picks a level of detail from how many pixels tall a bounding sphere is on
+// screen.
+class LodSelector {
+public:
+  // Level i + 1 is used once the sphere is below thresholds[i] pixels, so
+  // thresholds should be decreasing. bias > 0 picks coarser levels; each unit
+  // halves the apparent size.
+  LodSelector(std::vector<float> thresholds, float bias)
+      : bias(bias), thresholds(std::move(thresholds)) {}
+
+  // Never returns more than numLods - 1.
+  int select(float projectedPixels, int numLods) const;
+
+  // Projected diameter of a sphere at distance from a perspective camera.
+  static float perspectivePixels(float radius, float distance, float fovY,
+                                 int viewportHeight);
+  // Projected diameter under an orthographic projection orthoHeight units
+  // tall, e.g. a shadow map.
+  static float orthographicPixels(float radius, float orthoHeight, int targetHeight);
+
+  float bias;
+
+private:
+  std::vector<float> thresholds;
+};
+
+#endif // SD_LOD_SELECTOR_H_
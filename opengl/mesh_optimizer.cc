@@ -0,0 +1,285 @@
+#include "opengl/mesh_optimizer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+struct VertexBytesHash {
+  size_t operator()(const Vertex &v) const {
+    // FNV-1a over the raw floats; Vertex has no padding.
+    const unsigned char *p = reinterpret_cast<const unsigned char *>(&v);
+    size_t h = 14695981039346656037ull;
+    for (int i = 0; i < sizeof(Vertex); ++i) {
+      h = (h ^ p[i]) * 1099511628211ull;
+    }
+    return h;
+  }
+};
+
+struct VertexBytesEqual {
+  bool operator()(const Vertex &a, const Vertex &b) const {
+    return memcmp(&a, &b, sizeof(Vertex)) == 0;
+  }
+};
+
+// Forsyth's scoring constants. The modelled cache is larger than the FIFO
+// used for reporting since the heuristic only needs to approximate it.
+const int forsythCacheSize = 32;
+const float cacheDecayPower = 1.5f;
+const float lastTriScore = 0.75f;
+const float valenceBoostScale = 2.0f;
+const float valenceBoostPower = 0.5f;
+
+float vertexScore(int cachePosition, int remainingTris) {
+  if (remainingTris == 0) {
+    return -1.0f;
+  }
+  float score = 0.0f;
+  if (cachePosition >= 0) {
+    if (cachePosition < 3) {
+      // The triangle just emitted; using it again doesn't help much.
+      score = lastTriScore;
+    } else {
+      const float scaler = 1.0f / (forsythCacheSize - 3);
+      score = powf(1.0f - (cachePosition - 3) * scaler, cacheDecayPower);
+    }
+  }
+  // Favour vertices with few triangles left so they can drop out of the cache.
+  return score + valenceBoostScale * powf(remainingTris, -valenceBoostPower);
+}
+
+} // namespace
+
+int weldVertices(std::vector<Vertex> *vertices, std::vector<unsigned int> *indices) {
+  std::unordered_map<Vertex, unsigned int, VertexBytesHash, VertexBytesEqual> firstSeen;
+  firstSeen.reserve(vertices->size());
+  std::vector<unsigned int> remap(vertices->size());
+  std::vector<Vertex> unique;
+  unique.reserve(vertices->size());
+  for (int i = 0; i < vertices->size(); ++i) {
+    auto inserted = firstSeen.emplace((*vertices)[i], unique.size());
+    if (inserted.second) {
+      unique.push_back((*vertices)[i]);
+    }
+    remap[i] = inserted.first->second;
+  }
+  for (unsigned int &index : *indices) {
+    index = remap[index];
+  }
+  const int removed = vertices->size() - unique.size();
+  vertices->swap(unique);
+  return removed;
+}
+
+void optimizeVertexCache(std::vector<unsigned int> *indices, int numVertices) {
+  const int numTris = indices->size() / 3;
+  if (numTris == 0) {
+    return;
+  }
+
+  // Triangles using each vertex, as offsets into one flat list.
+  std::vector<int> triStart(numVertices + 1, 0);
+  for (unsigned int index : *indices) {
+    triStart[index + 1]++;
+  }
+  for (int v = 0; v < numVertices; ++v) {
+    triStart[v + 1] += triStart[v];
+  }
+  std::vector<int> vertexTris(indices->size());
+  std::vector<int> fill(triStart.begin(), triStart.end() - 1);
+  for (int t = 0; t < numTris; ++t) {
+    for (int k = 0; k < 3; ++k) {
+      vertexTris[fill[(*indices)[t * 3 + k]]++] = t;
+    }
+  }
+
+  std::vector<int> remaining(numVertices);
+  std::vector<int> cachePosition(numVertices, -1);
+  std::vector<float> score(numVertices);
+  for (int v = 0; v < numVertices; ++v) {
+    remaining[v] = triStart[v + 1] - triStart[v];
+    score[v] = vertexScore(-1, remaining[v]);
+  }
+  std::vector<float> triScore(numTris);
+  std::vector<bool> emitted(numTris, false);
+  for (int t = 0; t < numTris; ++t) {
+    const unsigned int *tri = &(*indices)[t * 3];
+    triScore[t] = score[tri[0]] + score[tri[1]] + score[tri[2]];
+  }
+
+  std::vector<unsigned int> result;
+  result.reserve(indices->size());
+  // Three extra slots hold the vertices pushed out by the newest triangle.
+  std::vector<int> cache;
+  std::vector<int> nextCache;
+  cache.reserve(forsythCacheSize + 3);
+  nextCache.reserve(forsythCacheSize + 3);
+  int bestTri = -1;
+  // Triangles before this have all been emitted; used when the cache offers
+  // no candidate and we have to search.
+  int scanStart = 0;
+
+  for (int emittedCount = 0; emittedCount < numTris; ++emittedCount) {
+    if (bestTri < 0) {
+      float bestScore = -1.0f;
+      while (emitted[scanStart]) {
+        scanStart++;
+      }
+      for (int t = scanStart; t < numTris; ++t) {
+        if (!emitted[t] && triScore[t] > bestScore) {
+          bestScore = triScore[t];
+          bestTri = t;
+        }
+      }
+    }
+
+    emitted[bestTri] = true;
+    const unsigned int *tri = &(*indices)[bestTri * 3];
+    nextCache.clear();
+    for (int k = 0; k < 3; ++k) {
+      const int v = tri[k];
+      result.push_back(v);
+      remaining[v]--;
+      int *begin = &vertexTris[triStart[v]];
+      int *end = begin + remaining[v] + 1;
+      for (int *it = begin; it != end; ++it) {
+        if (*it == bestTri) {
+          // Keep each vertex's live triangles at the front of its list.
+          std::swap(*it, *(end - 1));
+          break;
+        }
+      }
+      if (k == 0 || (v != tri[0] && (k == 1 || v != tri[1]))) {
+        nextCache.push_back(v);
+      }
+    }
+    for (int v : cache) {
+      if (v != tri[0] && v != tri[1] && v != tri[2]) {
+        nextCache.push_back(v);
+      }
+    }
+    for (int v : cache) {
+      cachePosition[v] = -1;
+    }
+    cache.swap(nextCache);
+
+    // Rescore the cached vertices and the triangles that touch them, picking
+    // the best of those as the next triangle.
+    for (int i = 0; i < cache.size(); ++i) {
+      const int v = cache[i];
+      cachePosition[v] = i < forsythCacheSize ? i : -1;
+      score[v] = vertexScore(cachePosition[v], remaining[v]);
+    }
+    bestTri = -1;
+    float bestScore = -1.0f;
+    for (int v : cache) {
+      for (int i = 0; i < remaining[v]; ++i) {
+        const int t = vertexTris[triStart[v] + i];
+        const unsigned int *candidate = &(*indices)[t * 3];
+        triScore[t] = score[candidate[0]] + score[candidate[1]] + score[candidate[2]];
+        if (triScore[t] > bestScore) {
+          bestScore = triScore[t];
+          bestTri = t;
+        }
+      }
+    }
+    if (cache.size() > forsythCacheSize) {
+      cache.resize(forsythCacheSize);
+    }
+  }
+
+  indices->swap(result);
+}
+
+std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int> *indices,
+                                              int numVertices) {
+  const unsigned int unassigned = ~0u;
+  std::vector<unsigned int> oldToNew(numVertices, unassigned);
+  std::vector<unsigned int> newToOld;
+  newToOld.reserve(numVertices);
+  for (unsigned int &index : *indices) {
+    if (oldToNew[index] == unassigned) {
+      oldToNew[index] = newToOld.size();
+      newToOld.push_back(index);
+    }
+    index = oldToNew[index];
+  }
+  // Vertices no triangle uses are dropped.
+  return newToOld;
+}
+
+std::vector<Vertex> remapVertices(const std::vector<Vertex> &vertices,
+                                  const std::vector<unsigned int> &newToOld) {
+  std::vector<Vertex> result;
+  remapVertices(vertices.data(), newToOld, &result);
+  return result;
+}
+
+void remapVertices(const Vertex *vertices, const std::vector<unsigned int> &newToOld,
+                   std::vector<Vertex> *result) {
+  result->resize(newToOld.size());
+  for (size_t i = 0; i < newToOld.size(); ++i) {
+    (*result)[i] = vertices[newToOld[i]];
+  }
+}
+
+float vertexCacheMissRatio(const std::vector<unsigned int> &indices, int cacheSize) {
+  if (indices.size() < 3) {
+    return 0.0f;
+  }
+  // FIFO as a ring of the most recent misses.
+  std::vector<unsigned int> fifo(cacheSize, ~0u);
+  int head = 0;
+  int misses = 0;
+  for (unsigned int index : indices) {
+    bool hit = false;
+    for (unsigned int cached : fifo) {
+      if (cached == index) {
+        hit = true;
+        break;
+      }
+    }
+    if (!hit) {
+      fifo[head] = index;
+      head = (head + 1) % cacheSize;
+      misses++;
+    }
+  }
+  return misses / (float)(indices.size() / 3);
+}
+
+std::vector<unsigned int> optimizeMeshOrder(std::vector<unsigned int> *indices,
+                                            int numVertices) {
+  const float before = vertexCacheMissRatio(*indices);
+  optimizeVertexCache(indices, numVertices);
+  std::vector<unsigned int> newToOld = optimizeVertexFetch(indices, numVertices);
+  std::cout << "  ACMR " << before << " -> " << vertexCacheMissRatio(*indices)
+            << " over " << indices->size() / 3 << " triangles" << std::endl;
+  return newToOld;
+}
+
+std::vector<unsigned int> optimizeMeshOrder(std::vector<std::vector<unsigned int>> *lods,
+                                            int numVertices) {
+  std::vector<unsigned int> all;
+  for (int level = 0; level < lods->size(); ++level) {
+    std::vector<unsigned int> &indices = (*lods)[level];
+    const float before = vertexCacheMissRatio(indices);
+    optimizeVertexCache(&indices, numVertices);
+    std::cout << "  LOD " << level << " ACMR " << before << " -> "
+              << vertexCacheMissRatio(indices) << " over " << indices.size() / 3
+              << " triangles" << std::endl;
+    all.insert(all.end(), indices.begin(), indices.end());
+  }
+  // Coarser levels only use vertices LOD 0 does, so LOD 0 decides the order.
+  std::vector<unsigned int> newToOld = optimizeVertexFetch(&all, numVertices);
+  int offset = 0;
+  for (std::vector<unsigned int> &indices : *lods) {
+    std::copy(all.begin() + offset, all.begin() + offset + indices.size(), indices.begin());
+    offset += indices.size();
+  }
+  return newToOld;
+}
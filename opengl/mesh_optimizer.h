@@ -0,0 +1,44 @@
+#ifndef SD_MESH_OPTIMIZER_H_
+#define SD_MESH_OPTIMIZER_H_
+
+#include <vector>
+
+#include "opengl/vertex.h"
+
+// Load-time clean up of indexed triangle lists, run in this order:
+// weldVertices, optimizeVertexCache, optimizeVertexFetch.
+
+// Merges vertices with identical attributes and rewrites indices to match.
+// Returns the number of vertices removed.
+int weldVertices(std::vector<Vertex> *vertices, std::vector<unsigned int> *indices);
+
+// Reorders triangles so that vertices are reused while still in the
+// post-transform cache (Forsyth's linear-speed algorithm).
+void optimizeVertexCache(std::vector<unsigned int> *indices, int numVertices);
+
+// Renumbers vertices in order of first use so fetches walk memory forwards.
+// Returns, for each new vertex index, the old index it came from; apply it to
+// the vertex data with remapVertices.
+std::vector<unsigned int> optimizeVertexFetch(std::vector<unsigned int> *indices,
+                                              int numVertices);
+std::vector<Vertex> remapVertices(const std::vector<Vertex> &vertices,
+                                  const std::vector<unsigned int> &newToOld);
+// The same into *result, reusing its storage.
+void remapVertices(const Vertex *vertices, const std::vector<unsigned int> &newToOld,
+                   std::vector<Vertex> *result);
+
+// optimizeVertexCache then optimizeVertexFetch, printing the cache miss
+// ratio before and after. Returns the new-to-old vertex order.
+std::vector<unsigned int> optimizeMeshOrder(std::vector<unsigned int> *indices,
+                                            int numVertices);
+// The same for a LOD chain indexing one vertex buffer. Each level gets its own
+// triangle order; the vertex order follows LOD 0.
+std::vector<unsigned int> optimizeMeshOrder(std::vector<std::vector<unsigned int>> *lods,
+                                            int numVertices);
+
+// Average cache miss ratio: vertices transformed per triangle with a FIFO
+// post-transform cache of the given size. 0.5 is ideal for a regular grid,
+// 3 means no reuse at all.
+float vertexCacheMissRatio(const std::vector<unsigned int> &indices, int cacheSize = 16);
+
+#endif // SD_MESH_OPTIMIZER_H_
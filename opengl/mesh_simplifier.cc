@@ -0,0 +1,241 @@
+#include "opengl/mesh_simplifier.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <iostream>
+#include <unordered_map>
+
+namespace {
+
+// Sum of squared distances to a set of planes, as the 10 distinct terms of
+// the symmetric 4x4 matrix.
+struct Quadric {
+  double a2 = 0, ab = 0, ac = 0, ad = 0, b2 = 0, bc = 0, bd = 0, c2 = 0, cd = 0, d2 = 0;
+
+  void addPlane(double a, double b, double c, double d) {
+    a2 += a * a; ab += a * b; ac += a * c; ad += a * d;
+    b2 += b * b; bc += b * c; bd += b * d;
+    c2 += c * c; cd += c * d;
+    d2 += d * d;
+  }
+
+  void add(const Quadric &q) {
+    a2 += q.a2; ab += q.ab; ac += q.ac; ad += q.ad;
+    b2 += q.b2; bc += q.bc; bd += q.bd;
+    c2 += q.c2; cd += q.cd;
+    d2 += q.d2;
+  }
+
+  double error(const glm::vec3 &p) const {
+    const double x = p.x, y = p.y, z = p.z;
+    const double e = a2 * x * x + b2 * y * y + c2 * z * z +
+                     2 * (ab * x * y + ac * x * z + bc * y * z) +
+                     2 * (ad * x + bd * y + cd * z) + d2;
+    return std::max(e, 0.0);
+  }
+};
+
+struct Collapse {
+  unsigned int from;
+  unsigned int to;
+  double cost;
+};
+
+glm::vec3 triangleNormal(const glm::vec3 &p0, const glm::vec3 &p1, const glm::vec3 &p2) {
+  const glm::vec3 e1 = p1 - p0;
+  const glm::vec3 e2 = p2 - p0;
+  return glm::vec3(e1.y * e2.z - e1.z * e2.y, e1.z * e2.x - e1.x * e2.z,
+                   e1.x * e2.y - e1.y * e2.x);
+}
+
+uint64_t edgeKey(unsigned int a, unsigned int b) {
+  return a < b ? ((uint64_t)a << 32) | b : ((uint64_t)b << 32) | a;
+}
+
+bool isDegenerate(const unsigned int *tri) {
+  return tri[0] == tri[1] || tri[1] == tri[2] || tri[0] == tri[2];
+}
+
+} // namespace
+
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices,
+                                       const std::vector<unsigned int> &indices,
+                                       int targetIndexCount, float *error) {
+  const int numVertices = vertices.size();
+  std::vector<unsigned int> result = indices;
+  std::vector<Quadric> quadrics(numVertices);
+  std::unordered_map<uint64_t, int> edgeUses;
+  for (int i = 0; i + 2 < result.size(); i += 3) {
+    const unsigned int *tri = &result[i];
+    const glm::vec3 n = triangleNormal(vertices[tri[0]].position, vertices[tri[1]].position,
+                                       vertices[tri[2]].position);
+    const float length = glm::length(n);
+    if (length > 0.0f) {
+      const glm::vec3 unit = (1.0f / length) * n;
+      const double d = -glm::dot(unit, vertices[tri[0]].position);
+      for (int k = 0; k < 3; ++k) {
+        quadrics[tri[k]].addPlane(unit.x, unit.y, unit.z, d);
+      }
+    }
+    for (int k = 0; k < 3; ++k) {
+      edgeUses[edgeKey(tri[k], tri[(k + 1) % 3])]++;
+    }
+  }
+  // Edges with one triangle are borders, or UV/normal seams since welding
+  // only merges identical vertices. Collapsing along them would tear holes.
+  std::vector<bool> locked(numVertices, false);
+  for (const auto &edge : edgeUses) {
+    if (edge.second == 1) {
+      locked[edge.first >> 32] = true;
+      locked[edge.first & 0xffffffff] = true;
+    }
+  }
+
+  double maxError = 0.0;
+  std::vector<uint64_t> edges;
+  std::vector<Collapse> candidates;
+  std::vector<int> triStart(numVertices + 1);
+  std::vector<int> vertexTris;
+  std::vector<bool> touched(numVertices);
+  while (result.size() > targetIndexCount) {
+    edges.clear();
+    for (int i = 0; i < result.size(); ++i) {
+      const int triBase = i - i % 3;
+      edges.push_back(edgeKey(result[i], result[triBase + (i + 1 - triBase) % 3]));
+    }
+    std::sort(edges.begin(), edges.end());
+    edges.erase(std::unique(edges.begin(), edges.end()), edges.end());
+
+    candidates.clear();
+    for (uint64_t edge : edges) {
+      const unsigned int a = edge >> 32;
+      const unsigned int b = edge & 0xffffffff;
+      Quadric q = quadrics[a];
+      q.add(quadrics[b]);
+      Collapse c;
+      c.cost = -1.0;
+      if (!locked[a]) {
+        c = {a, b, q.error(vertices[b].position)};
+      }
+      if (!locked[b]) {
+        const double cost = q.error(vertices[a].position);
+        if (c.cost < 0.0 || cost < c.cost) {
+          c = {b, a, cost};
+        }
+      }
+      if (c.cost >= 0.0) {
+        candidates.push_back(c);
+      }
+    }
+    if (candidates.empty()) {
+      break;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+              [](const Collapse &x, const Collapse &y) { return x.cost < y.cost; });
+
+    std::fill(triStart.begin(), triStart.end(), 0);
+    for (unsigned int index : result) {
+      triStart[index + 1]++;
+    }
+    for (int v = 0; v < numVertices; ++v) {
+      triStart[v + 1] += triStart[v];
+    }
+    vertexTris.resize(result.size());
+    std::vector<int> fill(triStart.begin(), triStart.end() - 1);
+    for (int i = 0; i < result.size(); ++i) {
+      vertexTris[fill[result[i]]++] = i / 3;
+    }
+
+    // Each pass collapses greedily from the cheapest edge, touching each
+    // vertex at most once, until enough triangles are gone.
+    const int trisToRemove = (result.size() - targetIndexCount) / 3;
+    int removed = 0;
+    int collapses = 0;
+    std::fill(touched.begin(), touched.end(), false);
+    for (const Collapse &c : candidates) {
+      if (removed >= trisToRemove) {
+        break;
+      }
+      if (touched[c.from] || touched[c.to]) {
+        continue;
+      }
+      // Reject collapses that would turn a triangle over.
+      bool flips = false;
+      int collapsing = 0;
+      for (int i = triStart[c.from]; i < triStart[c.from + 1] && !flips; ++i) {
+        const unsigned int *tri = &result[vertexTris[i] * 3];
+        if (isDegenerate(tri)) {
+          continue;
+        }
+        if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) {
+          collapsing++;
+          continue;
+        }
+        glm::vec3 p[3];
+        for (int k = 0; k < 3; ++k) {
+          p[k] = vertices[tri[k]].position;
+        }
+        const glm::vec3 before = triangleNormal(p[0], p[1], p[2]);
+        for (int k = 0; k < 3; ++k) {
+          if (tri[k] == c.from) {
+            p[k] = vertices[c.to].position;
+          }
+        }
+        const glm::vec3 after = triangleNormal(p[0], p[1], p[2]);
+        flips = glm::dot(before, after) <= 0.0f;
+      }
+      if (flips) {
+        continue;
+      }
+      for (int i = triStart[c.from]; i < triStart[c.from + 1]; ++i) {
+        unsigned int *tri = &result[vertexTris[i] * 3];
+        for (int k = 0; k < 3; ++k) {
+          if (tri[k] == c.from) {
+            tri[k] = c.to;
+          }
+        }
+      }
+      quadrics[c.to].add(quadrics[c.from]);
+      touched[c.from] = true;
+      touched[c.to] = true;
+      maxError = std::max(maxError, c.cost);
+      removed += collapsing;
+      collapses++;
+    }
+    if (collapses == 0) {
+      break;
+    }
+
+    int kept = 0;
+    for (int i = 0; i < result.size(); i += 3) {
+      if (!isDegenerate(&result[i])) {
+        for (int k = 0; k < 3; ++k) {
+          result[kept++] = result[i + k];
+        }
+      }
+    }
+    result.resize(kept);
+  }
+  *error = sqrt(maxError);
+  return result;
+}
+
+std::vector<std::vector<unsigned int>> buildLodChain(
+    const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices,
+    int maxLods) {
+  std::vector<std::vector<unsigned int>> lods = {indices};
+  for (int level = 1; level < maxLods; ++level) {
+    // Always simplify from the full mesh so errors don't compound.
+    const int target = (indices.size() / 3 >> level) * 3;
+    float error;
+    std::vector<unsigned int> lod = simplifyMesh(vertices, indices, target, &error);
+    if (lod.size() > lods.back().size() * 0.8f) {
+      break;
+    }
+    std::cout << "  LOD " << level << ": " << lod.size() / 3 << " triangles, error "
+              << error << std::endl;
+    lods.push_back(std::move(lod));
+  }
+  return lods;
+}
@@ -0,0 +1,24 @@
+#ifndef SD_MESH_SIMPLIFIER_H_
+#define SD_MESH_SIMPLIFIER_H_
+
+#include <vector>
+
+#include "opengl/vertex.h"
+
+// Reduces a triangle list towards targetIndexCount by collapsing edges in
+// order of quadric error (Garland & Heckbert). Vertices are only moved onto
+// each other, so the result indexes the same vertex buffer. Open and seam
+// edges are kept in place. error is set to the largest collapse error, as a
+// distance in model units.
+std::vector<unsigned int> simplifyMesh(const std::vector<Vertex> &vertices,
+                                       const std::vector<unsigned int> &indices,
+                                       int targetIndexCount, float *error);
+
+// Index lists for LOD 0 (indices itself) and up to maxLods - 1 coarser levels,
+// each aiming for half the triangles of the one before. Stops early once a
+// level would barely shrink.
+std::vector<std::vector<unsigned int>> buildLodChain(
+    const std::vector<Vertex> &vertices, const std::vector<unsigned int> &indices,
+    int maxLods);
+
+#endif // SD_MESH_SIMPLIFIER_H_
@@ -0,0 +1,232 @@
+#include "opengl/packed_vertex.h"
+
+#include <glad/glad.h>
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+
+namespace {
+
+unsigned short floatToHalf(float f) {
+  unsigned int bits;
+  memcpy(&bits, &f, sizeof(bits));
+  const unsigned int sign = (bits >> 16) & 0x8000;
+  const int exponent = ((bits >> 23) & 0xff) - 127 + 15;
+  unsigned int mantissa = bits & 0x7fffff;
+  if (((bits >> 23) & 0xff) == 0xff) {
+    return sign | 0x7c00 | (mantissa ? 0x200 : 0);
+  }
+  if (exponent >= 31) {
+    return sign | 0x7c00;
+  }
+  if (exponent <= 0) {
+    // Subnormal half, or zero if too small even for that.
+    if (exponent < -10) {
+      return sign;
+    }
+    mantissa |= 0x800000;
+    const int shift = 14 - exponent;
+    unsigned int half = mantissa >> shift;
+    const unsigned int rest = mantissa & ((1u << shift) - 1);
+    const unsigned int halfway = 1u << (shift - 1);
+    if (rest > halfway || (rest == halfway && (half & 1))) {
+      half++;
+    }
+    return sign | half;
+  }
+  unsigned int half = sign | (exponent << 10) | (mantissa >> 13);
+  const unsigned int rest = mantissa & 0x1fff;
+  // Round to nearest even; a carry into the exponent is still correct.
+  if (rest > 0x1000 || (rest == 0x1000 && (half & 1))) {
+    half++;
+  }
+  return half;
+}
+
+float halfToFloat(unsigned short h) {
+  const unsigned int sign = (h & 0x8000) << 16;
+  const int exponent = (h >> 10) & 0x1f;
+  const unsigned int mantissa = h & 0x3ff;
+  if (exponent == 0) {
+    const float f = ldexpf(mantissa, -24);
+    return sign ? -f : f;
+  }
+  unsigned int bits;
+  if (exponent == 31) {
+    bits = sign | 0x7f800000 | (mantissa << 13);
+  } else {
+    bits = sign | ((exponent - 15 + 127) << 23) | (mantissa << 13);
+  }
+  float f;
+  memcpy(&f, &bits, sizeof(f));
+  return f;
+}
+
+unsigned short toUnorm16(float v) {
+  return (unsigned short)lroundf(std::min(std::max(v, 0.0f), 1.0f) * 65535.0f);
+}
+
+short toSnorm16(float v) {
+  return (short)lroundf(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f);
+}
+
+float signNotZero(float v) { return v >= 0.0f ? 1.0f : -1.0f; }
+
+// Projects the unit sphere onto an octahedron, then unfolds the lower half
+// over the corners of the square.
+void encodeOctahedral(const glm::vec3 &n, float *x, float *y) {
+  const float l1 = std::abs(n.x) + std::abs(n.y) + std::abs(n.z);
+  float px = l1 > 0.0f ? n.x / l1 : 0.0f;
+  float py = l1 > 0.0f ? n.y / l1 : 0.0f;
+  if (n.z < 0.0f) {
+    const float fx = (1.0f - std::abs(py)) * signNotZero(px);
+    const float fy = (1.0f - std::abs(px)) * signNotZero(py);
+    px = fx;
+    py = fy;
+  }
+  *x = px;
+  *y = py;
+}
+
+// Same as decodeNormal() in the vertex shaders.
+glm::vec3 decodeOctahedral(float x, float y) {
+  glm::vec3 n(x, y, 1.0f - std::abs(x) - std::abs(y));
+  const float t = std::max(-n.z, 0.0f);
+  n.x += n.x >= 0.0f ? -t : t;
+  n.y += n.y >= 0.0f ? -t : t;
+  return glm::normalize(n);
+}
+
+float axisScale(const PositionBounds &bounds, int axis) {
+  return bounds.max[axis] - bounds.min[axis];
+}
+
+} // namespace
+
+void PositionBounds::include(const std::vector<Vertex> &vertices) {
+  for (const Vertex &v : vertices) {
+    min = glm::min(min, v.position);
+    max = glm::max(max, v.position);
+  }
+}
+
+void PositionBounds::expandForAnimation() {
+  const glm::vec3 centre = 0.5f * (min + max);
+  const float radius = 0.5f * glm::length(max - min);
+  // A point within radius of the centre, turned about a pivot that is also
+  // within radius, ends up within 3 * radius.
+  min = centre - glm::vec3(3.0f * radius);
+  max = centre + glm::vec3(3.0f * radius);
+}
+
+void packPosition(const glm::vec3 &position, const PositionBounds &bounds,
+                  unsigned short out[4]) {
+  for (int axis = 0; axis < 3; ++axis) {
+    const float scale = axisScale(bounds, axis);
+    // Out of bounds positions, e.g. from skinning, are clamped.
+    out[axis] = toUnorm16(
+        scale > 0.0f ? (position[axis] - bounds.min[axis]) / scale : 0.0f);
+  }
+  out[3] = 0;
+}
+
+void packNormal(const glm::vec3 &normal, short out[2]) {
+  float nx, ny;
+  encodeOctahedral(normal, &nx, &ny);
+  out[0] = toSnorm16(nx);
+  out[1] = toSnorm16(ny);
+}
+
+void packTexCoords(const glm::vec2 &texCoords, unsigned short out[2]) {
+  out[0] = floatToHalf(texCoords.x);
+  out[1] = floatToHalf(texCoords.y);
+}
+
+PackedVertex packVertex(const Vertex &v, const PositionBounds &bounds) {
+  PackedVertex p;
+  packPosition(v.position, bounds, p.position);
+  packNormal(v.normal, p.normal);
+  packTexCoords(v.texCoords, p.texCoords);
+  return p;
+}
+
+Vertex unpackVertex(const PackedVertex &p, const PositionBounds &bounds) {
+  Vertex v;
+  for (int axis = 0; axis < 3; ++axis) {
+    v.position[axis] =
+        bounds.min[axis] + axisScale(bounds, axis) * (p.position[axis] / 65535.0f);
+  }
+  v.normal = decodeOctahedral(std::max(p.normal[0] / 32767.0f, -1.0f),
+                              std::max(p.normal[1] / 32767.0f, -1.0f));
+  v.texCoords = glm::vec2(halfToFloat(p.texCoords[0]), halfToFloat(p.texCoords[1]));
+  return v;
+}
+
+void packVertices(const std::vector<Vertex> &vertices, const PositionBounds &bounds,
+                  std::vector<PackedVertex> *out) {
+  out->resize(vertices.size());
+  for (int i = 0; i < vertices.size(); ++i) {
+    (*out)[i] = packVertex(vertices[i], bounds);
+  }
+}
+
+void checkPackingPrecision(const std::vector<Vertex> &vertices,
+                           const PositionBounds &bounds) {
+  float positionError = 0.0f;
+  float positionTolerance = 0.0f;
+  float normalError = 0.0f;
+  float texCoordError = 0.0f;
+  for (int axis = 0; axis < 3; ++axis) {
+    // Half a quantisation step, plus float rounding in the decode.
+    positionTolerance = std::max(positionTolerance,
+                                 0.5f * axisScale(bounds, axis) / 65535.0f * 1.01f);
+  }
+  bool texCoordsOk = true;
+  for (const Vertex &v : vertices) {
+    const Vertex u = unpackVertex(packVertex(v, bounds), bounds);
+    for (int axis = 0; axis < 3; ++axis) {
+      positionError = std::max(positionError, std::abs(u.position[axis] - v.position[axis]));
+    }
+    const float n = glm::length(v.normal);
+    if (n > 0.0f) {
+      // Chord length rather than acos(dot), which is too coarse near 0.
+      const float chord = std::min(1.0f, glm::length(u.normal - (1.0f / n) * v.normal));
+      normalError = std::max(normalError, 2.0f * asinf(0.5f * chord));
+    }
+    for (int k = 0; k < 2; ++k) {
+      const float error = std::abs(u.texCoords[k] - v.texCoords[k]);
+      texCoordError = std::max(texCoordError, error);
+      // Half floats keep 11 significant bits.
+      if (error > std::max(std::abs(v.texCoords[k]), 1.0f / 16384.0f) / 2048.0f) {
+        texCoordsOk = false;
+      }
+    }
+  }
+  const float normalErrorDegrees = normalError * 180.0f / 3.14159265f;
+  std::cout << "  packed vertex error: position " << positionError << " (step "
+            << 2.0f * positionTolerance / 1.01f << "), normal " << normalErrorDegrees
+            << " degrees, tex coord " << texCoordError << std::endl;
+  if (positionError > positionTolerance + 1e-6f || normalErrorDegrees > 0.01f ||
+      !texCoordsOk) {
+    std::cerr << "Packed vertices lost more precision than expected" << std::endl;
+  }
+}
+
+void setupPackedVertexAttributes() {
+  glVertexAttribPointer(0, 3, GL_UNSIGNED_SHORT, GL_TRUE, sizeof(PackedVertex),
+                        (void *)offsetof(PackedVertex, position));
+  glEnableVertexAttribArray(0);
+  glVertexAttribPointer(1, 2, GL_SHORT, GL_TRUE, sizeof(PackedVertex),
+                        (void *)offsetof(PackedVertex, normal));
+  glEnableVertexAttribArray(1);
+  glVertexAttribPointer(2, 2, GL_HALF_FLOAT, GL_FALSE, sizeof(PackedVertex),
+                        (void *)offsetof(PackedVertex, texCoords));
+  glEnableVertexAttribArray(2);
+}
+
+void usePositionBounds(const Shader &shader, const PositionBounds &bounds) {
+  shader.setVec3("positionOffset", bounds.min);
+  shader.setVec3("positionScale", bounds.max - bounds.min);
+}
@@ -0,0 +1,57 @@
+#ifndef SD_PACKED_VERTEX_H_
+#define SD_PACKED_VERTEX_H_
+
+#include <cfloat>
+#include <vector>
+
+#include "glm/glm.hpp"
+#include "opengl/shader.h"
+#include "opengl/vertex.h"
+
+// Box that packed positions are quantised within. Shaders decode with
+// positionOffset + positionScale * inPos, see usePositionBounds().
+struct PositionBounds {
+  glm::vec3 min = glm::vec3(FLT_MAX);
+  glm::vec3 max = glm::vec3(-FLT_MAX);
+
+  void include(const std::vector<Vertex> &vertices);
+  // Of the sphere around the box.
+  float radius() const { return 0.5f * glm::length(max - min); }
+  // Turns tight bounds into a cube around their centre that any rigid motion
+  // of the contents about a point inside them stays within, for meshes
+  // skinned after packing.
+  void expandForAnimation();
+};
+
+// Half the size of Vertex:
+// - position: unorm16 within a PositionBounds, w unused
+// - normal: octahedral, 2x snorm16
+// - texCoords: half float
+struct PackedVertex {
+  unsigned short position[4];
+  short normal[2];
+  unsigned short texCoords[2];
+};
+
+PackedVertex packVertex(const Vertex &v, const PositionBounds &bounds);
+// The parts of packVertex(), for callers that produce attributes separately.
+void packPosition(const glm::vec3 &position, const PositionBounds &bounds,
+                  unsigned short out[4]);
+// Needn't be unit length.
+void packNormal(const glm::vec3 &normal, short out[2]);
+void packTexCoords(const glm::vec2 &texCoords, unsigned short out[2]);
+Vertex unpackVertex(const PackedVertex &v, const PositionBounds &bounds);
+void packVertices(const std::vector<Vertex> &vertices, const PositionBounds &bounds,
+                  std::vector<PackedVertex> *out);
+
+// Compares the packed form against the float vertices and prints the worst
+// errors, warning if they exceed what the format should give.
+void checkPackingPrecision(const std::vector<Vertex> &vertices,
+                           const PositionBounds &bounds);
+
+// Attribute pointers 0-2 for PackedVertex in the bound VAO and array buffer.
+void setupPackedVertexAttributes();
+// Sets the decode uniforms on shader, which must be in use.
+void usePositionBounds(const Shader &shader, const PositionBounds &bounds);
+
+#endif // SD_PACKED_VERTEX_H_
@@ -0,0 +1,99 @@
+#include "opengl/packed_vertex.h"
+
+#include <algorithm>
+#include <cmath>
+#include <iostream>
+#include <random>
+
+// Packs random vertices and checks each attribute comes back within what its
+// format can hold. Returns non-zero on the first failure.
+
+namespace {
+
+const int numVertices = 100000;
+
+int failures = 0;
+
+void expectWithin(const char *what, int vertex, float error, float bound) {
+  if (!(error <= bound)) {
+    std::cerr << "Vertex " << vertex << ": " << what << " error " << error
+              << " exceeds " << bound << std::endl;
+    failures++;
+  }
+}
+
+// Angle between two directions, via the chord so it stays accurate near 0.
+float angleBetween(const glm::vec3 &a, const glm::vec3 &b) {
+  const float chord = std::min(
+      2.0f, glm::length(glm::normalize(a) - glm::normalize(b)));
+  return 2.0f * asinf(0.5f * chord);
+}
+
+} // namespace
+
+int main() {
+  std::mt19937 rng(1234);
+  std::uniform_real_distribution<float> unit(-1.0f, 1.0f);
+  std::uniform_real_distribution<float> positions(-50.0f, 50.0f);
+  std::uniform_real_distribution<float> uvs(0.0f, 4.0f);
+
+  std::vector<Vertex> vertices(numVertices);
+  for (Vertex &v : vertices) {
+    v.position = glm::vec3(positions(rng), positions(rng), positions(rng));
+    do {
+      v.normal = glm::vec3(unit(rng), unit(rng), unit(rng));
+    } while (glm::length(v.normal) < 1e-3f);
+    v.texCoords = glm::vec2(uvs(rng), uvs(rng));
+  }
+  // The axis directions sit on the octahedron's folds.
+  const glm::vec3 axes[] = {
+      glm::vec3(1, 0, 0), glm::vec3(-1, 0, 0), glm::vec3(0, 1, 0),
+      glm::vec3(0, -1, 0), glm::vec3(0, 0, 1), glm::vec3(0, 0, -1)};
+  for (int i = 0; i < 6; ++i) {
+    vertices[i].normal = axes[i];
+  }
+  vertices[6].texCoords = glm::vec2(0.0f, 1.0f / 65536.0f);
+
+  PositionBounds bounds;
+  bounds.include(vertices);
+  // Half a unorm16 step per axis, plus float rounding in the decode.
+  glm::vec3 positionBound;
+  for (int axis = 0; axis < 3; ++axis) {
+    positionBound[axis] =
+        0.5f * (bounds.max[axis] - bounds.min[axis]) / 65535.0f * 1.01f + 1e-6f;
+  }
+  // snorm16 octahedral normals are good to a few thousandths of a degree.
+  const float normalBound = 0.01f * 3.14159265f / 180.0f;
+
+  for (int i = 0; i < numVertices; ++i) {
+    const Vertex &v = vertices[i];
+    const Vertex u = unpackVertex(packVertex(v, bounds), bounds);
+    for (int axis = 0; axis < 3; ++axis) {
+      expectWithin("position", i, std::abs(u.position[axis] - v.position[axis]),
+                   positionBound[axis]);
+    }
+    expectWithin("normal length", i, std::abs(glm::length(u.normal) - 1.0f), 1e-5f);
+    expectWithin("normal angle", i, angleBetween(u.normal, v.normal), normalBound);
+    for (int k = 0; k < 2; ++k) {
+      // Half floats keep 11 significant bits, and are subnormal below 2^-14.
+      expectWithin("tex coord", i, std::abs(u.texCoords[k] - v.texCoords[k]),
+                   std::max(std::abs(v.texCoords[k]), 1.0f / 16384.0f) / 2048.0f);
+    }
+    if (failures > 0) {
+      return 1;
+    }
+  }
+
+  // Positions outside the bounds, e.g. from skinning, clamp to the box.
+  unsigned short packed[4];
+  packPosition(bounds.max + glm::vec3(10.0f), bounds, packed);
+  for (int axis = 0; axis < 3; ++axis) {
+    if (packed[axis] != 65535) {
+      std::cerr << "Out of bounds position didn't clamp on axis " << axis << std::endl;
+      return 1;
+    }
+  }
+
+  std::cout << "Packed " << numVertices << " vertices within bounds" << std::endl;
+  return 0;
+}
@@ -0,0 +1,276 @@
+#include "opengl/program_cache.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+
+#ifdef _WIN32
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#endif
+
+#include "opengl/gl_state.h"
+
+// Not in the GL 3.3 core headers. Program binaries are core in 4.1 and
+// ARB_get_program_binary; the completion status query is
+// KHR/ARB_parallel_shader_compile.
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+#ifndef GL_COMPLETION_STATUS_KHR
+#define GL_COMPLETION_STATUS_KHR 0x91B1
+#endif
+
+namespace {
+
+typedef void (APIENTRYP PFNGETPROGRAMBINARYPROC)(GLuint program, GLsizei bufSize, GLsizei *length, GLenum *binaryFormat, void *binary);
+typedef void (APIENTRYP PFNPROGRAMBINARYPROC)(GLuint program, GLenum binaryFormat, const void *binary, GLsizei length);
+typedef void (APIENTRYP PFNPROGRAMPARAMETERIPROC)(GLuint program, GLenum pname, GLint value);
+typedef void (APIENTRYP PFNMAXSHADERCOMPILERTHREADSPROC)(GLuint count);
+
+PFNGETPROGRAMBINARYPROC getProgramBinary = nullptr;
+PFNPROGRAMBINARYPROC programBinary = nullptr;
+PFNPROGRAMPARAMETERIPROC programParameteri = nullptr;
+PFNMAXSHADERCOMPILERTHREADSPROC maxShaderCompilerThreads = nullptr;
+
+bool hasExtension(const char *name) {
+  int numExtensions = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &numExtensions);
+  for (int i = 0; i < numExtensions; ++i) {
+    const char *ext = (const char *)glGetStringi(GL_EXTENSIONS, i);
+    if (ext && std::strcmp(ext, name) == 0) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// FNV-1a
+uint64_t hashString(uint64_t h, const std::string &s) {
+  for (const char c : s) {
+    h ^= (unsigned char)c;
+    h *= 1099511628211ull;
+  }
+  // Separator so that ("ab", "c") and ("a", "bc") differ.
+  h ^= 0xff;
+  h *= 1099511628211ull;
+  return h;
+}
+
+unsigned int compileShader(GLenum type, const std::string &source) {
+  const char *code = source.c_str();
+  const unsigned int shader = glCreateShader(type);
+  glShaderSource(shader, 1, &code, NULL);
+  glCompileShader(shader);
+  return shader;
+}
+
+} // namespace
+
+ProgramCache::ProgramCache(GLADloadproc loadProc, std::string _cacheDir)
+    : cacheDir(std::move(_cacheDir)) {
+  int major = 0;
+  int minor = 0;
+  glGetIntegerv(GL_MAJOR_VERSION, &major);
+  glGetIntegerv(GL_MINOR_VERSION, &minor);
+  const bool isGl41 = major > 4 || (major == 4 && minor >= 1);
+  if (isGl41 || hasExtension("GL_ARB_get_program_binary")) {
+    getProgramBinary = (PFNGETPROGRAMBINARYPROC)loadProc("glGetProgramBinary");
+    programBinary = (PFNPROGRAMBINARYPROC)loadProc("glProgramBinary");
+    programParameteri = (PFNPROGRAMPARAMETERIPROC)loadProc("glProgramParameteri");
+    int numFormats = 0;
+    glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+    binariesSupported = getProgramBinary && programBinary && programParameteri && numFormats > 0;
+  }
+  if (hasExtension("GL_KHR_parallel_shader_compile")) {
+    maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSPROC)loadProc("glMaxShaderCompilerThreadsKHR");
+  } else if (hasExtension("GL_ARB_parallel_shader_compile")) {
+    maxShaderCompilerThreads = (PFNMAXSHADERCOMPILERTHREADSPROC)loadProc("glMaxShaderCompilerThreadsARB");
+  }
+  parallelCompileSupported = maxShaderCompilerThreads != nullptr;
+  if (parallelCompileSupported) {
+    // Let the driver pick the thread count.
+    maxShaderCompilerThreads(0xFFFFFFFFu);
+  }
+
+  driverString = std::string((const char *)glGetString(GL_VENDOR)) + "|" +
+                 (const char *)glGetString(GL_RENDERER) + "|" +
+                 (const char *)glGetString(GL_VERSION);
+
+  if (binariesSupported) {
+#ifdef _WIN32
+    _mkdir(cacheDir.c_str());
+#else
+    mkdir(cacheDir.c_str(), 0755);
+#endif
+  }
+  std::cout << "Program binary cache " << (binariesSupported ? "enabled" : "unsupported")
+            << ", parallel shader compile " << (parallelCompileSupported ? "enabled" : "unsupported")
+            << std::endl;
+}
+
+int ProgramCache::submit(const GLchar *vertexPath, const GLchar *fragmentPath) {
+  Program program;
+  program.vertexPath = vertexPath;
+  program.fragmentPath = fragmentPath;
+  program.vertexCode = readShaderFile(vertexPath);
+  program.fragmentCode = readShaderFile(fragmentPath);
+
+  uint64_t h = 14695981039346656037ull;
+  h = hashString(h, program.vertexCode);
+  h = hashString(h, program.fragmentCode);
+  h = hashString(h, driverString);
+  char hashHex[17];
+  snprintf(hashHex, sizeof(hashHex), "%016llx", (unsigned long long)h);
+  program.cacheFile = cacheDir + "/" + hashHex + ".bin";
+
+  if (binariesSupported) {
+    const auto start = std::chrono::high_resolution_clock::now();
+    readCacheFile(&program);
+    cacheLoadTime += std::chrono::high_resolution_clock::now() - start;
+  }
+  programs.push_back(std::move(program));
+  return programs.size() - 1;
+}
+
+void ProgramCache::startProgram(Program &program) {
+  const auto start = std::chrono::high_resolution_clock::now();
+  if (!program.cachedBinary.empty() && loadFromCache(&program)) {
+    program.fromCache = true;
+    numCacheHits++;
+    cacheLoadTime += std::chrono::high_resolution_clock::now() - start;
+  } else {
+    // Don't query any status here, that would serialise the compiles.
+    program.vertexShader = compileShader(GL_VERTEX_SHADER, program.vertexCode);
+    program.fragmentShader = compileShader(GL_FRAGMENT_SHADER, program.fragmentCode);
+    program.id = glCreateProgram();
+    glAttachShader(program.id, program.vertexShader);
+    glAttachShader(program.id, program.fragmentShader);
+    if (binariesSupported) {
+      programParameteri(program.id, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    }
+    glLinkProgram(program.id);
+    numCompiled++;
+    compileTime += std::chrono::high_resolution_clock::now() - start;
+  }
+  program.vertexCode = std::string();
+  program.fragmentCode = std::string();
+  program.cachedBinary = std::vector<char>();
+}
+
+void ProgramCache::finish() {
+  for (Program &program : programs) {
+    startProgram(program);
+  }
+  const auto start = std::chrono::high_resolution_clock::now();
+  std::vector<Program *> pending;
+  for (Program &program : programs) {
+    if (!program.fromCache) {
+      pending.push_back(&program);
+    }
+  }
+  while (!pending.empty()) {
+    for (int i = pending.size() - 1; i >= 0; --i) {
+      int done = GL_TRUE;
+      if (parallelCompileSupported) {
+        // Non-blocking, unlike GL_LINK_STATUS.
+        glGetProgramiv(pending[i]->id, GL_COMPLETION_STATUS_KHR, &done);
+      }
+      if (done) {
+        finishProgram(*pending[i]);
+        pending.erase(pending.begin() + i);
+      }
+    }
+    if (!pending.empty()) {
+      std::this_thread::yield();
+    }
+  }
+  compileTime += std::chrono::high_resolution_clock::now() - start;
+  finished = true;
+}
+
+void ProgramCache::finishProgram(Program &program) {
+  if (!checkShaderCompilation(program.vertexShader) ||
+      !checkShaderCompilation(program.fragmentShader) ||
+      !checkProgramLinking(program.id)) {
+    std::cout << "  in " << program.vertexPath << " / " << program.fragmentPath << std::endl;
+    exit(1);
+  }
+  glDeleteShader(program.vertexShader);
+  glDeleteShader(program.fragmentShader);
+  if (binariesSupported) {
+    writeToCache(program);
+  }
+}
+
+Shader ProgramCache::get(int handle) const {
+  if (!finished) {
+    std::cerr << "ProgramCache::get called before finish" << std::endl;
+    exit(1);
+  }
+  return Shader(programs[handle].id);
+}
+
+void ProgramCache::logStats() const {
+  const auto ms = [](std::chrono::high_resolution_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+  };
+  std::cout << "Shader programs (" << (numCompiled == 0 ? "warm" : "cold") << " start): "
+            << numCacheHits << " from cache in " << ms(cacheLoadTime) << "ms, "
+            << numCompiled << " compiled in " << ms(compileTime) << "ms" << std::endl;
+}
+
+void ProgramCache::readCacheFile(Program *program) {
+  std::ifstream file(program->cacheFile, std::ios::binary);
+  if (!file) {
+    return;
+  }
+  file.read((char *)&program->cachedFormat, sizeof(program->cachedFormat));
+  // The iterators read the buffer directly and never set eofbit, so only a
+  // short header read shows in the stream state.
+  std::vector<char> binary((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (file) {
+    program->cachedBinary = std::move(binary);
+  }
+}
+
+bool ProgramCache::loadFromCache(Program *program) {
+  const unsigned int id = glCreateProgram();
+  programBinary(id, program->cachedFormat, program->cachedBinary.data(),
+                program->cachedBinary.size());
+  int success = 0;
+  glGetProgramiv(id, GL_LINK_STATUS, &success);
+  if (!success) {
+    // Stale or rejected by the driver, fall back to compiling.
+    glstate::deleteProgram(id);
+    return false;
+  }
+  program->id = id;
+  return true;
+}
+
+void ProgramCache::writeToCache(const Program &program) {
+  int length = 0;
+  glGetProgramiv(program.id, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) {
+    return;
+  }
+  std::vector<char> binary(length);
+  GLenum format = 0;
+  getProgramBinary(program.id, length, nullptr, &format, binary.data());
+  std::ofstream file(program.cacheFile, std::ios::binary | std::ios::trunc);
+  if (!file) {
+    std::cerr << "Couldn't write program cache file " << program.cacheFile << std::endl;
+    return;
+  }
+  file.write((const char *)&format, sizeof(format));
+  file.write(binary.data(), binary.size());
+}
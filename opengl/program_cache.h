@@ -0,0 +1,76 @@
+#ifndef SD_PROGRAM_CACHE_H_
+#define SD_PROGRAM_CACHE_H_
+
+#include <glad/glad.h>
+
+#include <chrono>
+#include <string>
+#include <vector>
+
+#include "opengl/shader.h"
+
+// Builds shader programs in a batch. Linked program binaries are kept on disk
+// (keyed by source and driver) and reloaded with glProgramBinary on later
+// runs. Programs that miss the cache are all submitted before any status is
+// queried so that drivers with KHR_parallel_shader_compile can overlap them.
+//
+// Usage: submit() everything, finish() once, then get() each program.
+// submit() only touches files, so it can run on a worker thread (one at a
+// time) while finish() runs on the thread that owns the context.
+class ProgramCache {
+public:
+  // loadProc is used to resolve entry points that aren't part of the GL 3.3
+  // core set glad was generated for. cacheDir is created if missing.
+  ProgramCache(GLADloadproc loadProc, std::string cacheDir);
+
+  // Reads the sources and any cached binary for them. Returns a handle to
+  // pass to get() after finish().
+  int submit(const GLchar *vertexPath, const GLchar *fragmentPath);
+
+  // Loads the cached binaries, compiles the rest, waits for every program,
+  // exits on compile/link failure, and writes newly linked programs back to
+  // the cache.
+  void finish();
+
+  Shader get(int handle) const;
+
+  // Logs how many programs came from the cache vs the compiler, and how long
+  // each path took.
+  void logStats() const;
+
+private:
+  struct Program {
+    std::string vertexPath;
+    std::string fragmentPath;
+    std::string cacheFile;
+    // Dropped once the program is built.
+    std::string vertexCode;
+    std::string fragmentCode;
+    GLenum cachedFormat = 0;
+    std::vector<char> cachedBinary;
+    unsigned int id = 0;
+    unsigned int vertexShader = 0;
+    unsigned int fragmentShader = 0;
+    bool fromCache = false;
+  };
+
+  void startProgram(Program &program);
+  void finishProgram(Program &program);
+  void readCacheFile(Program *program);
+  bool loadFromCache(Program *program);
+  void writeToCache(const Program &program);
+
+  const std::string cacheDir;
+  std::string driverString;
+  bool binariesSupported = false;
+  bool parallelCompileSupported = false;
+  std::vector<Program> programs;
+  bool finished = false;
+
+  int numCacheHits = 0;
+  int numCompiled = 0;
+  std::chrono::high_resolution_clock::duration cacheLoadTime{0};
+  std::chrono::high_resolution_clock::duration compileTime{0};
+};
+
+#endif // SD_PROGRAM_CACHE_H_
@@ -0,0 +1,214 @@
+#include "opengl/render_queue.h"
+
+#include <algorithm>
+#include <iostream>
+
+#include "glm/gtc/type_ptr.hpp"
+#include "opengl/gl_state.h"
+
+namespace {
+
+const int layerBits = 4;
+const int programBits = 8;
+const int materialBits = 12;
+const int vaoBits = 16;
+const int depthBits = 24;
+
+uint64_t field(uint64_t value, int bits) {
+  return value & ((uint64_t(1) << bits) - 1);
+}
+
+} // namespace
+
+int RenderQueue::addMaterial(unsigned int program,
+                             std::vector<std::pair<std::string, int>> intUniforms,
+                             std::vector<std::pair<std::string, float>> floatUniforms,
+                             bool blend, bool depthWrite) {
+  int programIndex = -1;
+  for (int i = 0; i < programs.size(); ++i) {
+    if (programs[i].id == program) {
+      programIndex = i;
+    }
+  }
+  if (programIndex < 0) {
+    ProgramState p;
+    p.id = program;
+    p.modelLocation = glGetUniformLocation(program, "model");
+    p.aimRotLocation = glGetUniformLocation(program, "aimRot");
+    p.ageLocation = glGetUniformLocation(program, "age");
+    programs.push_back(p);
+    programIndex = programs.size() - 1;
+  }
+  if (programs.size() > (1 << programBits) || materials.size() >= (1 << materialBits)) {
+    std::cerr << "Too many programs or materials for the render queue key" << std::endl;
+    exit(1);
+  }
+
+  MaterialState m;
+  m.program = programIndex;
+  for (const auto &u : intUniforms) {
+    m.ints.emplace_back(glGetUniformLocation(program, u.first.c_str()), u.second);
+  }
+  for (const auto &u : floatUniforms) {
+    m.floats.emplace_back(glGetUniformLocation(program, u.first.c_str()), u.second);
+  }
+  m.blend = blend;
+  m.depthWrite = depthWrite;
+  materials.push_back(m);
+  return materials.size() - 1;
+}
+
+void RenderQueue::reserve(const int draws) {
+  transforms.reserve(draws);
+  items.reserve(draws);
+  keys.reserve(draws);
+  order.reserve(draws);
+  scratchKeys.reserve(draws);
+  scratchOrder.reserve(draws);
+}
+
+int RenderQueue::addTransform(const glm::mat4 &m) {
+  transforms.push_back(m);
+  return transforms.size() - 1;
+}
+
+void RenderQueue::submit(int material, const Draw &draw, float viewDepth) {
+  const MaterialState &m = materials[material];
+  const float d = std::min(std::max(viewDepth / maxDepth, 0.0f), 1.0f);
+  const uint64_t depth = (uint64_t)(d * ((1 << depthBits) - 1));
+  const uint64_t state = (field(m.program, programBits) << (materialBits + vaoBits)) |
+                         (field(material, materialBits) << vaoBits) |
+                         field(draw.vao, vaoBits);
+  const uint64_t translucentLayer = 1;
+  uint64_t key;
+  if (m.blend && sortTranslucent) {
+    const uint64_t farFirst = field(~depth, depthBits);
+    key = (translucentLayer << (64 - layerBits)) |
+          (farFirst << (64 - layerBits - depthBits)) | state;
+  } else {
+    key = (state << depthBits) | depth;
+    if (m.blend) {
+      key |= translucentLayer << (64 - layerBits);
+    }
+  }
+
+  Item item;
+  item.material = material;
+  item.draw = draw;
+  items.push_back(item);
+  keys.push_back(key);
+}
+
+// LSD radix sort on bytes, skipping bytes every key agrees on (most of the
+// high ones, usually).
+void RenderQueue::sortKeys() {
+  const int n = keys.size();
+  order.resize(n);
+  for (int i = 0; i < n; ++i) {
+    order[i] = i;
+  }
+  scratchKeys.resize(n);
+  scratchOrder.resize(n);
+  for (int shift = 0; shift < 64; shift += 8) {
+    int counts[256] = {0};
+    for (int i = 0; i < n; ++i) {
+      counts[(keys[i] >> shift) & 0xff]++;
+    }
+    if (n == 0 || counts[(keys[0] >> shift) & 0xff] == n) {
+      continue;
+    }
+    int offset = 0;
+    for (int b = 0; b < 256; ++b) {
+      const int c = counts[b];
+      counts[b] = offset;
+      offset += c;
+    }
+    for (int i = 0; i < n; ++i) {
+      const int dst = counts[(keys[i] >> shift) & 0xff]++;
+      scratchKeys[dst] = keys[i];
+      scratchOrder[dst] = order[i];
+    }
+    keys.swap(scratchKeys);
+    order.swap(scratchOrder);
+  }
+}
+
+void RenderQueue::applyMaterial(const MaterialState &m) const {
+  for (const auto &u : m.ints) {
+    glUniform1i(u.first, u.second);
+  }
+  for (const auto &u : m.floats) {
+    glUniform1f(u.first, u.second);
+  }
+  if (m.blend) {
+    glstate::enable(GL_BLEND);
+  } else {
+    glstate::disable(GL_BLEND);
+  }
+  glstate::depthMask(m.depthWrite);
+}
+
+void RenderQueue::flush() {
+  stats = Stats();
+  stats.draws = items.size();
+  for (int i = 1; i < items.size(); ++i) {
+    const Item &a = items[i - 1];
+    const Item &b = items[i];
+    stats.unsortedChanges += (materials[a.material].program != materials[b.material].program) +
+                             (a.material != b.material) + (a.draw.vao != b.draw.vao);
+  }
+  if (!items.empty()) {
+    stats.unsortedChanges += 3;
+  }
+
+  sortKeys();
+
+  int program = -1;
+  int material = -1;
+  unsigned int vao = 0;
+  for (const uint32_t index : order) {
+    const Item &item = items[index];
+    const MaterialState &m = materials[item.material];
+    const ProgramState &p = programs[m.program];
+    if (m.program != program) {
+      glstate::useProgram(p.id);
+      program = m.program;
+      stats.programChanges++;
+    }
+    if (item.material != material) {
+      applyMaterial(m);
+      material = item.material;
+      stats.materialChanges++;
+    }
+    const Draw &d = item.draw;
+    if (d.vao != vao) {
+      glstate::bindVertexArray(d.vao);
+      vao = d.vao;
+      stats.vaoChanges++;
+    }
+    if (d.transform >= 0) {
+      glUniformMatrix4fv(p.modelLocation, 1, GL_FALSE, glm::value_ptr(transforms[d.transform]));
+    }
+    if (d.aimRot >= 0) {
+      glUniformMatrix4fv(p.aimRotLocation, 1, GL_FALSE, glm::value_ptr(transforms[d.aimRot]));
+    }
+    if (p.ageLocation >= 0) {
+      glUniform1f(p.ageLocation, d.age);
+    }
+    if (d.indexed) {
+      glDrawElements(d.mode, d.count, d.indexType,
+                     (void *)(d.firstIndex * (d.indexType == GL_UNSIGNED_SHORT
+                                                  ? sizeof(GLushort)
+                                                  : sizeof(GLuint))));
+    } else {
+      glDrawArrays(d.mode, 0, d.count);
+    }
+  }
+
+  glstate::disable(GL_BLEND);
+  glstate::depthMask(true);
+
+  items.clear();
+  keys.clear();
+  transforms.clear();
+}
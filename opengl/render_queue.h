@@ -0,0 +1,117 @@
+#ifndef SD_RENDER_QUEUE_H_
+#define SD_RENDER_QUEUE_H_
+
+#include <glad/glad.h>
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "glm/glm.hpp"
+
+// Collects a pass's draws, sorts them on a packed 64 bit key and submits them
+// switching program, material and VAO only when they change.
+//
+// Key layout, most significant bits first:
+//   opaque:      layer:4 | program:8 | material:12 | vao:16 | depth:24
+//   translucent: layer:4 | ~depth:24 | program:8 | material:12 | vao:16
+// so opaque draws are grouped by state and then go front to back, while
+// translucent draws go back to front after all opaque ones. Queues whose
+// translucent draws blend order-independently (weighted blended OIT, say)
+// don't need them sorted, and key them like opaque draws in their layer:
+//   unsorted:    layer:4 | program:8 | material:12 | vao:16 | depth:24
+//
+// Per-program uniforms (PV, lights, ...) are still set by the caller before
+// flush(); the queue only sets the per-draw "model", "aimRot" and "age".
+class RenderQueue {
+public:
+  // One draw call. transform and aimRot are indices from addTransform(), or -1
+  // to leave the uniform alone.
+  struct Draw {
+    unsigned int vao = 0;
+    GLenum mode = GL_TRIANGLES;
+    int count = 0;
+    bool indexed = false;
+    GLenum indexType = GL_UNSIGNED_INT;
+    // Offset into the element buffer, in indices.
+    int firstIndex = 0;
+    int transform = -1;
+    int aimRot = -1;
+    float age = 0.0f;
+  };
+
+  struct Stats {
+    int draws = 0;
+    int programChanges = 0;
+    int materialChanges = 0;
+    int vaoChanges = 0;
+    // Program + material + VAO changes the same draws would have needed in
+    // submission order.
+    int unsortedChanges = 0;
+  };
+
+  // Draws further than maxDepth from the camera all share the last depth
+  // bucket. With sortTranslucent off, translucent draws are grouped by state
+  // like opaque ones.
+  explicit RenderQueue(float maxDepth, bool sortTranslucent = true)
+      : maxDepth(maxDepth), sortTranslucent(sortTranslucent) {}
+
+  // A material is a program plus the uniforms (samplers and the like) and
+  // blend state its draws share. Blended materials go in the translucent
+  // layer. Returns the material id to submit with.
+  int addMaterial(unsigned int program,
+                  std::vector<std::pair<std::string, int>> intUniforms,
+                  std::vector<std::pair<std::string, float>> floatUniforms = {},
+                  bool blend = false, bool depthWrite = true);
+
+  // Sizes the per-frame storage for this many draws (and transforms), so
+  // frames up to it don't allocate.
+  void reserve(int draws);
+
+  int addTransform(const glm::mat4 &m);
+  // viewDepth is the draw's distance from the camera.
+  void submit(int material, const Draw &draw, float viewDepth);
+  // Sorts and issues everything submitted since the last flush.
+  void flush();
+
+  const Stats &lastFlushStats() const { return stats; }
+
+private:
+  struct ProgramState {
+    unsigned int id;
+    int modelLocation;
+    int aimRotLocation;
+    int ageLocation;
+  };
+  struct MaterialState {
+    int program;
+    std::vector<std::pair<int, int>> ints; // location, value
+    std::vector<std::pair<int, float>> floats;
+    bool blend;
+    bool depthWrite;
+  };
+  struct Item {
+    int material;
+    Draw draw;
+  };
+
+  void sortKeys();
+  void applyMaterial(const MaterialState &m) const;
+
+  const float maxDepth;
+  const bool sortTranslucent;
+  std::vector<ProgramState> programs;
+  std::vector<MaterialState> materials;
+  std::vector<glm::mat4> transforms;
+  std::vector<Item> items;
+  // keys is parallel to items; sorting permutes keys and order (item indices)
+  // together.
+  std::vector<uint64_t> keys;
+  std::vector<uint32_t> order;
+  std::vector<uint64_t> scratchKeys;
+  std::vector<uint32_t> scratchOrder;
+  Stats stats;
+};
+
+#endif // SD_RENDER_QUEUE_H_
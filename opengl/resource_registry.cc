@@ -0,0 +1,165 @@
+#include "opengl/resource_registry.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+
+namespace resources {
+namespace {
+
+struct Record {
+  long long bytes;
+  const char *tag;
+};
+
+struct TagUsage {
+  Usage byKind[NUM_KINDS];
+  long long bytes = 0;
+  long long peakBytes = 0;
+};
+
+const char *const kindNames[NUM_KINDS] = {"buffers", "textures", "renderbuffers", "cpu"};
+
+std::unordered_map<uint64_t, Record> &records() {
+  static std::unordered_map<uint64_t, Record> r;
+  return r;
+}
+
+// Ordered so dumps are stable. Transparent so lookups don't build strings.
+std::map<std::string, TagUsage, std::less<>> &tags() {
+  static std::map<std::string, TagUsage, std::less<>> t;
+  return t;
+}
+
+Usage totals[NUM_KINDS];
+
+uint64_t key(Kind kind, uint64_t id) { return (id << 2) | kind; }
+
+void adjust(Kind kind, const char *tag, long long bytes, int objects) {
+  auto found = tags().find(tag);
+  if (found == tags().end()) {
+    found = tags().emplace(tag, TagUsage()).first;
+  }
+  TagUsage &t = found->second;
+  for (Usage *u : {&t.byKind[kind], &totals[kind]}) {
+    u->bytes += bytes;
+    u->objects += objects;
+    u->peakBytes = std::max(u->peakBytes, u->bytes);
+  }
+  t.bytes += bytes;
+  t.peakBytes = std::max(t.peakBytes, t.bytes);
+}
+
+void add(Kind kind, uint64_t id, long long bytes, const char *tag) {
+  // Streamed buffers are re-tracked every frame, which shouldn't allocate.
+  auto found = records().find(key(kind, id));
+  if (found == records().end()) {
+    records().emplace(key(kind, id), Record{bytes, tag});
+    adjust(kind, tag, bytes, 1);
+    return;
+  }
+  Record &r = found->second;
+  if (strcmp(r.tag, tag) == 0) {
+    adjust(kind, tag, bytes - r.bytes, 0);
+    r.bytes = bytes;
+  } else {
+    adjust(kind, r.tag, -r.bytes, -1);
+    adjust(kind, tag, bytes, 1);
+    r = {bytes, tag};
+  }
+}
+
+void remove(Kind kind, uint64_t id) {
+  auto it = records().find(key(kind, id));
+  if (it != records().end()) {
+    adjust(kind, it->second.tag, -it->second.bytes, -1);
+    records().erase(it);
+  }
+}
+
+std::string formatBytes(long long bytes) {
+  std::ostringstream out;
+  out << std::fixed << std::setprecision(1);
+  if (bytes >= (1 << 20)) {
+    out << bytes / (double)(1 << 20) << "MB";
+  } else {
+    out << bytes / 1024.0 << "KB";
+  }
+  return out.str();
+}
+
+} // namespace
+
+void track(Kind kind, unsigned int id, long long bytes, const char *tag) {
+  add(kind, id, bytes, tag);
+}
+
+void untrack(Kind kind, unsigned int id) { remove(kind, id); }
+
+void trackCpu(const void *owner, long long bytes, const char *tag) {
+  add(CPU, (uintptr_t)owner, bytes, tag);
+}
+
+void untrackCpu(const void *owner) { remove(CPU, (uintptr_t)owner); }
+
+Usage usage(const char *tag, Kind kind) {
+  auto it = tags().find(tag);
+  return it == tags().end() ? Usage() : it->second.byKind[kind];
+}
+
+long long totalBytes(Kind kind) { return totals[kind].bytes; }
+
+int bytesPerPixel(GLenum internalFormat) {
+  switch (internalFormat) {
+  case GL_R8:
+  case GL_RED:
+    return 1;
+  case GL_DEPTH_COMPONENT16:
+  case GL_R16F:
+    return 2;
+  case GL_RGBA16F:
+  case GL_RGB16F:
+    return 8;
+  case GL_RGBA32F:
+  case GL_RGB32F:
+    return 16;
+  default:
+    return 4;
+  }
+}
+
+long long textureBytes(GLenum internalFormat, int width, int height, int depth,
+                       bool mipmapped) {
+  const long long base = (long long)width * height * depth * bytesPerPixel(internalFormat);
+  return mipmapped ? base * 4 / 3 : base;
+}
+
+void dump() {
+  std::cout << "Resource memory (live / peak, objects):" << std::endl;
+  for (const auto &entry : tags()) {
+    const TagUsage &t = entry.second;
+    std::cout << "  " << entry.first << ": " << formatBytes(t.bytes) << " / "
+              << formatBytes(t.peakBytes) << std::endl;
+    for (int kind = 0; kind < NUM_KINDS; ++kind) {
+      const Usage &u = t.byKind[kind];
+      if (u.peakBytes > 0 || u.objects > 0) {
+        std::cout << "    " << kindNames[kind] << ": " << formatBytes(u.bytes) << " / "
+                  << formatBytes(u.peakBytes) << ", " << u.objects << std::endl;
+      }
+    }
+  }
+  std::cout << "  total:";
+  for (int kind = 0; kind < NUM_KINDS; ++kind) {
+    std::cout << " " << kindNames[kind] << " " << formatBytes(totals[kind].bytes) << " / "
+              << formatBytes(totals[kind].peakBytes);
+  }
+  std::cout << std::endl;
+}
+
+} // namespace resources
@@ -0,0 +1,49 @@
+#ifndef SD_RESOURCE_REGISTRY_H_
+#define SD_RESOURCE_REGISTRY_H_
+
+#include <glad/glad.h>
+
+// Tallies the memory held by GL objects, and the CPU copies kept alongside
+// them, by owning subsystem. Owners report sizes when they (re)specify
+// storage and untrack on delete, so anything still listed at exit leaked.
+//
+// Tags name the subsystem and must outlive the program; use string literals.
+// Not thread safe; call from the GL thread.
+namespace resources {
+
+enum Kind {
+  BUFFER,
+  TEXTURE,
+  RENDERBUFFER,
+  // Not a GL object; keyed by the owner's address.
+  CPU,
+  NUM_KINDS,
+};
+
+// Replaces whatever was recorded for the object, so respecified storage
+// (streamed buffers, resized targets) is just tracked again.
+void track(Kind kind, unsigned int id, long long bytes, const char *tag);
+void untrack(Kind kind, unsigned int id);
+void trackCpu(const void *owner, long long bytes, const char *tag);
+void untrackCpu(const void *owner);
+
+struct Usage {
+  long long bytes = 0;
+  long long peakBytes = 0;
+  int objects = 0;
+};
+Usage usage(const char *tag, Kind kind);
+long long totalBytes(Kind kind);
+
+// Rough, drivers are free to pad. Unsized formats count as 8 bits a channel.
+int bytesPerPixel(GLenum internalFormat);
+// A full mip chain adds about a third.
+long long textureBytes(GLenum internalFormat, int width, int height, int depth,
+                       bool mipmapped);
+
+// Prints live and peak usage per tag and kind.
+void dump();
+
+} // namespace resources
+
+#endif // SD_RESOURCE_REGISTRY_H_
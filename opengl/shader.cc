@@ -1,6 +1,21 @@
 #include "opengl/shader.h"
 
-namespace {
+#include "opengl/gl_state.h"
+
+std::string readShaderFile(const std::string &path) {
+  std::ifstream file;
+  // ensure ifstream objects can throw exceptions:
+  file.exceptions(std::ifstream::failbit | std::ifstream::badbit);
+  try {
+    file.open(path);
+    std::stringstream stream;
+    stream << file.rdbuf();
+    return stream.str();
+  } catch (const std::ifstream::failure &e) {
+    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ " << path << std::endl;
+    exit(1);
+  }
+}
 
 // Returns true iff successful
 bool checkShaderCompilation(const unsigned int shaderId) {
@@ -27,36 +42,11 @@ bool checkProgramLinking(const unsigned int programId) {
   return success == 1;
 }
 
-} // namespace
-
 // static
 Shader Shader::create(const GLchar *vertexPath, const GLchar *fragmentPath) {
   // 1. retrieve the vertex/fragment source code from filePath
-  std::string vertexCode;
-  std::string fragmentCode;
-  std::ifstream vShaderFile;
-  std::ifstream fShaderFile;
-  // ensure ifstream objects can throw exceptions:
-  vShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  fShaderFile.exceptions(std::ifstream::failbit | std::ifstream::badbit);
-  try {
-    // open files
-    vShaderFile.open(vertexPath);
-    fShaderFile.open(fragmentPath);
-    std::stringstream vShaderStream, fShaderStream;
-    // read file's buffer contents into streams
-    vShaderStream << vShaderFile.rdbuf();
-    fShaderStream << fShaderFile.rdbuf();
-    // close file handlers
-    vShaderFile.close();
-    fShaderFile.close();
-    // convert stream into string
-    vertexCode = vShaderStream.str();
-    fragmentCode = fShaderStream.str();
-  } catch (std::ifstream::failure e) {
-    std::cout << "ERROR::SHADER::FILE_NOT_SUCCESFULLY_READ" << std::endl;
-    exit(1);
-  }
+  const std::string vertexCode = readShaderFile(vertexPath);
+  const std::string fragmentCode = readShaderFile(fragmentPath);
   const char *vShaderCode = vertexCode.c_str();
   const char *fShaderCode = fragmentCode.c_str();
 
@@ -85,7 +75,7 @@ Shader Shader::create(const GLchar *vertexPath, const GLchar *fragmentPath) {
   return Shader(shaderProgram);
 }
 
-void Shader::use() const { glUseProgram(id); }
+void Shader::use() const { glstate::useProgram(id); }
 
 void Shader::setBool(const std::string &name, bool value) const {
   const int loc = glGetUniformLocation(id, name.c_str());
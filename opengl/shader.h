@@ -10,6 +10,13 @@
 
 #include "glm/glm.hpp"
 
+// Returns the whole file, exiting if it can't be read.
+std::string readShaderFile(const std::string &path);
+
+// Both return true iff successful, logging the info log otherwise.
+bool checkShaderCompilation(const unsigned int shaderId);
+bool checkProgramLinking(const unsigned int programId);
+
 class Shader {
 public:
   // the program ID
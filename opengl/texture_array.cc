@@ -0,0 +1,92 @@
+#include "opengl/texture_array.h"
+
+#include <glad/glad.h>
+
+#include <iostream>
+
+#include "opengl/gl_state.h"
+#include "opengl/resource_registry.h"
+
+namespace {
+
+GLenum formatFor(int nrComponents) {
+  switch (nrComponents) {
+  case 1:
+    return GL_RED;
+  case 3:
+    return GL_RGB;
+  default:
+    return GL_RGBA;
+  }
+}
+
+} // namespace
+
+TextureLayer TextureArrayPool::add(int width, int height, int nrComponents,
+                                   const unsigned char *data) {
+  TextureLayer result;
+  for (int i = 0; i < arrays.size(); ++i) {
+    const Array &a = arrays[i];
+    if (a.width == width && a.height == height && a.nrComponents == nrComponents) {
+      result.array = i;
+    }
+  }
+  if (result.array < 0) {
+    Array a;
+    a.width = width;
+    a.height = height;
+    a.nrComponents = nrComponents;
+    arrays.push_back(a);
+    result.array = arrays.size() - 1;
+  }
+  Array &a = arrays[result.array];
+  result.layer = a.layers.size();
+  a.layers.push_back(data);
+  a.numLayers++;
+  return result;
+}
+
+void TextureArrayPool::build(int _firstUnit) {
+  firstUnit = _firstUnit;
+  int maxUnits;
+  glGetIntegerv(GL_MAX_TEXTURE_IMAGE_UNITS, &maxUnits);
+  if (firstUnit + (int)arrays.size() > maxUnits) {
+    std::cerr << "Texture arrays need " << arrays.size() << " units from "
+              << firstUnit << ", only " << maxUnits << " available" << std::endl;
+    exit(1);
+  }
+  // Rows of 1 and 3 component images aren't 4 byte aligned in general.
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < arrays.size(); ++i) {
+    Array &a = arrays[i];
+    const GLenum format = formatFor(a.nrComponents);
+    glGenTextures(1, &a.id);
+    glstate::bindTexture(unit(i), GL_TEXTURE_2D_ARRAY, a.id);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, format, a.width, a.height,
+                 a.layers.size(), 0, format, GL_UNSIGNED_BYTE, NULL);
+    resources::track(resources::TEXTURE, a.id,
+                     resources::textureBytes(format, a.width, a.height, a.layers.size(), true),
+                     "materials");
+    for (int layer = 0; layer < a.layers.size(); ++layer) {
+      glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, a.width, a.height, 1,
+                      format, GL_UNSIGNED_BYTE, a.layers[layer]);
+    }
+    glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER,
+                    GL_LINEAR_MIPMAP_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    a.layers.clear();
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+}
+
+void TextureArrayPool::logStats() const {
+  std::cout << "Texture arrays:" << std::endl;
+  for (int i = 0; i < arrays.size(); ++i) {
+    const Array &a = arrays[i];
+    std::cout << "  unit " << unit(i) << ": " << a.width << "x" << a.height
+              << "x" << a.nrComponents << ", " << a.numLayers << " layers" << std::endl;
+  }
+}
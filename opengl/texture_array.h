@@ -0,0 +1,43 @@
+#ifndef SD_TEXTURE_ARRAY_H_
+#define SD_TEXTURE_ARRAY_H_
+
+#include <vector>
+
+// Where a texture ended up: which GL_TEXTURE_2D_ARRAY and which layer of it.
+struct TextureLayer {
+  int array = -1;
+  int layer = 0;
+};
+
+// Packs decoded images into texture arrays, one per distinct size and channel
+// count, so draws with different textures can share a sampler binding and
+// pick a layer instead of rebinding.
+class TextureArrayPool {
+public:
+  // data must stay valid until build(). Makes no GL calls.
+  TextureLayer add(int width, int height, int nrComponents,
+                   const unsigned char *data);
+  // Creates and fills the arrays, binding array i to unit firstUnit + i.
+  void build(int firstUnit);
+
+  int numArrays() const { return arrays.size(); }
+  int unit(int array) const { return firstUnit + array; }
+
+  void logStats() const;
+
+private:
+  struct Array {
+    int width;
+    int height;
+    int nrComponents;
+    // Cleared once uploaded.
+    std::vector<const unsigned char *> layers;
+    int numLayers = 0;
+    unsigned int id = 0;
+  };
+
+  std::vector<Array> arrays;
+  int firstUnit = 0;
+};
+
+#endif // SD_TEXTURE_ARRAY_H_